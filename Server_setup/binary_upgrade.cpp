@@ -0,0 +1,190 @@
+#include "binary_upgrade.hpp"
+#include "../utils/logger.hpp"
+#include "cpu_affinity.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace
+{
+	const char *const LISTENERS_VAR = "WEBSERV_LISTENERS";
+	const char *const READY_VAR = "WEBSERV_READY_FD";
+	const int READY_TIMEOUT_MS = 10000;
+
+	std::string binary_path;
+	std::vector<BinaryUpgrade::Listener> inherited;
+	int ready_fd = -1;
+	bool inherited_loaded = false;
+
+	// Read what the old process left in the environment, once, and drop it
+	// so CGI scripts and later upgrades do not see it
+	void load_inherited()
+	{
+		if (inherited_loaded)
+			return;
+		inherited_loaded = true;
+
+		const char *ready = getenv(READY_VAR);
+		if (ready)
+		{
+			ready_fd = atoi(ready);
+			fcntl(ready_fd, F_SETFD, FD_CLOEXEC);
+		}
+		const char *list = getenv(LISTENERS_VAR);
+		std::string entries = list ? list : "";
+		size_t start = 0;
+		while (start < entries.size())
+		{
+			size_t end = entries.find(';', start);
+			if (end == std::string::npos)
+				end = entries.size();
+			std::string entry = entries.substr(start, end - start);
+			size_t first = entry.find(':');
+			size_t last = entry.rfind(':');
+			if (first != std::string::npos && last != first)
+			{
+				BinaryUpgrade::Listener listener;
+				listener.fd = atoi(entry.substr(0, first).c_str());
+				listener.host = entry.substr(first + 1, last - first - 1);
+				listener.port = entry.substr(last + 1);
+				// Back to close-on-exec, so CGI scripts do not get it
+				if (fcntl(listener.fd, F_SETFD, FD_CLOEXEC) != -1)
+					inherited.push_back(listener);
+			}
+			start = end + 1;
+		}
+		unsetenv(LISTENERS_VAR);
+		unsetenv(READY_VAR);
+	}
+}
+
+void BinaryUpgrade::remember_binary()
+{
+	char path[4096];
+	ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+
+	if (length > 0)
+		binary_path.assign(path, length);
+}
+
+bool BinaryUpgrade::spawn(const std::string &config_path, const std::vector<Listener> &listeners)
+{
+	if (binary_path.empty())
+	{
+		LOG_ERROR("Binary upgrade: the path of the running binary is unknown");
+		return false;
+	}
+	int ready[2];
+	if (pipe2(ready, O_CLOEXEC) == -1)
+	{
+		LOG_ERROR("Binary upgrade: pipe failed: " << std::strerror(errno));
+		return false;
+	}
+
+	// Everything exec() needs is built before fork(): the child of a
+	// threaded process may only make async-signal-safe calls
+	std::ostringstream names;
+	for (size_t i = 0; i < listeners.size(); ++i)
+		names << (i ? ";" : "") << listeners[i].fd << ":" << listeners[i].host << ":" << listeners[i].port;
+	std::ostringstream ready_name;
+	ready_name << READY_VAR << "=" << ready[1];
+	std::vector<std::string> env_strings;
+	for (char **env = environ; *env; ++env)
+	{
+		if (std::strncmp(*env, "WEBSERV_", 8) != 0)
+			env_strings.push_back(*env);
+	}
+	env_strings.push_back(std::string(LISTENERS_VAR) + "=" + names.str());
+	env_strings.push_back(ready_name.str());
+	std::vector<char *> envp;
+	for (size_t i = 0; i < env_strings.size(); ++i)
+		envp.push_back(const_cast<char *>(env_strings[i].c_str()));
+	envp.push_back(NULL);
+	char *argv[] = {const_cast<char *>(binary_path.c_str()), const_cast<char *>(config_path.c_str()), NULL};
+	sigset_t no_signals;
+	sigemptyset(&no_signals);
+	cpu_set_t all_cpus = CpuAffinity::original_cpus();
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		for (size_t i = 0; i < listeners.size(); ++i)
+			fcntl(listeners[i].fd, F_SETFD, 0);
+		fcntl(ready[1], F_SETFD, 0);
+		// The mask survives exec(); threaded mode blocks SIGHUP and SIGUSR2
+		sigprocmask(SIG_SETMASK, &no_signals, NULL);
+		// Nor should worker_cpu_affinity pin the new binary to this loop's CPU
+		sched_setaffinity(0, sizeof(all_cpus), &all_cpus);
+		execve(binary_path.c_str(), argv, &envp[0]);
+		_exit(127);
+	}
+	close(ready[1]);
+	if (pid == -1)
+	{
+		LOG_ERROR("Binary upgrade: fork failed: " << std::strerror(errno));
+		close(ready[0]);
+		return false;
+	}
+	LOG_INFO("Binary upgrade: started " << binary_path << " as pid " << pid);
+
+	struct pollfd wait_ready;
+	wait_ready.fd = ready[0];
+	wait_ready.events = POLLIN;
+	int polled;
+	do
+		polled = poll(&wait_ready, 1, READY_TIMEOUT_MS);
+	while (polled == -1 && errno == EINTR);
+	char byte;
+	bool up = polled == 1 && read(ready[0], &byte, 1) == 1;
+	close(ready[0]);
+	if (!up)
+	{
+		LOG_ERROR("Binary upgrade: the new process did not come up, still serving");
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		return false;
+	}
+	return true;
+}
+
+int BinaryUpgrade::take_inherited(const std::string &host, const std::string &port)
+{
+	load_inherited();
+	for (size_t i = 0; i < inherited.size(); ++i)
+	{
+		if (inherited[i].host == host && inherited[i].port == port)
+		{
+			int fd = inherited[i].fd;
+			inherited.erase(inherited.begin() + i);
+			return fd;
+		}
+	}
+	return -1;
+}
+
+void BinaryUpgrade::finish_startup()
+{
+	load_inherited();
+	for (size_t i = 0; i < inherited.size(); ++i)
+	{
+		LOG_INFO("Binary upgrade: closing inherited listener " << inherited[i].host << ":"
+				 << inherited[i].port << ", no longer configured");
+		close(inherited[i].fd);
+	}
+	inherited.clear();
+	if (ready_fd != -1)
+	{
+		char byte = 1;
+		if (write(ready_fd, &byte, 1) != 1)
+			LOG_WARN("Binary upgrade: could not tell the old process this one is up");
+		close(ready_fd);
+		ready_fd = -1;
+	}
+}
@@ -0,0 +1,41 @@
+#ifndef BINARY_UPGRADE_HPP
+# define BINARY_UPGRADE_HPP
+
+# include <string>
+# include <vector>
+
+// Zero-downtime binary upgrade (SIGUSR2). The running process starts its
+// binary again with the listening sockets left open across exec() and
+// named in WEBSERV_LISTENERS ("fd:host:port;..."). The new process adopts
+// them instead of binding, writes a byte to the WEBSERV_READY_FD pipe once
+// it serves, and only then does the old process stop accepting and drain.
+// Connections waiting in the backlog are never refused: the socket itself
+// changes hands.
+class BinaryUpgrade
+{
+  public:
+	struct Listener
+	{
+		int fd;
+		std::string host;
+		std::string port;
+	};
+
+	// Path of the running binary, read once at startup: a deploy replaces
+	// the file at that path
+	static void remember_binary();
+	// Start the new binary on `config_path` with `listeners` inherited.
+	// Returns true once it reported that it is serving.
+	static bool spawn(const std::string &config_path, const std::vector<Listener> &listeners);
+
+	// In the new process: the inherited socket for host:port, or -1
+	static int take_inherited(const std::string &host, const std::string &port);
+	// Close inherited sockets no server block claimed and tell the old
+	// process this one is up
+	static void finish_startup();
+
+  private:
+	BinaryUpgrade();
+};
+
+#endif
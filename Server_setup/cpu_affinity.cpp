@@ -0,0 +1,134 @@
+#include "cpu_affinity.hpp"
+#include "../config/parser.hpp"
+#include "../utils/logger.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+
+cpu_set_t CpuAffinity::startup_cpus;
+
+CpuAffinity::CpuAffinity() : pinned(false), loop(0), local(0), remote(0), unknown(0)
+{
+	CPU_ZERO(&cpus);
+}
+
+void CpuAffinity::remember_cpus()
+{
+	CPU_ZERO(&startup_cpus);
+	if (sched_getaffinity(0, sizeof(startup_cpus), &startup_cpus) == -1)
+		CPU_SET(0, &startup_cpus);
+}
+
+const cpu_set_t &CpuAffinity::original_cpus()
+{
+	return startup_cpus;
+}
+
+// auto: the index-th allowed CPU, wrapping around. Masks are binary, CPU 0
+// rightmost, one per loop; loops past the last mask use the last one.
+bool CpuAffinity::cpus_for(const GlobalContext &global, size_t index, cpu_set_t &set)
+{
+	const std::vector<std::string> &masks = global.cpuAffinity;
+
+	CPU_ZERO(&set);
+	if (masks.empty())
+		return false;
+	if (masks[0] == "auto")
+	{
+		int allowed = CPU_COUNT(&startup_cpus);
+		if (allowed == 0)
+			return false;
+		size_t skip = index % allowed;
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+		{
+			if (CPU_ISSET(cpu, &startup_cpus) && skip-- == 0)
+			{
+				CPU_SET(cpu, &set);
+				return true;
+			}
+		}
+		return false;
+	}
+	const std::string &mask = masks[index < masks.size() ? index : masks.size() - 1];
+	for (size_t bit = 0; bit < mask.size(); ++bit)
+	{
+		if (mask[mask.size() - 1 - bit] == '1')
+			CPU_SET(bit, &set);
+	}
+	return true;
+}
+
+int CpuAffinity::incoming_cpu(int fd)
+{
+	int cpu = -1;
+	socklen_t length = sizeof(cpu);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &length) == -1)
+		return -1;
+	return cpu;
+}
+
+void CpuAffinity::pin(const GlobalContext &global, size_t index)
+{
+	cpu_set_t set;
+
+	if (!cpus_for(global, index, set))
+		return;
+	if (sched_setaffinity(0, sizeof(set), &set) == -1)
+	{
+		LOG_WARN("worker_cpu_affinity: cannot pin event loop " << index << ": " << std::strerror(errno));
+		return;
+	}
+	assign(set, index);
+}
+
+void CpuAffinity::assign(const cpu_set_t &set, size_t index)
+{
+	cpus = set;
+	pinned = true;
+	loop = index;
+	LOG_DEBUG("Event loop " << index << " pinned to " << CPU_COUNT(&cpus) << " CPU(s)");
+}
+
+bool CpuAffinity::is_pinned() const
+{
+	return pinned;
+}
+
+int CpuAffinity::single_cpu() const
+{
+	if (!pinned || CPU_COUNT(&cpus) != 1)
+		return -1;
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+	{
+		if (CPU_ISSET(cpu, &cpus))
+			return cpu;
+	}
+	return -1;
+}
+
+void CpuAffinity::record(int fd)
+{
+	if (!pinned)
+		return;
+	int cpu = incoming_cpu(fd);
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+		unknown++;
+	else if (CPU_ISSET(cpu, &cpus))
+		local++;
+	else
+		remote++;
+}
+
+void CpuAffinity::print_stats() const
+{
+	if (!pinned)
+		return;
+	size_t known = local + remote;
+	LOG_INFO("[CPU] loop=" << loop
+			  << " cpu=" << single_cpu()
+			  << " local=" << local
+			  << " remote=" << remote
+			  << " unknown=" << unknown
+			  << " locality=" << (known ? local * 100 / known : 100) << "%");
+}
@@ -0,0 +1,48 @@
+#ifndef CPU_AFFINITY_HPP
+#define CPU_AFFINITY_HPP
+
+#include <cstddef>
+#include <sched.h>
+
+struct GlobalContext;
+
+// worker_cpu_affinity for one event loop: the CPUs it is pinned to and how
+// many of its connections had their packets received on one of them.
+// Pinning happens before the loop allocates its tables and buffers, so
+// Linux's first-touch policy places them on the local NUMA node.
+class CpuAffinity
+{
+  private:
+	cpu_set_t cpus;
+	bool pinned;
+	size_t loop;     // event loop number, for the stats line
+	size_t local;    // connections received on one of `cpus`
+	size_t remote;   // received on another CPU
+	size_t unknown;  // the kernel did not say
+
+	static cpu_set_t startup_cpus;
+
+  public:
+	CpuAffinity();
+
+	// Save the CPUs the process may run on, before anything is pinned:
+	// worker_cpu_affinity auto spreads loops over them
+	static void remember_cpus();
+	static const cpu_set_t &original_cpus();
+	// CPUs of event loop `index` under `global`; false when unset
+	static bool cpus_for(const GlobalContext &global, size_t index, cpu_set_t &set);
+	// CPU that received the connection's packets, or -1
+	static int incoming_cpu(int fd);
+
+	// Pin the calling thread as event loop `index`
+	void pin(const GlobalContext &global, size_t index);
+	// The thread was started on `set` already
+	void assign(const cpu_set_t &set, size_t index);
+	bool is_pinned() const;
+	// The one CPU the loop runs on, or -1
+	int single_cpu() const;
+	void record(int fd);
+	void print_stats() const;
+};
+
+#endif
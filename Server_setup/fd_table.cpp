@@ -0,0 +1,111 @@
+#include "fd_table.hpp"
+#include "../client/client.hpp"
+#include "load_limits.hpp"
+
+static const FdHandle unused_handle;
+
+FdTable::FdTable() : client_count(0)
+{
+}
+
+FdTable::~FdTable()
+{
+	for (size_t fd = 0; fd < handles.size(); ++fd)
+	{
+		if (handles[fd].client)
+		{
+			delete handles[fd].client;
+			LoadLimits::connection_closed();
+		}
+	}
+}
+
+FdHandle &FdTable::slot(int fd)
+{
+	if (static_cast<size_t>(fd) >= handles.size())
+		handles.resize(fd + 1);
+	return handles[fd];
+}
+
+const FdHandle &FdTable::get(int fd) const
+{
+	if (fd < 0 || static_cast<size_t>(fd) >= handles.size())
+		return unused_handle;
+	return handles[fd];
+}
+
+void FdTable::add_listener(int fd, ServerContext *config, int port)
+{
+	release(fd);
+	FdHandle &handle = slot(fd);
+	handle.kind = FD_LISTENER;
+	handle.config = config;
+	handle.port = port;
+}
+
+// The connection state is built in place on the heap, so the pointer stays
+// valid while the table grows. LoadLimits counted the connection when it
+// was accepted; it is uncounted when the client is released.
+Client *FdTable::add_client(int fd)
+{
+	release(fd);
+	FdHandle &handle = slot(fd);
+	handle.kind = FD_CLIENT;
+	handle.client = new Client();
+	client_count++;
+	return handle.client;
+}
+
+void FdTable::add_cgi(int fd)
+{
+	release(fd);
+	slot(fd).kind = FD_CGI;
+}
+
+void FdTable::add_wakeup(int fd)
+{
+	release(fd);
+	slot(fd).kind = FD_WAKEUP;
+}
+
+void FdTable::add_control(int fd)
+{
+	release(fd);
+	slot(fd).kind = FD_CONTROL;
+}
+
+void FdTable::add_signal(int fd)
+{
+	release(fd);
+	slot(fd).kind = FD_SIGNAL;
+}
+
+// Forget the fd. A client is destroyed, so callers must not touch it after.
+void FdTable::release(int fd)
+{
+	if (fd < 0 || static_cast<size_t>(fd) >= handles.size())
+		return;
+	FdHandle &handle = handles[fd];
+	if (handle.client)
+	{
+		delete handle.client;
+		client_count--;
+		LoadLimits::connection_closed();
+	}
+	handle = FdHandle();
+}
+
+Client *FdTable::find_client(int fd) const
+{
+	return get(fd).client;
+}
+
+size_t FdTable::clients() const
+{
+	return client_count;
+}
+
+int FdTable::capacity() const
+{
+	return static_cast<int>(handles.size());
+}
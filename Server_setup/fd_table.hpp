@@ -0,0 +1,63 @@
+#ifndef FD_TABLE_HPP
+#define FD_TABLE_HPP
+
+#include <cstddef>
+#include <vector>
+
+class Client;
+struct ServerContext;
+
+enum FdKind
+{
+	FD_UNUSED,
+	FD_LISTENER,
+	FD_CLIENT,
+	FD_CGI,
+	FD_WAKEUP,               // eventfd of the connection handoff queue
+	FD_CONTROL,              // eventfd announcing a reloaded config
+	FD_SIGNAL                // signalfd of a loop that runs the process
+};
+
+// What an fd is, found by indexing the table with the fd itself
+struct FdHandle
+{
+	FdKind kind;
+	Client *client;          // FD_CLIENT: owned by the table
+	ServerContext *config;   // FD_LISTENER: server block served on the socket
+	int port;                // FD_LISTENER
+
+	FdHandle() : kind(FD_UNUSED), client(NULL), config(NULL), port(0) {}
+};
+
+// Dense fd-indexed table of every fd the event loop watches. The kernel
+// hands out the lowest free fd, so the table stays as small as the highest
+// fd in use and dispatching an event is a single index.
+class FdTable
+{
+  private:
+	std::vector<FdHandle> handles;
+	size_t client_count;
+
+	FdHandle &slot(int fd);
+	FdTable(const FdTable &);
+	FdTable &operator=(const FdTable &);
+
+  public:
+	FdTable();
+	~FdTable();
+
+	const FdHandle &get(int fd) const;
+	void add_listener(int fd, ServerContext *config, int port);
+	Client *add_client(int fd);
+	void add_cgi(int fd);
+	void add_wakeup(int fd);
+	void add_control(int fd);
+	void add_signal(int fd);
+	void release(int fd);
+
+	Client *find_client(int fd) const;
+	size_t clients() const;
+	int capacity() const;
+};
+
+#endif
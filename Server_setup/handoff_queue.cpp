@@ -0,0 +1,135 @@
+#include "handoff_queue.hpp"
+#include <stdexcept>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+HandoffQueue::HandoffQueue() : head(&stub), tail(&stub)
+{
+	stub.fd = -1;
+	stub.config = NULL;
+	stub.peer = 0;
+	stub.next = NULL;
+	event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (event_fd == -1)
+		throw std::runtime_error("Failed to create eventfd for connection handoff");
+}
+
+// Only destroyed once every thread using it has stopped
+HandoffQueue::~HandoffQueue()
+{
+	int fd;
+	ServerContext *config;
+	uint32_t peer;
+
+	while (pop(fd, config, peer))
+		close(fd);
+	close(event_fd);
+}
+
+int HandoffQueue::get_event_fd() const
+{
+	return event_fd;
+}
+
+void HandoffQueue::push_node(Handoff *node)
+{
+	node->next = NULL;
+	__sync_synchronize();
+	Handoff *prev = __sync_lock_test_and_set(&head, node);
+	// Between the exchange and this store the consumer sees a gap and
+	// stops; the eventfd write that follows wakes it up again
+	prev->next = node;
+}
+
+void HandoffQueue::push(int fd, ServerContext *config, uint32_t peer)
+{
+	Handoff *node = new Handoff;
+	uint64_t one = 1;
+
+	node->fd = fd;
+	node->config = config;
+	node->peer = peer;
+	push_node(node);
+	if (write(event_fd, &one, sizeof(one)) != sizeof(one))
+	{
+		// Counter saturated: a wakeup is already pending
+	}
+}
+
+bool HandoffQueue::pop(int &fd, ServerContext *&config, uint32_t &peer)
+{
+	Handoff *node = tail;
+	Handoff *next = node->next;
+
+	if (node == &stub)
+	{
+		if (next == NULL)
+			return false;
+		tail = next;
+		node = next;
+		next = next->next;
+	}
+	if (next == NULL)
+	{
+		// node is the last one published: put the stub behind it so it can
+		// be unlinked, unless a producer is half way through a push
+		if (node != head)
+			return false;
+		push_node(&stub);
+		next = node->next;
+		if (next == NULL)
+			return false;
+	}
+	tail = next;
+	__sync_synchronize();
+	fd = node->fd;
+	config = node->config;
+	peer = node->peer;
+	delete node;
+	return true;
+}
+
+void HandoffQueue::clear_wakeup()
+{
+	uint64_t count;
+
+	if (read(event_fd, &count, sizeof(count)) != sizeof(count))
+	{
+		// Nothing pending
+	}
+}
+
+HandoffGroup::HandoffGroup() : next(0)
+{
+}
+
+// `cpu` is the one CPU the loop is pinned to, or -1
+void HandoffGroup::add(HandoffQueue *queue, int cpu)
+{
+	queues.push_back(queue);
+	if (cpu < 0)
+		return;
+	if (by_cpu.size() <= static_cast<size_t>(cpu))
+		by_cpu.resize(cpu + 1);
+	by_cpu[cpu].push_back(queue);
+}
+
+// `cpu` received the connection, -1 when unknown
+HandoffQueue *HandoffGroup::pick(int cpu)
+{
+	size_t ticket = __sync_fetch_and_add(&next, 1);
+	if (cpu >= 0 && static_cast<size_t>(cpu) < by_cpu.size() && !by_cpu[cpu].empty())
+		return by_cpu[cpu][ticket % by_cpu[cpu].size()];
+	return queues[ticket % queues.size()];
+}
+
+bool HandoffGroup::routes_by_cpu() const
+{
+	return !by_cpu.empty();
+}
+
+size_t HandoffGroup::size() const
+{
+	return queues.size();
+}
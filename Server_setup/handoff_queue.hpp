@@ -0,0 +1,64 @@
+#ifndef HANDOFF_QUEUE_HPP
+#define HANDOFF_QUEUE_HPP
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+struct ServerContext;
+
+// A connection accepted by an acceptor thread, on its way to an event loop
+struct Handoff
+{
+	int fd;
+	ServerContext *config;
+	uint32_t peer;            // client address, for limit_conn/limit_req
+	Handoff *volatile next;
+};
+
+// Lock-free multi-producer/single-consumer queue (Vyukov's intrusive MPSC
+// design): a producer publishes a node with one atomic exchange of the
+// head, the single consumer walks from the tail. Producers then bump an
+// eventfd so the consumer's epoll loop wakes up.
+class HandoffQueue
+{
+  private:
+	Handoff stub;
+	Handoff *volatile head;   // last pushed node, swapped by producers
+	Handoff *tail;            // next node to pop, consumer only
+	int event_fd;
+
+	void push_node(Handoff *node);
+	HandoffQueue(const HandoffQueue &);
+	HandoffQueue &operator=(const HandoffQueue &);
+
+  public:
+	HandoffQueue();
+	~HandoffQueue();
+
+	int get_event_fd() const;
+	void push(int fd, ServerContext *config, uint32_t peer);    // any thread
+	bool pop(int &fd, ServerContext *&config, uint32_t &peer);  // owning event loop only
+	void clear_wakeup();                        // owning event loop only
+};
+
+// The event loops acceptors hand connections to, picked round-robin. Under
+// worker_cpu_affinity a connection goes to a loop pinned to the CPU that
+// received its packets when there is one.
+class HandoffGroup
+{
+  private:
+	std::vector<HandoffQueue *> queues;
+	std::vector<std::vector<HandoffQueue *> > by_cpu;  // CPU -> loops pinned to it alone
+	volatile size_t next;
+
+  public:
+	HandoffGroup();
+
+	void add(HandoffQueue *queue, int cpu);
+	HandoffQueue *pick(int cpu);
+	bool routes_by_cpu() const;
+	size_t size() const;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "io_engine.hpp"
+#include "../utils/logger.hpp"
+#include <unistd.h>
+
+IoEngine::~IoEngine()
+{
+}
+
+IoEngine *IoEngine::create(bool want_io_uring)
+{
+	if (want_io_uring)
+	{
+		IoUringEngine *uring = new IoUringEngine();
+		if (uring->ready())
+			return uring;
+		delete uring;
+		LOG_INFO("io_uring is not available, falling back to epoll");
+	}
+	EpollEngine *epoll = new EpollEngine();
+	if (epoll->ready())
+		return epoll;
+	delete epoll;
+	return NULL;
+}
+
+EpollEngine::EpollEngine()
+{
+	LOG_INFO("=== SETTING UP EPOLL ===");
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1)
+		LOG_ERROR("Failed to create epoll");
+	else
+		LOG_INFO("Epoll created");
+}
+
+EpollEngine::~EpollEngine()
+{
+	if (epoll_fd != -1)
+	{
+		close(epoll_fd);
+		LOG_INFO("Epoll closed");
+	}
+}
+
+bool EpollEngine::ready() const
+{
+	return epoll_fd != -1;
+}
+
+bool EpollEngine::add(int fd, uint32_t events)
+{
+	struct epoll_event event;
+
+	event.events = events;
+	event.data.fd = fd;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+bool EpollEngine::modify(int fd, uint32_t events)
+{
+	struct epoll_event event;
+
+	event.events = events;
+	event.data.fd = fd;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+bool EpollEngine::remove(int fd)
+{
+	return epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) == 0;
+}
+
+int EpollEngine::wait(struct epoll_event *events, int max_events, int timeout_ms)
+{
+	return epoll_wait(epoll_fd, events, max_events, timeout_ms);
+}
+
+const char *EpollEngine::name() const
+{
+	return "epoll";
+}
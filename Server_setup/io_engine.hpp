@@ -0,0 +1,109 @@
+#ifndef IO_ENGINE_HPP
+#define IO_ENGINE_HPP
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <vector>
+
+// Readiness multiplexer behind the event loop. Interest and results use the
+// EPOLL* flags whatever the backend; EPOLLET asks for edge-triggered
+// reporting. Clients and the server only talk to this interface.
+class IoEngine
+{
+  public:
+	virtual ~IoEngine();
+
+	// io_uring when asked for and supported by the kernel, epoll otherwise.
+	// Returns NULL when no backend could be set up.
+	static IoEngine *create(bool want_io_uring);
+
+	virtual bool add(int fd, uint32_t events) = 0;
+	virtual bool modify(int fd, uint32_t events) = 0;
+	virtual bool remove(int fd) = 0;
+	// Like epoll_wait: up to max_events ready fds, timeout_ms -1 blocks
+	virtual int wait(struct epoll_event *events, int max_events, int timeout_ms) = 0;
+	virtual const char *name() const = 0;
+};
+
+class EpollEngine : public IoEngine
+{
+  private:
+	int epoll_fd;
+
+	EpollEngine(const EpollEngine &);
+	EpollEngine &operator=(const EpollEngine &);
+
+  public:
+	EpollEngine();
+	~EpollEngine();
+
+	bool ready() const;
+	bool add(int fd, uint32_t events);
+	bool modify(int fd, uint32_t events);
+	bool remove(int fd);
+	int wait(struct epoll_event *events, int max_events, int timeout_ms);
+	const char *name() const;
+};
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// io_uring backend: interest changes become POLL_ADD/POLL_REMOVE entries
+// on the submission queue and go to the kernel together with the wait, in
+// one io_uring_enter per loop turn instead of one epoll_ctl each.
+// Edge-triggered interest uses multishot polls; level-triggered interest
+// uses one-shot polls that are re-armed on the next turn.
+class IoUringEngine : public IoEngine
+{
+  private:
+	struct PollState
+	{
+		uint32_t events;
+		uint32_t generation;     // tags completions, so stale ones are dropped
+		bool live;               // registered by the caller
+		bool armed;              // a poll request is pending in the kernel
+
+		PollState() : events(0), generation(0), live(false), armed(false) {}
+	};
+
+	int ring_fd;
+	void *ring;
+	size_t ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned pending;            // entries queued since the last submit
+	std::vector<PollState> polls;
+	std::vector<int> rearm;      // one-shot polls that fired last turn
+
+	bool setup(unsigned entries);
+	int enter(unsigned min_complete, unsigned flags, const void *arg, size_t arg_size);
+	struct io_uring_sqe *next_sqe();
+	PollState &state(int fd);
+	bool queue_poll(int fd);
+	bool queue_cancel(int fd);
+	int reap(struct epoll_event *events, int max_events);
+
+	IoUringEngine(const IoUringEngine &);
+	IoUringEngine &operator=(const IoUringEngine &);
+
+  public:
+	IoUringEngine();
+	~IoUringEngine();
+
+	bool ready() const;
+	bool add(int fd, uint32_t events);
+	bool modify(int fd, uint32_t events);
+	bool remove(int fd);
+	int wait(struct epoll_event *events, int max_events, int timeout_ms);
+	const char *name() const;
+};
+
+#endif
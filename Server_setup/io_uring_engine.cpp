@@ -0,0 +1,299 @@
+#include "io_engine.hpp"
+#include "../utils/logger.hpp"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace
+{
+	const unsigned RING_ENTRIES = 1024;
+	// Interest bits a poll request understands; EPOLLET only picks the mode
+	const uint32_t POLL_EVENTS = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLPRI;
+	// user_data of POLL_REMOVE requests, whose completions are ignored
+	const uint64_t CANCEL_TAG = ~static_cast<uint64_t>(0);
+
+	uint64_t poll_tag(int fd, uint32_t generation)
+	{
+		return (static_cast<uint64_t>(generation & 0x7fffffff) << 32) | static_cast<uint32_t>(fd);
+	}
+}
+
+IoUringEngine::IoUringEngine() : ring_fd(-1), ring(MAP_FAILED), ring_size(0), sqes(NULL), sqes_size(0),
+	sq_head(NULL), sq_tail(NULL), sq_mask(0), sq_entries(0), cq_head(NULL), cq_tail(NULL), cq_mask(0),
+	cqes(NULL), pending(0)
+{
+	LOG_INFO("=== SETTING UP IO_URING ===");
+	if (setup(RING_ENTRIES))
+		LOG_INFO("io_uring created with " << sq_entries << " entries");
+}
+
+IoUringEngine::~IoUringEngine()
+{
+	if (sqes)
+		munmap(sqes, sqes_size);
+	if (ring != MAP_FAILED)
+		munmap(ring, ring_size);
+	if (ring_fd != -1)
+	{
+		close(ring_fd);
+		LOG_INFO("io_uring closed");
+	}
+}
+
+// Create the ring and map its queues. Needs a single mapping for both
+// rings, no dropped completions, a timeout argument on io_uring_enter and
+// multishot polls (5.13, the release that also brought resource tags).
+bool IoUringEngine::setup(unsigned entries)
+{
+	const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP
+		| IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS;
+	struct io_uring_params params;
+
+	std::memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = entries * 4;
+	ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring_fd < 0)
+	{
+		ring_fd = -1;
+		LOG_ERROR("io_uring_setup failed: " << std::strerror(errno));
+		return false;
+	}
+	if ((params.features & required) != required)
+	{
+		LOG_INFO("io_uring on this kernel lacks multishot poll support");
+		return false;
+	}
+
+	ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (cq_size > ring_size)
+		ring_size = cq_size;
+	ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (ring == MAP_FAILED)
+		return false;
+	sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	void *sqe_map = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sqe_map == MAP_FAILED)
+		return false;
+	sqes = static_cast<struct io_uring_sqe *>(sqe_map);
+
+	char *base = static_cast<char *>(ring);
+	sq_head = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+	sq_tail = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+	sq_mask = *reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+	sq_entries = params.sq_entries;
+	cq_head = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+	cq_tail = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+	cq_mask = *reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<struct io_uring_cqe *>(base + params.cq_off.cqes);
+	// Submission slots map one to one onto the entry array
+	unsigned *sq_array = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+	for (unsigned i = 0; i < sq_entries; ++i)
+		sq_array[i] = i;
+	return true;
+}
+
+bool IoUringEngine::ready() const
+{
+	return sqes != NULL;
+}
+
+// Submit everything queued and optionally wait for completions
+int IoUringEngine::enter(unsigned min_complete, unsigned flags, const void *arg, size_t arg_size)
+{
+	int ret = syscall(__NR_io_uring_enter, ring_fd, pending, min_complete, flags, arg, arg_size);
+	if (ret >= 0 || errno == ETIME || errno == EINTR)
+		pending = 0;
+	return ret;
+}
+
+// A zeroed submission entry, flushing the queue first when it is full
+struct io_uring_sqe *IoUringEngine::next_sqe()
+{
+	unsigned tail = *sq_tail;
+
+	if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+	{
+		enter(0, 0, NULL, 0);
+		if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+			return NULL;
+	}
+	struct io_uring_sqe *sqe = &sqes[tail & sq_mask];
+	std::memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+IoUringEngine::PollState &IoUringEngine::state(int fd)
+{
+	if (static_cast<size_t>(fd) >= polls.size())
+		polls.resize(fd + 1);
+	return polls[fd];
+}
+
+bool IoUringEngine::queue_poll(int fd)
+{
+	PollState &poll = state(fd);
+	struct io_uring_sqe *sqe = next_sqe();
+
+	if (!sqe)
+		return false;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = poll.events & POLL_EVENTS;
+	if (poll.events & EPOLLET)
+		sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = poll_tag(fd, poll.generation);
+	__atomic_store_n(sq_tail, *sq_tail + 1, __ATOMIC_RELEASE);
+	pending++;
+	poll.armed = true;
+	return true;
+}
+
+bool IoUringEngine::queue_cancel(int fd)
+{
+	PollState &poll = state(fd);
+	struct io_uring_sqe *sqe = next_sqe();
+
+	if (!sqe)
+		return false;
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = poll_tag(fd, poll.generation);
+	sqe->user_data = CANCEL_TAG;
+	__atomic_store_n(sq_tail, *sq_tail + 1, __ATOMIC_RELEASE);
+	pending++;
+	poll.armed = false;
+	return true;
+}
+
+bool IoUringEngine::add(int fd, uint32_t events)
+{
+	PollState &poll = state(fd);
+
+	if (poll.live)
+	{
+		errno = EEXIST;
+		return false;
+	}
+	poll.live = true;
+	poll.events = events;
+	poll.generation++;
+	return !(events & POLL_EVENTS) || queue_poll(fd);
+}
+
+bool IoUringEngine::modify(int fd, uint32_t events)
+{
+	PollState &poll = state(fd);
+
+	if (!poll.live)
+	{
+		errno = ENOENT;
+		return false;
+	}
+	if (poll.events == events && poll.armed)
+		return true;
+	if (poll.armed && !queue_cancel(fd))
+		return false;
+	poll.events = events;
+	poll.generation++;
+	return !(events & POLL_EVENTS) || queue_poll(fd);
+}
+
+// The caller may close the fd right away: the pending poll keeps the file
+// alive until the removal is submitted with the next wait
+bool IoUringEngine::remove(int fd)
+{
+	PollState &poll = state(fd);
+
+	if (!poll.live)
+	{
+		errno = ENOENT;
+		return false;
+	}
+	if (poll.armed && !queue_cancel(fd))
+		return false;
+	poll.live = false;
+	poll.generation++;
+	return true;
+}
+
+// Move completions into `events`. Results of removed or re-registered
+// polls are dropped by their generation; a poll that will not fire again
+// (one-shot, or a multishot the kernel ended) is queued to be re-armed.
+int IoUringEngine::reap(struct epoll_event *events, int max_events)
+{
+	unsigned head = *cq_head;
+	int count = 0;
+
+	while (count < max_events && head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+	{
+		const struct io_uring_cqe *cqe = &cqes[head & cq_mask];
+		uint64_t tag = cqe->user_data;
+		int result = cqe->res;
+		bool more = cqe->flags & IORING_CQE_F_MORE;
+		head++;
+
+		if (tag == CANCEL_TAG)
+			continue;
+		int fd = static_cast<int>(tag & 0xffffffff);
+		if (static_cast<size_t>(fd) >= polls.size())
+			continue;
+		PollState &poll = polls[fd];
+		if (!poll.live || tag != poll_tag(fd, poll.generation))
+			continue;
+		if (!more)
+		{
+			poll.armed = false;
+			if (result >= 0 || result == -ECANCELED)
+				rearm.push_back(fd);
+		}
+		if (result == -ECANCELED)
+			continue;
+		events[count].events = result < 0 ? EPOLLERR : static_cast<uint32_t>(result);
+		events[count].data.fd = fd;
+		count++;
+	}
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+int IoUringEngine::wait(struct epoll_event *events, int max_events, int timeout_ms)
+{
+	for (size_t i = 0; i < rearm.size(); ++i)
+	{
+		PollState &poll = polls[rearm[i]];
+		if (poll.live && !poll.armed && (poll.events & POLL_EVENTS))
+			queue_poll(rearm[i]);
+	}
+	rearm.clear();
+
+	bool completed = *cq_head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+	if (completed || timeout_ms == 0)
+	{
+		if (pending)
+			enter(0, 0, NULL, 0);
+	}
+	else if (timeout_ms < 0)
+		enter(1, IORING_ENTER_GETEVENTS, NULL, 0);
+	else
+	{
+		struct __kernel_timespec ts;
+		struct io_uring_getevents_arg arg;
+
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+		std::memset(&arg, 0, sizeof(arg));
+		arg.ts = reinterpret_cast<uint64_t>(&ts);
+		enter(1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	}
+	return reap(events, max_events);
+}
+
+const char *IoUringEngine::name() const
+{
+	return "io_uring";
+}
@@ -0,0 +1,123 @@
+#include "load_limits.hpp"
+#include "../utils/logger.hpp"
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+volatile int LoadLimits::max_connections = 0;
+volatile int LoadLimits::max_cgi_processes = 0;
+volatile int LoadLimits::shedding = 0;
+LoadStats LoadLimits::stats = LoadStats();
+
+static std::string build_busy_response()
+{
+	static const char body[] = "<html><body><h1>503 Service Unavailable</h1>"
+		"<p>The server is overloaded, please retry shortly.</p></body></html>";
+	std::ostringstream response;
+
+	response << "HTTP/1.1 503 Service Unavailable\r\n"
+			 << "Retry-After: 1\r\n"
+			 << "Content-Type: text/html\r\n"
+			 << "Content-Length: " << sizeof(body) - 1 << "\r\n"
+			 << "Connection: close\r\n\r\n"
+			 << body;
+	return response.str();
+}
+
+// Serialized once: shedding must cost less than serving
+static const std::string busy_response = build_busy_response();
+
+void LoadLimits::configure(int connections, int cgi_processes)
+{
+	max_connections = connections;
+	max_cgi_processes = cgi_processes;
+}
+
+void LoadLimits::connection_opened()
+{
+	__sync_fetch_and_add(&stats.connections, 1);
+}
+
+void LoadLimits::connection_closed()
+{
+	__sync_fetch_and_sub(&stats.connections, 1);
+}
+
+// Threads race on the flag only around the transitions, where either
+// answer is acceptable
+bool LoadLimits::should_shed()
+{
+	int limit = max_connections;
+	size_t open = stats.connections;
+
+	if (limit <= 0)
+		shedding = 0;
+	else if (!shedding && open >= static_cast<size_t>(limit))
+	{
+		shedding = 1;
+		LOG_WARN("max_connections " << limit << " reached, answering new connections with 503");
+	}
+	else if (shedding && open < static_cast<size_t>(limit - limit / 10))
+	{
+		shedding = 0;
+		LOG_INFO("Down to " << open << " connections, accepting again");
+	}
+	return shedding;
+}
+
+// The request the client may already have sent is read first: closing a
+// socket with unread data resets it, and the reset can overtake the 503
+void LoadLimits::refuse_connection(int fd)
+{
+	char discard[4096];
+
+	while (recv(fd, discard, sizeof(discard), MSG_DONTWAIT) == static_cast<ssize_t>(sizeof(discard)))
+		;
+	if (send(fd, busy_response.data(), busy_response.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+	{
+		// Best effort: the client sees the close either way
+	}
+	close(fd);
+}
+
+void LoadLimits::shed_connection(int fd)
+{
+	refuse_connection(fd);
+	__sync_fetch_and_add(&stats.shed_connections, 1);
+}
+
+void LoadLimits::count_listener_pause()
+{
+	__sync_fetch_and_add(&stats.listener_pauses, 1);
+}
+
+bool LoadLimits::acquire_cgi()
+{
+	int limit = max_cgi_processes;
+	size_t running = __sync_add_and_fetch(&stats.cgi_processes, 1);
+
+	if (limit <= 0 || running <= static_cast<size_t>(limit))
+		return true;
+	__sync_fetch_and_sub(&stats.cgi_processes, 1);
+	__sync_fetch_and_add(&stats.shed_cgi, 1);
+	return false;
+}
+
+void LoadLimits::release_cgi()
+{
+	__sync_fetch_and_sub(&stats.cgi_processes, 1);
+}
+
+LoadStats LoadLimits::get_stats()
+{
+	return stats;
+}
+
+void LoadLimits::print_stats()
+{
+	LOG_INFO("[LOAD] connections=" << stats.connections << "/" << max_connections
+			  << " cgi=" << stats.cgi_processes << "/" << max_cgi_processes
+			  << " shed_connections=" << stats.shed_connections
+			  << " shed_cgi=" << stats.shed_cgi
+			  << " listener_pauses=" << stats.listener_pauses);
+}
@@ -0,0 +1,52 @@
+#ifndef LOAD_LIMITS_HPP
+#define LOAD_LIMITS_HPP
+
+#include <cstddef>
+
+// Shed counters, logged with the buffer pool stats
+struct LoadStats
+{
+	size_t connections;       // connections currently open
+	size_t cgi_processes;     // CGI scripts currently running
+	size_t shed_connections;  // connections answered 503 at max_connections
+	size_t shed_cgi;          // CGI requests answered 503 at max_cgi_processes
+	size_t listener_pauses;   // times a listener was muted at max_connections
+};
+
+// max_connections and max_cgi_processes for the whole process: every event
+// loop and acceptor thread updates the same counters, with atomic builtins.
+// A limit of 0 means unlimited. Limits are set at startup and on reload.
+class LoadLimits
+{
+  private:
+	static volatile int max_connections;
+	static volatile int max_cgi_processes;
+	static volatile int shedding;     // between reaching max_connections and the low watermark
+	static LoadStats stats;
+
+	LoadLimits();
+
+  public:
+	static void configure(int connections, int cgi_processes);
+
+	static void connection_opened();
+	static void connection_closed();
+	// True from the moment max_connections is reached until the count is
+	// back under the low watermark, max_connections less 10%. The gap keeps
+	// the server from flapping around the limit.
+	static bool should_shed();
+	// Answer a connection with the prebuilt 503 and close it. Shedding
+	// counts it as shed at max_connections, refusing does not.
+	static void shed_connection(int fd);
+	static void refuse_connection(int fd);
+	static void count_listener_pause();
+
+	// Reserve a slot for a CGI script; false at max_cgi_processes
+	static bool acquire_cgi();
+	static void release_cgi();
+
+	static LoadStats get_stats();
+	static void print_stats();
+};
+
+#endif
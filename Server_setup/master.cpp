@@ -0,0 +1,236 @@
+#include "master.hpp"
+#include "../utils/logger.hpp"
+#include "server.hpp"
+#include "reactor_threads.hpp"
+#include <cerrno>
+#include <csignal>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+static volatile sig_atomic_t pending_term = 0;
+static volatile sig_atomic_t pending_hup = 0;
+static volatile sig_atomic_t pending_usr2 = 0;
+static volatile sig_atomic_t pending_usr1 = 0;
+
+static void master_signal_handler(int sig)
+{
+	if (sig == SIGHUP)
+		pending_hup = 1;
+	else if (sig == SIGUSR2)
+		pending_usr2 = 1;
+	else if (sig == SIGUSR1)
+		pending_usr1 = 1;
+	else
+		pending_term = 1;
+}
+
+// No SA_RESTART, so the blocking waitpid() in run() returns on a signal
+static void install_master_handler(int sig)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = master_signal_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(sig, &sa, NULL);
+}
+
+Master::Master(ConfigSnapshot *config) : config(config)
+{
+	config->retain();
+}
+
+Master::~Master()
+{
+	config->release();
+}
+
+int Master::worker_count(const GlobalContext &global)
+{
+	if (global.workerProcesses > 0)
+		return global.workerProcesses;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		return 1;
+	return static_cast<int>(cpus);
+}
+
+pid_t Master::spawn_worker(size_t slot)
+{
+	pid_t pid = fork();
+	if (pid == -1)
+	{
+		LOG_ERROR("[MASTER] fork failed for worker " << slot);
+		return -1;
+	}
+	if (pid == 0)
+	{
+		// Do not outlive the master
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		// Until the worker's loop takes them over
+		signal(SIGHUP, SIG_IGN);
+		signal(SIGUSR1, SIG_IGN);
+		signal(SIGUSR2, SIG_IGN);
+		Logger::start();
+		try
+		{
+			if (config->getGlobal().workerThreads != 0)
+			{
+				ReactorThreads threads(config, slot * ReactorThreads::thread_count(config->getGlobal()));
+				exit(threads.run());
+			}
+			Server server;
+			server.init_data(config, slot);
+			server.run();
+		}
+		catch (const std::exception &e)
+		{
+			LOG_ERROR("Error: worker " << slot << ": " << e.what());
+			exit(1);
+		}
+		exit(0);
+	}
+	LOG_INFO("[MASTER] Worker " << slot << " started (pid " << pid << ")");
+	workers[slot] = pid;
+	started[slot] = time(NULL);
+	return pid;
+}
+
+void Master::signal_workers(int sig)
+{
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		if (workers[i] > 0)
+			kill(workers[i], sig);
+	}
+}
+
+size_t Master::live_workers() const
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		if (workers[i] > 0)
+			count++;
+	}
+	return count;
+}
+
+// A worker killed by a signal crashed and gets replaced. One that exited
+// on its own failed to start (bad listener, etc.) and would only fail again.
+void Master::reap_worker(pid_t pid, int status, bool shutting_down)
+{
+	for (size_t slot = 0; slot < workers.size(); ++slot)
+	{
+		if (workers[slot] != pid)
+			continue;
+		workers[slot] = -1;
+		if (WIFEXITED(status))
+		{
+			LOG_WARN("[MASTER] Worker " << slot << " (pid " << pid << ") exited with status "
+					  << WEXITSTATUS(status));
+			return;
+		}
+		LOG_WARN("[MASTER] Worker " << slot << " (pid " << pid << ") killed by signal "
+				  << WTERMSIG(status));
+		if (shutting_down)
+			return;
+		// A worker that dies right after starting is probably crashing in a
+		// loop: slow the restarts down
+		if (time(NULL) - started[slot] < 1)
+			sleep(1);
+		spawn_worker(slot);
+		return;
+	}
+}
+
+// Workers parse the file again themselves; checking it here first keeps
+// an invalid file away from them, and workers restarted later start from
+// the new config
+void Master::reload()
+{
+	ConfigSnapshot *next;
+
+	LOG_INFO("[MASTER] Reloading configuration from " << config->getPath());
+	try
+	{
+		next = ConfigSnapshot::load(config->getPath());
+	}
+	catch (const std::exception &e)
+	{
+		LOG_ERROR("[MASTER] Reload failed, keeping the running configuration: " << e.what());
+		return;
+	}
+	std::string fixed = next->restartOnlyChanges(config->getGlobal());
+	if (!fixed.empty())
+		LOG_WARN("[MASTER] Reload: " << fixed << " only change on a restart");
+	const GlobalContext &next_global = next->getGlobal();
+	if (!Logger::configure(next_global.errorLogPath, next_global.logLevel))
+		LOG_ERROR("[MASTER] Cannot open error_log " << next_global.errorLogPath << ", keeping the previous one");
+	config->release();
+	config = next;
+	signal_workers(SIGHUP);
+}
+
+int Master::run()
+{
+	int count = worker_count(config->getGlobal());
+	bool shutting_down = false;
+	int status;
+
+	install_master_handler(SIGTERM);
+	install_master_handler(SIGINT);
+	install_master_handler(SIGHUP);
+	install_master_handler(SIGUSR2);
+	install_master_handler(SIGUSR1);
+
+	workers.assign(count, -1);
+	started.assign(count, 0);
+	LOG_INFO("=== MASTER " << getpid() << ": STARTING " << count << " WORKERS ===");
+	for (int i = 0; i < count; ++i)
+		spawn_worker(i);
+
+	while (live_workers() > 0)
+	{
+		pid_t pid = waitpid(-1, &status, 0);
+		// Workers drain on the first SIGTERM and close what is left on
+		// the second
+		if (pending_term)
+		{
+			pending_term = 0;
+			if (!shutting_down)
+				LOG_INFO("[MASTER] Shutting down workers");
+			shutting_down = true;
+			signal_workers(SIGTERM);
+		}
+		if (pending_usr1)
+		{
+			pending_usr1 = 0;
+			const GlobalContext &global = config->getGlobal();
+			if (!Logger::configure(global.errorLogPath, global.logLevel))
+				LOG_ERROR("[MASTER] Cannot reopen error_log " << global.errorLogPath);
+			signal_workers(SIGUSR1);
+		}
+		if (pending_hup)
+		{
+			pending_hup = 0;
+			reload();
+		}
+		if (pending_usr2)
+		{
+			// Every worker binds its own SO_REUSEPORT listeners: there is
+			// no single set of sockets to hand over
+			pending_usr2 = 0;
+			LOG_WARN("[MASTER] Binary upgrade needs worker_processes 1, ignoring SIGUSR2");
+		}
+		if (pid > 0)
+			reap_worker(pid, status, shutting_down);
+		else if (errno == ECHILD)
+			break;
+	}
+	LOG_INFO("=== MASTER " << getpid() << ": ALL WORKERS STOPPED ===");
+	return shutting_down ? 0 : 1;
+}
@@ -0,0 +1,37 @@
+#ifndef MASTER_HPP
+# define MASTER_HPP
+
+# include "../config/config_snapshot.hpp"
+# include <ctime>
+# include <sys/types.h>
+# include <vector>
+
+// Supervisor for worker_processes > 1. Forks one Server per worker, each
+// with its own SO_REUSEPORT listeners and epoll loop, restarts workers that
+// crash and passes SIGTERM/SIGINT on to them. On SIGHUP it checks the
+// config file first and only then has the workers reload it.
+class Master
+{
+  private:
+	ConfigSnapshot *config;           // what workers started from now on get
+	std::vector<pid_t> workers;       // slot -> pid, -1 when the slot is empty
+	std::vector<time_t> started;      // slot -> spawn time, to throttle crash loops
+
+	pid_t spawn_worker(size_t slot);
+	void signal_workers(int sig);
+	void reap_worker(pid_t pid, int status, bool shutting_down);
+	size_t live_workers() const;
+	void reload();
+
+	Master(const Master &);
+	Master &operator=(const Master &);
+
+  public:
+	Master(ConfigSnapshot *config);
+	~Master();
+
+	static int worker_count(const GlobalContext &global);
+	int run();
+};
+
+#endif
@@ -0,0 +1,191 @@
+#include "peer_limits.hpp"
+#include "../config/parser.hpp"
+#include "../utils/logger.hpp"
+#include "../utils/timer_wheel.hpp"
+#include <pthread.h>
+
+namespace
+{
+	const size_t SETS = 4096;       // power of two
+	const size_t WAYS = 8;          // slots per set
+	const size_t STRIPES = 64;      // locks, each guarding SETS / STRIPES sets
+
+	struct PeerEntry
+	{
+		uint32_t peer;
+		uint32_t zone;              // 0: connections, else the limit_req directive
+		uint32_t connections;
+		uint32_t excess;            // limit_req backlog, in thousandths of a request
+		uint64_t last;              // ms the peer was last seen, 0 = free slot
+		uint64_t last_request;      // ms of the last limit_req update, 0 = none yet
+	};
+
+	PeerEntry table[SETS][WAYS];    // 1 MiB, zero pages until touched
+	pthread_mutex_t stripes[STRIPES] = {
+#define PEER_LOCK_8 PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, \
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, \
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER
+		PEER_LOCK_8, PEER_LOCK_8, PEER_LOCK_8, PEER_LOCK_8,
+		PEER_LOCK_8, PEER_LOCK_8, PEER_LOCK_8, PEER_LOCK_8
+#undef PEER_LOCK_8
+	};
+	PeerLimitStats stats;
+
+	// Fibonacci hashing spreads neighbouring addresses over the sets
+	size_t set_of(uint32_t peer, uint32_t zone)
+	{
+		return ((peer ^ zone * 0x9e3779b9u) * 2654435769u) >> 20;
+	}
+
+	// Holds the set's stripe lock for its lifetime
+	class SetLock
+	{
+	  private:
+		pthread_mutex_t *lock;
+
+	  public:
+		PeerEntry *ways;
+
+		SetLock(uint32_t peer, uint32_t zone)
+		{
+			size_t set = set_of(peer, zone);
+			lock = &stripes[set % STRIPES];
+			ways = table[set];
+			pthread_mutex_lock(lock);
+		}
+		~SetLock()
+		{
+			pthread_mutex_unlock(lock);
+		}
+	};
+
+	PeerEntry *find(PeerEntry *ways, uint32_t peer, uint32_t zone)
+	{
+		for (size_t i = 0; i < WAYS; ++i)
+		{
+			if (ways[i].last && ways[i].peer == peer && ways[i].zone == zone)
+				return &ways[i];
+		}
+		return NULL;
+	}
+
+	// The peer's slot, taking a free one or the least recently seen peer
+	// without open connections. NULL when every slot has connections.
+	PeerEntry *find_or_insert(PeerEntry *ways, uint32_t peer, uint32_t zone, uint64_t now)
+	{
+		PeerEntry *victim = NULL;
+
+		for (size_t i = 0; i < WAYS; ++i)
+		{
+			PeerEntry &entry = ways[i];
+			if (entry.last && entry.peer == peer && entry.zone == zone)
+			{
+				entry.last = now;
+				return &entry;
+			}
+			if (entry.connections == 0 && (!victim || entry.last < victim->last))
+				victim = &entry;
+		}
+		if (!victim)
+		{
+			__sync_fetch_and_add(&stats.untracked, 1);
+			return NULL;
+		}
+		if (victim->last)
+			__sync_fetch_and_add(&stats.evictions, 1);
+		victim->peer = peer;
+		victim->zone = zone;
+		victim->connections = 0;
+		victim->excess = 0;
+		victim->last = now;
+		victim->last_request = 0;
+		return victim;
+	}
+}
+
+PeerLimits::Verdict PeerLimits::open_connection(uint32_t peer, int limit)
+{
+	SetLock set(peer, 0);
+	PeerEntry *entry = find_or_insert(set.ways, peer, 0, TimerWheel::monotonic_ms());
+
+	if (!entry)
+		return UNTRACKED;
+	if (limit > 0 && entry->connections >= static_cast<uint32_t>(limit))
+	{
+		__sync_fetch_and_add(&stats.rejected_connections, 1);
+		return REJECTED;
+	}
+	entry->connections++;
+	return COUNTED;
+}
+
+void PeerLimits::close_connection(uint32_t peer)
+{
+	SetLock set(peer, 0);
+	PeerEntry *entry = find(set.ways, peer, 0);
+
+	// Never evicted while it has connections
+	if (entry && entry->connections > 0)
+		entry->connections--;
+}
+
+bool PeerLimits::over_limit(uint32_t peer, int limit)
+{
+	SetLock set(peer, 0);
+	PeerEntry *entry = find(set.ways, peer, 0);
+
+	if (!entry || entry->connections <= static_cast<uint32_t>(limit))
+		return false;
+	__sync_fetch_and_add(&stats.rejected_connections, 1);
+	return true;
+}
+
+// The leaky bucket of nginx's limit_req: the backlog drains at `rate` and
+// each request adds one. Past the burst the request is refused; within it
+// the request waits until the backlog ahead of it has drained, unless
+// nodelay lets the burst through at once.
+long PeerLimits::admit_request(uint32_t peer, const LimitReq &limit)
+{
+	uint64_t now = TimerWheel::monotonic_ms();
+	SetLock set(peer, limit.zone);
+	PeerEntry *entry = find_or_insert(set.ways, peer, limit.zone, now);
+
+	if (!entry)
+		return 0;
+	uint64_t excess = 0;
+	if (entry->last_request)
+	{
+		const uint64_t MAX_ELAPSED = 1000000000; // keeps the product in range
+		uint64_t elapsed = now - entry->last_request;
+		if (elapsed > MAX_ELAPSED)
+			elapsed = MAX_ELAPSED;
+		uint64_t drained = elapsed * static_cast<uint64_t>(limit.rate) / 1000;
+		uint64_t backlog = entry->excess + 1000;
+		excess = drained >= backlog ? 0 : backlog - drained;
+	}
+	if (excess > static_cast<uint64_t>(limit.burst) * 1000)
+	{
+		__sync_fetch_and_add(&stats.rejected_requests, 1);
+		return -1;
+	}
+	entry->excess = static_cast<uint32_t>(excess);
+	entry->last_request = now;
+	if (limit.nodelay || excess == 0)
+		return 0;
+	__sync_fetch_and_add(&stats.delayed_requests, 1);
+	return static_cast<long>(excess * 1000 / limit.rate);
+}
+
+PeerLimitStats PeerLimits::get_stats()
+{
+	return stats;
+}
+
+void PeerLimits::print_stats()
+{
+	LOG_INFO("[PEER LIMITS] rejected_connections=" << stats.rejected_connections
+			  << " rejected_requests=" << stats.rejected_requests
+			  << " delayed_requests=" << stats.delayed_requests
+			  << " evictions=" << stats.evictions
+			  << " untracked=" << stats.untracked);
+}
@@ -0,0 +1,54 @@
+#ifndef PEER_LIMITS_HPP
+#define PEER_LIMITS_HPP
+
+#include <cstddef>
+#include <stdint.h>
+
+struct LimitReq;
+
+// What limit_conn and limit_req turned away, logged with the load stats
+struct PeerLimitStats
+{
+	size_t rejected_connections; // over limit_conn
+	size_t rejected_requests;    // over limit_req burst
+	size_t delayed_requests;     // held back to the limit_req rate
+	size_t evictions;            // idle peers dropped to make room
+	size_t untracked;            // peers that found every slot of their set busy
+};
+
+// Per client address state for limit_conn and limit_req, shared by every
+// thread of the process: open connections of each peer (IPv4 address,
+// network order) and its backlog under each limit_req directive. The table is set-associative open
+// addressing: an address hashes to a set of a few slots, so lookups,
+// inserts and evictions touch one cache line's worth of entries, and memory
+// is fixed. A full set evicts its least recently seen peer without open
+// connections; a peer that still finds no slot is not limited.
+class PeerLimits
+{
+  private:
+	PeerLimits();
+
+  public:
+	enum Verdict
+	{
+		COUNTED,    // connection counted, close_connection() when it ends
+		UNTRACKED,  // no slot for the peer: serve it, nothing to undo
+		REJECTED    // `limit` connections already open from the peer
+	};
+
+	// Count a new connection from `peer`; `limit` 0 means none
+	static Verdict open_connection(uint32_t peer, int limit);
+	static void close_connection(uint32_t peer);
+	// A location's limit_conn: more than `limit` connections open from
+	// `peer`, the asking one included
+	static bool over_limit(uint32_t peer, int limit);
+
+	// Milliseconds to hold the request back (0 = serve now), or -1 to
+	// answer 503: the backlog would exceed the burst
+	static long admit_request(uint32_t peer, const LimitReq &limit);
+
+	static PeerLimitStats get_stats();
+	static void print_stats();
+};
+
+#endif
@@ -0,0 +1,286 @@
+#include "reactor_threads.hpp"
+#include "../utils/logger.hpp"
+#include "binary_upgrade.hpp"
+#include "load_limits.hpp"
+#include "server.hpp"
+#include <csignal>
+
+ReactorThreads::ReactorThreads(ConfigSnapshot *config, size_t first_loop)
+	: config(config), first_loop(first_loop), group(NULL)
+{
+	config->retain();
+}
+
+ReactorThreads::~ReactorThreads()
+{
+	config->release();
+}
+
+int ReactorThreads::thread_count(const GlobalContext &global)
+{
+	if (global.workerThreads > 0)
+		return global.workerThreads;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		return 1;
+	return static_cast<int>(cpus);
+}
+
+void *ReactorThreads::run_loop(void *server)
+{
+	try
+	{
+		static_cast<Server *>(server)->run();
+	}
+	catch (const std::exception &e)
+	{
+		LOG_ERROR("Error: event loop thread: " << e.what());
+	}
+	return NULL;
+}
+
+// Loop threads start on their worker_cpu_affinity CPUs, so everything they
+// allocate comes from the local NUMA node
+bool ReactorThreads::start_thread(pthread_t &thread, Server *server, const cpu_set_t *cpus)
+{
+	pthread_attr_t attr;
+
+	pthread_attr_init(&attr);
+	if (cpus)
+		pthread_attr_setaffinity_np(&attr, sizeof(*cpus), cpus);
+	int status = pthread_create(&thread, &attr, run_loop, server);
+	pthread_attr_destroy(&attr);
+	return status == 0;
+}
+
+// Event loops and queues live until the process exits: the loops only
+// return after a binary upgrade or a shutdown. This thread then waits for
+// the control signals, which every other thread inherits blocked.
+int ReactorThreads::run()
+{
+	const GlobalContext &global = config->getGlobal();
+	std::vector<ServerContext> &configs = config->getServers();
+	int count = thread_count(global);
+	sigset_t control_signals;
+	int sig;
+
+	sigemptyset(&control_signals);
+	sigaddset(&control_signals, SIGHUP);
+	sigaddset(&control_signals, SIGTERM);
+	sigaddset(&control_signals, SIGINT);
+	sigaddset(&control_signals, SIGCHLD);
+	sigaddset(&control_signals, SIGUSR1);
+	// Worker processes leave SIGUSR2 to the master
+	if (global.workerProcesses == 1)
+		sigaddset(&control_signals, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &control_signals, NULL);
+	// Worker processes inherit SIG_IGN for some of them from the master
+	for (sig = 1; sig < NSIG; ++sig)
+	{
+		if (sigismember(&control_signals, sig) == 1)
+			signal(sig, SIG_DFL);
+	}
+
+	group = new HandoffGroup;
+	LOG_INFO("=== STARTING " << count << " EVENT LOOP THREADS AND "
+			  << configs.size() << " ACCEPTORS ===");
+	for (int i = 0; i < count; ++i)
+	{
+		HandoffQueue *queue = new HandoffQueue;
+		Server *loop = new Server;
+		loop->init_worker(queue, global, first_loop + i);
+		group->add(queue, loop->loop_cpu());
+		loops.push_back(loop);
+	}
+	for (size_t i = 0; i < configs.size(); ++i)
+	{
+		Acceptor acceptor;
+		acceptor.server = new Server;
+		acceptor.server->init_acceptor(configs[i], group);
+		acceptor.fd = acceptor.server->listener_fd();
+		acceptor.host = configs[i].host;
+		acceptor.port = configs[i].port;
+		acceptors.push_back(acceptor);
+	}
+
+	for (size_t i = 0; i < loops.size() + acceptors.size(); ++i)
+	{
+		pthread_t thread;
+		Server *server = i < loops.size() ? loops[i] : acceptors[i - loops.size()].server;
+		cpu_set_t cpus;
+		bool pinned = i < loops.size() && CpuAffinity::cpus_for(global, first_loop + i, cpus);
+		if (!start_thread(thread, server, pinned ? &cpus : NULL))
+		{
+			LOG_ERROR("Error: failed to start event loop thread " << i);
+			return 1;
+		}
+		if (i < loops.size())
+			loop_threads.push_back(thread);
+		else
+			acceptors[i - loops.size()].thread = thread;
+	}
+	BinaryUpgrade::finish_startup();
+	while (true)
+	{
+		if (sigwait(&control_signals, &sig) != 0)
+			continue;
+		if (sig == SIGHUP)
+			reload();
+		else if (sig == SIGUSR2 && upgrade())
+			return 0;
+		else if (sig == SIGTERM || sig == SIGINT)
+		{
+			LOG_INFO("Shutting down");
+			stop();
+			return 0;
+		}
+		else if (sig == SIGUSR1)
+			reopen_log();
+		else if (sig == SIGCHLD)
+		{
+			// The exit may be a script of any loop
+			for (size_t i = 0; i < loops.size(); ++i)
+				loops[i]->post_reap();
+		}
+	}
+}
+
+// The acceptors stop and then every loop drains, within shutdown_timeout:
+// a connection an acceptor handed off just before stopping is still served
+void ReactorThreads::stop()
+{
+	int timeout = config->getGlobal().shutdownTimeout;
+
+	for (size_t i = 0; i < acceptors.size(); ++i)
+		acceptors[i].server->post_drain(timeout);
+	for (size_t i = 0; i < acceptors.size(); ++i)
+	{
+		pthread_join(acceptors[i].thread, NULL);
+		delete acceptors[i].server;
+	}
+	acceptors.clear();
+	for (size_t i = 0; i < loops.size(); ++i)
+		loops[i]->post_drain(timeout);
+	for (size_t i = 0; i < loop_threads.size(); ++i)
+		pthread_join(loop_threads[i], NULL);
+}
+
+void ReactorThreads::reopen_log()
+{
+	const GlobalContext &global = config->getGlobal();
+
+	if (!Logger::configure(global.errorLogPath, global.logLevel))
+		LOG_ERROR("Cannot reopen error_log " << global.errorLogPath);
+}
+
+// Start the new binary on the acceptors' listeners. Once it serves, this
+// process stops.
+bool ReactorThreads::upgrade()
+{
+	std::vector<BinaryUpgrade::Listener> listeners;
+
+	LOG_INFO("Binary upgrade requested");
+	for (size_t i = 0; i < acceptors.size(); ++i)
+	{
+		BinaryUpgrade::Listener listener;
+		listener.fd = acceptors[i].fd;
+		listener.host = acceptors[i].host;
+		listener.port = acceptors[i].port;
+		listeners.push_back(listener);
+	}
+	if (!BinaryUpgrade::spawn(config->getPath(), listeners))
+		return false;
+	stop();
+	LOG_INFO("Old process drained, exiting");
+	return true;
+}
+
+// Load the file once, open acceptors for addresses that are new, then post
+// the snapshot to the running acceptors: each one points its listener at
+// the new server block, or closes it and stops when its address is gone.
+// An invalid file or a listener that cannot be opened changes nothing.
+void ReactorThreads::reload()
+{
+	ConfigSnapshot *next;
+
+	LOG_INFO("Reloading configuration from " << config->getPath());
+	try
+	{
+		next = ConfigSnapshot::load(config->getPath());
+	}
+	catch (const std::exception &e)
+	{
+		LOG_ERROR("Reload failed, keeping the running configuration: " << e.what());
+		return;
+	}
+	std::string fixed = next->restartOnlyChanges(config->getGlobal());
+	if (!fixed.empty())
+		LOG_WARN("Reload: " << fixed << " only change on a restart");
+
+	std::vector<ServerContext> &configs = next->getServers();
+	std::vector<bool> kept(acceptors.size(), false);
+	std::vector<Acceptor> added;
+	for (size_t i = 0; i < configs.size(); ++i)
+	{
+		size_t j = 0;
+		while (j < acceptors.size() && (kept[j] || acceptors[j].host != configs[i].host
+				|| acceptors[j].port != configs[i].port))
+			j++;
+		if (j < acceptors.size())
+		{
+			kept[j] = true;
+			continue;
+		}
+		Acceptor acceptor;
+		acceptor.server = new Server;
+		acceptor.host = configs[i].host;
+		acceptor.port = configs[i].port;
+		try
+		{
+			acceptor.server->init_acceptor(configs[i], group);
+			acceptor.fd = acceptor.server->listener_fd();
+		}
+		catch (const std::exception &e)
+		{
+			LOG_ERROR("Reload failed, keeping the running configuration: " << e.what());
+			delete acceptor.server;
+			for (size_t k = 0; k < added.size(); ++k)
+				delete added[k].server;
+			next->release();
+			return;
+		}
+		added.push_back(acceptor);
+	}
+
+	std::vector<Acceptor> running;
+	for (size_t j = 0; j < acceptors.size(); ++j)
+	{
+		acceptors[j].server->post_snapshot(next);
+		if (kept[j])
+			running.push_back(acceptors[j]);
+		else
+		{
+			pthread_join(acceptors[j].thread, NULL);
+			delete acceptors[j].server;
+		}
+	}
+	for (size_t k = 0; k < added.size(); ++k)
+	{
+		if (!start_thread(added[k].thread, added[k].server, NULL))
+		{
+			LOG_ERROR("Reload: failed to start the acceptor for port " << added[k].port);
+			delete added[k].server;
+			continue;
+		}
+		running.push_back(added[k]);
+	}
+	acceptors.swap(running);
+
+	const GlobalContext &next_global = next->getGlobal();
+	LoadLimits::configure(next_global.maxConnections, next_global.maxCgiProcesses);
+	if (!Logger::configure(next_global.errorLogPath, next_global.logLevel))
+		LOG_ERROR("Cannot open error_log " << next_global.errorLogPath << ", keeping the previous one");
+	config->release();
+	config = next;
+	LOG_INFO("Configuration reloaded");
+}
@@ -0,0 +1,54 @@
+#ifndef REACTOR_THREADS_HPP
+# define REACTOR_THREADS_HPP
+
+# include "../config/config_snapshot.hpp"
+# include <pthread.h>
+# include <sched.h>
+# include <vector>
+
+class Server;
+class HandoffGroup;
+
+// Threaded mode (worker_threads): one acceptor thread per listener and N
+// event-loop threads, each with its own epoll instance, fd table, CGI runner
+// and buffer pool. Acceptors hand new connections to the loops through
+// lock-free queues, so the loops share nothing but the parsed config. The
+// calling thread stays behind to handle the process's signals.
+class ReactorThreads
+{
+  private:
+	struct Acceptor
+	{
+		Server *server;
+		pthread_t thread;
+		int fd;                        // its listener
+		std::string host;
+		std::string port;
+	};
+
+	ConfigSnapshot *config;
+	size_t first_loop;                 // worker_cpu_affinity number of loop 0
+	HandoffGroup *group;
+	std::vector<Acceptor> acceptors;
+	std::vector<Server *> loops;
+	std::vector<pthread_t> loop_threads;
+
+	static void *run_loop(void *server);
+	bool start_thread(pthread_t &thread, Server *server, const cpu_set_t *cpus);
+	void reload();
+	bool upgrade();
+	void stop();
+	void reopen_log();
+
+	ReactorThreads(const ReactorThreads &);
+	ReactorThreads &operator=(const ReactorThreads &);
+
+  public:
+	ReactorThreads(ConfigSnapshot *config, size_t first_loop = 0);
+	~ReactorThreads();
+
+	static int thread_count(const GlobalContext &global);
+	int run();
+};
+
+#endif
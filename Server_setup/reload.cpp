@@ -0,0 +1,262 @@
+#include "server.hpp"
+#include "../utils/logger.hpp"
+#include "load_limits.hpp"
+#include <algorithm>
+
+// Parse the config file again and switch to it. A file that does not parse,
+// or a listener that cannot be opened, leaves the running config in place.
+void Server::reload()
+{
+	ConfigSnapshot *next;
+
+	LOG_INFO("Reloading configuration from " << active->getPath());
+	try
+	{
+		next = ConfigSnapshot::load(active->getPath());
+	}
+	catch (const std::exception &e)
+	{
+		LOG_ERROR("Reload failed, keeping the running configuration: " << e.what());
+		return;
+	}
+	std::string fixed = next->restartOnlyChanges(global);
+	if (!fixed.empty())
+		LOG_WARN("Reload: " << fixed << " only change on a restart");
+	if (apply_snapshot(*next))
+	{
+		const GlobalContext &next_global = next->getGlobal();
+		LoadLimits::configure(next_global.maxConnections, next_global.maxCgiProcesses);
+		if (!Logger::configure(next_global.errorLogPath, next_global.logLevel))
+			LOG_ERROR("Cannot open error_log " << next_global.errorLogPath << ", keeping the previous one");
+		LOG_INFO("Configuration reloaded");
+	}
+	else
+		LOG_ERROR("Reload failed, keeping the running configuration");
+	next->release();
+}
+
+// Serve new connections from `next`. A listener whose host:port is still
+// configured stays open, backlog included, and points at its new server
+// block; listeners no longer configured are closed and new addresses are
+// opened. Accepted connections keep the block they started with. Returns
+// false, with nothing changed, when a new listener cannot be opened.
+// Acceptor threads only look after their own listener.
+bool Server::apply_snapshot(ConfigSnapshot &next)
+{
+	std::vector<ServerContext> &configs = next.getServers();
+	std::vector<int> listeners(configs.size(), -1);  // server block -> fd
+	std::vector<int> unused = server_fds;
+	std::vector<int> opened;
+
+	for (size_t i = 0; i < configs.size(); ++i)
+	{
+		for (size_t j = 0; j < unused.size(); ++j)
+		{
+			if (unused[j] == -1)
+				continue;
+			const ServerContext *current = fds.get(unused[j]).config;
+			if (current->host == configs[i].host && current->port == configs[i].port)
+			{
+				listeners[i] = unused[j];
+				unused[j] = -1;
+				break;
+			}
+		}
+		if (listeners[i] != -1 || handoff)
+			continue;
+		try
+		{
+			listeners[i] = add_listener(configs[i]);
+			opened.push_back(listeners[i]);
+		}
+		catch (const std::exception &e)
+		{
+			LOG_ERROR("Reload: " << e.what());
+			for (size_t k = 0; k < opened.size(); ++k)
+				close_listener(opened[k]);
+			return false;
+		}
+	}
+
+	for (size_t j = 0; j < unused.size(); ++j)
+	{
+		if (unused[j] == -1)
+			continue;
+		LOG_INFO("Reload: closing listener on port " << fds.get(unused[j]).port);
+		close_listener(unused[j]);
+	}
+	for (size_t i = 0; i < configs.size(); ++i)
+	{
+		if (listeners[i] == -1)
+			continue;
+		if (std::find(opened.begin(), opened.end(), listeners[i]) == opened.end())
+			retune_listener(listeners[i], configs[i]);
+		fds.add_listener(listeners[i], &configs[i], atoi(configs[i].port.c_str()));
+	}
+	next.retain();
+	if (active)
+		active->release();
+	active = &next;
+	global.eventBudget = next.getGlobal().eventBudget;
+	global.acceptBatch = next.getGlobal().acceptBatch;
+	return true;
+}
+
+void Server::close_listener(int server_fd)
+{
+	io->remove(server_fd);
+	fds.release(server_fd);
+	close(server_fd);
+	for (size_t i = 0; i < server_fds.size(); ++i)
+	{
+		if (server_fds[i] == server_fd)
+		{
+			server_fds.erase(server_fds.begin() + i);
+			break;
+		}
+	}
+	for (size_t i = 0; i < paused_listeners.size(); ++i)
+	{
+		if (paused_listeners[i] == server_fd)
+		{
+			paused_listeners.erase(paused_listeners.begin() + i);
+			break;
+		}
+	}
+}
+
+// Hand a loaded snapshot to an acceptor thread. Any thread; a snapshot
+// posted earlier and not yet applied is superseded.
+void Server::post_snapshot(ConfigSnapshot *next)
+{
+	uint64_t one = 1;
+
+	next->retain();
+	ConfigSnapshot *previous = __sync_lock_test_and_set(&posted, next);
+	if (previous)
+		previous->release();
+	if (write(control_fd, &one, sizeof(one)) != sizeof(one))
+	{
+		// Counter saturated: a wakeup is already pending
+	}
+}
+
+void Server::adopt_posted_snapshot()
+{
+	uint64_t count;
+
+	if (read(control_fd, &count, sizeof(count)) != sizeof(count))
+	{
+		// Nothing pending
+	}
+	if (reap_requested)
+	{
+		reap_requested = false;
+		reap_cgi();
+	}
+	if (drain_requested)
+	{
+		if (!draining)
+			drain(drain_timeout);
+		return;
+	}
+	ConfigSnapshot *next = __sync_lock_test_and_set(&posted, static_cast<ConfigSnapshot *>(NULL));
+	if (!next)
+		return;
+	apply_snapshot(*next);
+	next->release();
+}
+
+// Hand the listeners to a new copy of the binary and, once it serves, let
+// the connections in flight finish here
+void Server::upgrade()
+{
+	std::vector<BinaryUpgrade::Listener> listeners;
+
+	LOG_INFO("Binary upgrade requested");
+	for (size_t i = 0; i < server_fds.size(); ++i)
+	{
+		const ServerContext *config = fds.get(server_fds[i]).config;
+		BinaryUpgrade::Listener listener;
+		listener.fd = server_fds[i];
+		listener.host = config->host;
+		listener.port = config->port;
+		listeners.push_back(listener);
+	}
+	if (BinaryUpgrade::spawn(active->getPath(), listeners))
+		drain(active->getGlobal().shutdownTimeout);
+}
+
+// Stop accepting and finish what is open: idle keep-alive connections
+// close now, the others after their current response, file stream or CGI
+// script. run() returns once the last one is gone, or once timeout_seconds
+// have passed and the stragglers were closed.
+void Server::drain(int timeout_seconds)
+{
+	LOG_INFO("Draining " << fds.clients() << " connections");
+	// Connections already handed to this loop are served too
+	if (inbox)
+		adopt_handoffs();
+	draining = true;
+	while (!server_fds.empty())
+		close_listener(server_fds.back());
+	for (int fd = 0; fd < fds.capacity(); ++fd)
+	{
+		if (fds.get(fd).kind == FD_CLIENT)
+			fds.find_client(fd)->stop_keep_alive(*io, fds);
+	}
+	if (fds.clients() > 0)
+	{
+		LOG_INFO("Waiting up to " << timeout_seconds << " seconds for " << fds.clients() << " connections");
+		shutdown_deadline.fd = signal_fd != -1 ? signal_fd : control_fd;
+		timers.arm(&shutdown_deadline, static_cast<uint64_t>(timeout_seconds) * 1000);
+	}
+}
+
+// The drain deadline passed, or a second SIGTERM came: close whatever is
+// still open, responses in flight included
+void Server::close_connections()
+{
+	timers.cancel(&shutdown_deadline);
+	if (fds.clients() > 0)
+		LOG_WARN("Closing " << fds.clients() << " connections still open");
+	for (int fd = 0; fd < fds.capacity(); ++fd)
+	{
+		if (fds.get(fd).kind == FD_CLIENT)
+			fds.find_client(fd)->cleanup_connection(*io, fds);
+	}
+}
+
+// Threaded mode: have this loop drain within timeout_seconds. Any thread.
+void Server::post_drain(int timeout_seconds)
+{
+	uint64_t one = 1;
+
+	drain_timeout = timeout_seconds;
+	__sync_synchronize();
+	drain_requested = true;
+	__sync_synchronize();
+	if (write(control_fd, &one, sizeof(one)) != sizeof(one))
+	{
+		// Counter saturated: a wakeup is already pending
+	}
+}
+
+// Threaded mode: SIGCHLD came in, have this loop collect its CGI scripts.
+// Any thread.
+void Server::post_reap()
+{
+	uint64_t one = 1;
+
+	reap_requested = true;
+	__sync_synchronize();
+	if (write(control_fd, &one, sizeof(one)) != sizeof(one))
+	{
+		// Counter saturated: a wakeup is already pending
+	}
+}
+
+int Server::listener_fd() const
+{
+	return server_fds.empty() ? -1 : server_fds[0];
+}
@@ -1,191 +1,360 @@
 #include "server.hpp"
+#include "../utils/logger.hpp"
+#include "load_limits.hpp"
+#include "peer_limits.hpp"
 
 void Server::run()
 {
-	const int			MAX_EVENTS = 10;
+	const int			MAX_EVENTS = 256;
 	const int			TIMEOUT = 30000; // 30 seconds
 	struct epoll_event	events[MAX_EVENTS];
 	int					num_events;
-	int					fd;
 	int					server_fd;
 	int					port;
-	ServerContext		*server_config;
-	int					client_fd;
 
-	std::cout << "=== RUNNING MULTIPLE SERVERS ===" << std::endl;
-	std::cout << "Monitoring " << server_fds.size() << " server sockets" << std::endl;
+	LOG_INFO("=== RUNNING MULTIPLE SERVERS ===");
+	LOG_INFO("Monitoring " << server_fds.size() << " server sockets");
 	for (size_t i = 0; i < server_fds.size(); ++i)
 	{
 		server_fd = server_fds[i];
-		port = fd_to_port[server_fd];
-		std::cout << "Server " << (i
-			+ 1) << " listening on port " << port << " (fd: " << server_fd << ")" << std::endl;
+		port = fds.get(server_fd).port;
+		LOG_INFO("Server " << (i
+			+ 1) << " listening on port " << port << " (fd: " << server_fd << ")");
 	}
-	while (true)
+	while (!finished())
 	{
-		// Check for CGI timeouts before waiting for new events
-		std::vector<int> timed_out_fds = cgi_runner.get_timed_out_cgi_fds();
-		if (!timed_out_fds.empty())
+		// Fds that used up their budget last turn still have work and, when
+		// edge-triggered, no event will report them again: poll without
+		// blocking and serve them after this turn's events
+		std::vector<struct epoll_event> carried;
+		carried.swap(deferred_events);
+		int timeout = 0;
+		if (carried.empty())
 		{
-			std::cout << "\033[34m[TIMEOUT SCAN] Found " << timed_out_fds.size() << " timed out CGI processes\033[0m" << std::endl;
+			// Sleep until the next deadline on the timing wheel
+			timeout = timers.next_timeout();
+			if (timeout < 0 || timeout > TIMEOUT)
+				timeout = TIMEOUT;
 		}
-		
-		for (size_t i = 0; i < timed_out_fds.size(); ++i)
+		num_events = io->wait(events, MAX_EVENTS, timeout);
+		timers.update_clock();
+		if (num_events == 0 && carried.empty())
 		{
-			int cgi_fd = timed_out_fds[i];
-			std::string timeout_response;
-			if (cgi_runner.check_cgi_timeout(cgi_fd, timeout_response))
-			{
-				std::cout << "CGI timeout detected on fd " << cgi_fd << std::endl;
-				
-				// Send timeout response to client
-				int client_fd = cgi_runner.get_client_fd(cgi_fd);
-				if (client_fd >= 0 && !timeout_response.empty())
-				{
-					std::map<int, Client>::iterator client_it = active_clients.find(client_fd);
-					if (client_it != active_clients.end())
-					{
-						ssize_t bytes_sent = send(client_fd, timeout_response.c_str(), timeout_response.size(), 0);
-						if (bytes_sent == -1 || bytes_sent == 0)
-						{
-							std::cout << "Failed to send CGI timeout response to client " << client_fd << std::endl;
-						}
-						else
-						{
-							std::cout << "Sent " << bytes_sent << " bytes of CGI timeout response to client " << client_fd << std::endl;
-						}
-						client_it->second.cleanup_connection(epoll_fd, active_clients);
-					}
-				}
-				
-				// Clean up the timed out CGI process
-				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, cgi_fd, NULL);
-				cgi_runner.cleanup_cgi_process(cgi_fd);
-			}
+			buffer_pool.print_stats();
+			exchanges.print_stats(fds.clients());
+			affinity.print_stats();
+			LoadLimits::print_stats();
+			PeerLimits::print_stats();
 		}
 		
-		num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, TIMEOUT);
-        if (num_events == 0)
-        {
-            check_client_timeouts(active_clients);
-            continue; // No events, continue waiting
-        }
-		
 		for (int i = 0; i < num_events; i++)
+			dispatch_event(events[i]);
+		for (size_t i = 0; i < carried.size(); i++)
+			dispatch_event(carried[i]);
+		expire_timers();
+		act_on_signals();
+	}
+}
+
+// Acceptor threads stop once a reload closed their listener; a loop that
+// is draining stops with its last connection
+bool Server::finished() const
+{
+	if (draining)
+		return fds.clients() == 0;
+	return !inbox && server_fds.empty();
+}
+
+// Act on every client and CGI deadline that passed. Owners that saw
+// activity earlier in this turn have re-armed their timer and ignore it.
+void Server::expire_timers()
+{
+	std::vector<int> fired;
+
+	timers.expire(fired);
+	for (size_t i = 0; i < fired.size(); ++i)
+	{
+		int fd = fired[i];
+		FdKind kind = fds.get(fd).kind;
+
+		if (kind == FD_CLIENT)
+		{
+			// A request held back by limit_req is due
+			if (fds.find_client(fd)->handle_timeout(*io, fds))
+				defer_event(fd, 0);
+		}
+		else if (kind == FD_LISTENER)
+			resume_listeners();
+		else if (kind == FD_SIGNAL || kind == FD_CONTROL)
+		{
+			if (draining && !shutdown_deadline.armed())
+				close_connections();
+		}
+		else if (kind == FD_CGI)
+		{
+			std::string timeout_response;
+			if (!cgi_runner.check_cgi_timeout(fd, timeout_response))
+				continue;
+			LOG_DEBUG("CGI timeout detected on fd " << fd);
+			// The connection closes after the error response
+			deliver_cgi_response(fd, timeout_response, false);
+			close_cgi(fd);
+		}
+	}
+}
+
+// One index into the fd table tells what the fd is
+void Server::dispatch_event(const struct epoll_event &event)
+{
+	int fd = event.data.fd;
+	const FdHandle &handle = fds.get(fd);
+
+	switch (handle.kind)
+	{
+	case FD_LISTENER:
+		accept_connections(fd);
+		break;
+	case FD_CLIENT:
+		handle_client_event(fd, event.events);
+		break;
+	case FD_CGI:
+		handle_cgi_event(fd, event.events);
+		break;
+	case FD_WAKEUP:
+		adopt_handoffs();
+		break;
+	case FD_CONTROL:
+		adopt_posted_snapshot();
+		break;
+	case FD_SIGNAL:
+		read_signals();
+		break;
+	default:
+		// Closed earlier in this batch, or a deferred fd that went away
+		LOG_WARN("Unknown fd " << fd << " - not a server or client socket or CGI");
+		break;
+	}
+}
+
+void Server::defer_event(int fd, uint32_t events)
+{
+	struct epoll_event event;
+
+	event.events = events;
+	event.data.fd = fd;
+	deferred_events.push_back(event);
+}
+
+// Accept up to acceptBatch pending connections. Edge-triggered listeners
+// only report new arrivals, so the backlog must be drained or revisited.
+void Server::accept_connections(int server_fd)
+{
+	// Copied out: adopting a connection may grow the table
+	ServerContext *config = fds.get(server_fd).config;
+	int port = fds.get(server_fd).port;
+	int client_fd;
+	uint32_t peer = 0;
+	int shed = 0;
+
+	for (int accepted = 0; accepted < global.acceptBatch; accepted++)
+	{
+		LOG_DEBUG("New connection on server port " << port << " (server fd: " << server_fd << ")");
+		client_fd = Client::accept_connection(server_fd, &peer);
+		if (client_fd == Client::ACCEPT_NO_FDS)
+			client_fd = refuse_connection(server_fd);
+		if (client_fd == Client::ACCEPT_DRAINED)
+			return;
+		if (client_fd == Client::ACCEPT_NO_FDS)
+		{
+			LOG_WARN("Out of file descriptors: pausing listener " << server_fd);
+			pause_listener(server_fd);
+			return;
+		}
+		if (client_fd >= 0 && LoadLimits::should_shed())
 		{
-			fd = events[i].data.fd;
-			if (is_server_socket(fd))
-			{
-				port = fd_to_port[fd];
-				server_config = fd_to_config[fd];
-				std::cout << "New connection on server port " << port << " (server fd: " << fd << ")" << std::endl;
-				client_fd = Client::handle_new_connection(fd, epoll_fd,
-						active_clients);
-				if (client_fd == -1)
-				{
-					std::cout << "Failed to handle new connection on port " << port << std::endl;
-					continue; // skip this connection and continue with next event
-				}
-				client_to_server[client_fd] = fd;
-				std::cout << "Client " << client_fd << " connected to server " << port << std::endl;
-			}
-			else if (is_client_socket(fd))
-			{
-				std::map<int, Client>::iterator it = active_clients.find(fd);
-				if (it != active_clients.end())
-				{
-					server_config = get_client_config(fd);
-					if (server_config == NULL)
-					{
-						std::cout << "No server config found for client " << fd << std::endl;
-						continue ;
-					}
-					server_fd = client_to_server[fd];
-					port = fd_to_port[server_fd];
-					if (events[i].events & EPOLLIN)
-					{
-						std::cout << "Data input from client " << fd << " (server port " << port << ")" << std::endl;
-						it->second.handle_client_data_input(epoll_fd,
-							active_clients, *server_config, cgi_runner);
-					}
-					else if (events[i].events & EPOLLOUT)
-					{
-						std::cout << "Data output to client " << fd << " (server port " << port << ")" << std::endl;
-						it->second.handle_client_data_output(fd, epoll_fd,
-							active_clients, *server_config);
-					}
-				}
-			}
-			else if (is_cgi_socket(fd))
-			{
-				std::cout << "Handling CGI process I/O on fd " << fd << std::endl;
-				
-				if (events[i].events & EPOLLIN)
-				{
-					std::string response_data;
-					// Update activity timestamp when we receive data
-					cgi_runner.update_cgi_activity(fd);
-					if (cgi_runner.handle_cgi_output(fd, response_data))
-					{
-						epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
-						int client_fd = cgi_runner.get_client_fd(fd);
-						if (client_fd >= 0 && !response_data.empty())
-						{
-							std::map<int, Client>::iterator client_it = active_clients.find(client_fd);
-							if (client_it != active_clients.end())
-							{
-								ssize_t bytes_sent = send(client_fd, response_data.c_str(), response_data.size(), 0);
-								if (bytes_sent == -1 || bytes_sent == 0)
-								{
-									std::cout << "Failed to send CGI response to client " << client_fd << std::endl;
-								}
-								else
-								{
-									std::cout << "Sent " << bytes_sent << " bytes of CGI response to client " << client_fd << std::endl;
-								}
-								client_it->second.cleanup_connection(epoll_fd, active_clients);
-							}
-						}
-						// Clean up CGI process
-						cgi_runner.cleanup_cgi_process(fd);
-					}
-				}
-				else if (events[i].events & (EPOLLHUP | EPOLLERR))
-				{
-					std::cout<<"----------------------+++++++++++++++++\n";
-					std::cout << "CGI process fd " << fd << " closed or error occurred" << std::endl;
-					std::string response_data;
-					if (cgi_runner.handle_cgi_output(fd, response_data))
-					{
-						int client_fd = cgi_runner.get_client_fd(fd);
-						if (client_fd >= 0 && !response_data.empty())
-						{
-							std::map<int, Client>::iterator client_it = active_clients.find(client_fd);
-							if (client_it != active_clients.end())
-							{
-								ssize_t bytes_sent = send(client_fd, response_data.c_str(), response_data.size(), 0);
-								if (bytes_sent == -1 || bytes_sent == 0)
-								{
-									std::cout << "Failed to send CGI response to client " << client_fd << std::endl;
-								}
-								else
-								{
-									std::cout << "Sent " << bytes_sent << " bytes of CGI response to client " << client_fd << std::endl;
-								}
-								client_it->second.cleanup_connection(epoll_fd, active_clients);
-							}
-						}
-					}
-					
-					epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
-					cgi_runner.cleanup_cgi_process(fd);
-				}
-			}
-			else
-			{
-				std::cout << "Warning: Unknown fd " << fd << " - not a server or client socket or CGI" << std::endl;
-			}
+			LoadLimits::shed_connection(client_fd);
+			shed++;
+			continue;
 		}
+		if (client_fd >= 0)
+		{
+			LoadLimits::connection_opened();
+			if (!handoff)
+				affinity.record(client_fd);
+		}
+		if (client_fd == Client::ACCEPT_DROPPED
+			|| (!handoff && !Client::adopt_connection(client_fd, config, peer, *io, fds, global, timers, exchanges)))
+		{
+			LOG_ERROR("Failed to handle new connection on port " << port);
+			continue; // skip this connection and continue with next one
+		}
+		if (handoff)
+		{
+			// The loop that adopts it takes this reference over
+			config->snapshot->retain();
+			int cpu = handoff->routes_by_cpu() ? CpuAffinity::incoming_cpu(client_fd) : -1;
+			handoff->pick(cpu)->push(client_fd, config, peer);
+		}
+		LOG_DEBUG("Client " << client_fd << " connected to server " << port);
+	}
+	// A whole batch shed: the listener is flooded. Leave the backlog to the
+	// kernel for a moment so the open connections get the loop.
+	if (shed == global.acceptBatch)
+	{
+		LoadLimits::count_listener_pause();
+		pause_listener(server_fd);
+		return;
 	}
+	defer_event(server_fd, EPOLLIN);
 }
 
+// Out of descriptors, a pending connection would keep a level-triggered
+// listener firing forever. Spend the reserve descriptor to accept it and
+// close it right away, so the client sees a clean close rather than a
+// hanging connect. Returns ACCEPT_DROPPED when a connection was refused,
+// ACCEPT_DRAINED when none was pending (EMFILE is reported regardless) and
+// ACCEPT_NO_FDS when no reserve could be kept.
+int Server::refuse_connection(int server_fd)
+{
+	if (reserve_fd == -1)
+		reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	if (reserve_fd == -1)
+		return Client::ACCEPT_NO_FDS;
+	close(reserve_fd);
+	int fd = Client::accept_connection(server_fd);
+	if (fd >= 0)
+	{
+		LOG_WARN("Out of file descriptors: refused a connection on fd " << server_fd);
+		close(fd);
+		fd = Client::ACCEPT_DROPPED;
+	}
+	reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	if (reserve_fd == -1)
+		return Client::ACCEPT_NO_FDS;
+	return fd;
+}
+
+// Stop watching the listener for a moment; connections wait in the backlog
+void Server::pause_listener(int server_fd)
+{
+	const uint64_t PAUSE_MS = 100;
+
+	io->modify(server_fd, 0);
+	paused_listeners.push_back(server_fd);
+	listener_pause.fd = server_fd;
+	timers.arm(&listener_pause, PAUSE_MS);
+}
+
+void Server::resume_listeners()
+{
+	for (size_t i = 0; i < paused_listeners.size(); ++i)
+	{
+		int server_fd = paused_listeners[i];
+		io->modify(server_fd, global.edgeTriggered ? EPOLLIN | EPOLLET : EPOLLIN);
+		defer_event(server_fd, EPOLLIN);
+	}
+	paused_listeners.clear();
+}
+
+// Register the connections acceptor threads queued for this event loop
+void Server::adopt_handoffs()
+{
+	int client_fd;
+	ServerContext *config;
+	uint32_t peer;
+
+	inbox->clear_wakeup();
+	while (inbox->pop(client_fd, config, peer))
+	{
+		affinity.record(client_fd);
+		Client::adopt_connection(client_fd, config, peer, *io, fds, global, timers, exchanges);
+		config->snapshot->release();
+	}
+}
+
+void Server::handle_client_event(int fd, uint32_t events)
+{
+	Client *client = fds.find_client(fd);
+
+	LOG_DEBUG("Events 0x" << std::hex << events << std::dec << " on client " << fd);
+	if (client->handle_events(events, *io, fds, cgi_runner, buffer_pool))
+		defer_event(fd, 0);
+}
+
+void Server::handle_cgi_event(int fd, uint32_t events)
+{
+	std::string response_data;
+	bool more;
+
+	LOG_DEBUG("Handling CGI process I/O on fd " << fd);
+	if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+		return;
+	if (!(events & EPOLLIN))
+		LOG_DEBUG("CGI process fd " << fd << " closed or error occurred");
+	if (cgi_runner.handle_cgi_output(fd, response_data, global.eventBudget, more))
+	{
+		deliver_cgi_response(fd, response_data, cgi_runner.keeps_alive(fd));
+		// Clean up CGI process
+		close_cgi(fd);
+		return;
+	}
+	if (!response_data.empty() && deliver_cgi_output(fd, response_data))
+	{
+		// The client is behind: leave the rest in the pipe, which blocks
+		// the script, until the client resumes it
+		io->modify(fd, 0);
+		cgi_runner.pause_cgi(fd);
+	}
+	else if (more)
+		defer_event(fd, EPOLLIN);
+	else if (cgi_runner.awaiting_exit(fd))
+	{
+		// Output is complete; the exit status arrives with SIGCHLD. A
+		// level-triggered pipe at EOF would keep reporting it until then.
+		if (!global.edgeTriggered)
+			io->modify(fd, 0);
+	}
+	else if (!(events & EPOLLIN))
+	{
+		// Hung up without reaching EOF: nothing more will come
+		close_cgi(fd);
+	}
+}
+
+// Hand a finished CGI response to the client that started the script and
+// push it out right away
+void Server::deliver_cgi_response(int cgi_fd, const std::string &response_data, bool keep_alive)
+{
+	int client_fd = cgi_runner.get_client_fd(cgi_fd);
+	Client *client = fds.find_client(client_fd);
+
+	if (!client)
+		return;
+	LOG_DEBUG("Queueing " << response_data.size() << " bytes of CGI response for client " << client_fd);
+	client->queue_cgi_response(response_data, keep_alive);
+	if (client->handle_events(0, *io, fds, cgi_runner, buffer_pool))
+		defer_event(client_fd, 0);
+}
+
+// Pass on output of a script whose response is being streamed. Returns
+// true when the client asks for the pipe to be paused.
+bool Server::deliver_cgi_output(int cgi_fd, const std::string &output)
+{
+	int client_fd = cgi_runner.get_client_fd(cgi_fd);
+	Client *client = fds.find_client(client_fd);
+
+	if (!client)
+		return false;
+	client->queue_cgi_output(output);
+	if (client->handle_events(0, *io, fds, cgi_runner, buffer_pool))
+		defer_event(client_fd, 0);
+	client = fds.find_client(client_fd);
+	return client && client->cgi_output_paused();
+}
+
+void Server::close_cgi(int cgi_fd)
+{
+	io->remove(cgi_fd);
+	cgi_runner.cleanup_cgi_process(cgi_fd);
+	fds.release(cgi_fd);
+}
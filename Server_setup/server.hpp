@@ -5,7 +5,12 @@
 # include "../request/request.hpp"
 # include "../response/response.hpp"
 # include "../cgi/cgi_runner.hpp"
+# include "cpu_affinity.hpp"
+# include "fd_table.hpp"
+# include "handoff_queue.hpp"
+# include "io_engine.hpp"
 # include <arpa/inet.h>
+# include <csignal>
 # include <cstring>
 # include <exception>
 # include <fcntl.h>
@@ -13,46 +18,101 @@
 # include <map>
 # include <netdb.h>
 # include <netinet/in.h>
+# include <netinet/tcp.h>
 # include <stdexcept>
 # include <sys/epoll.h>
+# include <sys/eventfd.h>
+# include <sys/signalfd.h>
 # include <sys/socket.h>
 # include <unistd.h>
 #include <cstdlib>  // For atoi()
 
-#include "../config/parser.hpp"
+#include "../config/config_snapshot.hpp"
+#include "binary_upgrade.hpp"
 class	Client;
 class Server
 {
   private:
     int server_fd;
     int port;
-    int epoll_fd;
+    IoEngine *io;                               // epoll or io_uring readiness loop
     std::string hostname;
 
     std::vector<int> server_fds;
-    std::map<int, ServerContext*> fd_to_config;
-    std::map<int, int> fd_to_port;              
-    std::map<int, int> client_to_server; 
-    std::map<int, Client> active_clients;
+    TimerWheel timers;                          // client and CGI deadlines; outlives both
+    ExchangePool exchanges;                     // request state of busy clients; outlives them
+    FdTable fds;                                // listener/client/CGI handle per fd
     struct sockaddr_in address;
     CgiRunner cgi_runner;
+    BufferPool buffer_pool;
+    GlobalContext global;
+    std::vector<struct epoll_event> deferred_events; // fds that ran out of budget last turn
+    HandoffQueue *inbox;                        // threaded mode: connections for this loop
+    HandoffGroup *handoff;                      // threaded mode: loops to pass accepts to
+    int reserve_fd;                             // spare descriptor spent to refuse a connection on EMFILE
+    std::vector<int> paused_listeners;          // listeners muted while out of descriptors
+    TimerNode listener_pause;                   // when to watch them again
+    ConfigSnapshot *active;                     // config the listeners serve new connections from
+    int control_fd;                             // threaded mode: eventfd announcing a posted snapshot
+    ConfigSnapshot *volatile posted;            // snapshot waiting to be applied by this loop
+    volatile bool drain_requested;              // threaded mode: posted by post_drain()
+    volatile int drain_timeout;                 // shutdown_timeout posted along with it
+    volatile bool reap_requested;               // threaded mode: posted by post_reap()
+    bool draining;                              // listeners closed, finishing open connections
+    TimerNode shutdown_deadline;                // when draining gives up on open connections
+    int signal_fd;                              // signalfd when this loop runs the process
+    bool reload_requested;                      // SIGHUP read from signal_fd
+    bool upgrade_requested;                     // SIGUSR2
+    bool shutdown_requested;                    // SIGTERM or SIGINT
+    CpuAffinity affinity;                       // worker_cpu_affinity of this loop
+
+    void init_event_loop(const GlobalContext& global_config);
+    int add_listener(const ServerContext& config);
+    void close_listener(int server_fd);
+    void retune_listener(int server_fd, const ServerContext& config);
+    void adopt_handoffs();
+    void reload();
+    bool apply_snapshot(ConfigSnapshot &next);
+    void adopt_posted_snapshot();
+    void add_control_channel();
+    void upgrade();
+    void drain(int timeout_seconds);
+    void close_connections();
+    bool finished() const;
+    void add_signal_channel(bool binary_upgrade);
+    void read_signals();
+    void act_on_signals();
+    void reap_cgi();
+
+    void dispatch_event(const struct epoll_event &event);
+    void accept_connections(int server_fd);
+    int refuse_connection(int server_fd);
+    void pause_listener(int server_fd);
+    void resume_listeners();
+    void handle_client_event(int fd, uint32_t events);
+    void handle_cgi_event(int fd, uint32_t events);
+    void deliver_cgi_response(int cgi_fd, const std::string &response_data, bool keep_alive);
+    bool deliver_cgi_output(int cgi_fd, const std::string &output);
+    void close_cgi(int cgi_fd);
+    void expire_timers();
+    void defer_event(int fd, uint32_t events);
 
   public:
     Server();
     ~Server();
 
-    void init_data(const std::vector<ServerContext>& configs);
+    void init_data(ConfigSnapshot* config, size_t loop = 0);
+    void init_acceptor(ServerContext& config, HandoffGroup* group);
+    void init_worker(HandoffQueue* queue, const GlobalContext& global_config, size_t loop);
+    int loop_cpu() const;
     void run();
+    void post_snapshot(ConfigSnapshot* next);
+    void post_drain(int timeout_seconds);
+    void post_reap();
+    int listener_fd() const;
 
-    int setup_Socket_with_host(int port, const std::string& host);
-    int setup_epoll();
-
-    bool is_server_socket(int fd);
-    bool is_client_socket(int fd);
-    bool is_cgi_socket(int fd);
-    ServerContext* get_server_config(int fd);
-    ServerContext* get_client_config(int client_fd);
-    void check_client_timeouts(std::map<int, Client> &active_clients);
+    int setup_Socket_with_host(int port, const std::string& host, const ListenOptions& options);
+    static void tune_listener(int fd, const ListenOptions& options, int port);
 };
 
 #endif
@@ -0,0 +1,109 @@
+#include "server.hpp"
+#include "../utils/logger.hpp"
+
+// Signals this loop reads from its signalfd. They are blocked, so they stay
+// pending until read instead of interrupting whatever the loop is doing.
+static void loop_signals(sigset_t &signals, bool binary_upgrade)
+{
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGHUP);
+	sigaddset(&signals, SIGCHLD);
+	sigaddset(&signals, SIGUSR1);
+	// Worker processes leave SIGUSR2 to the master
+	if (binary_upgrade)
+		sigaddset(&signals, SIGUSR2);
+}
+
+// The loop that runs the process takes its signals as events: SIGHUP
+// reloads, SIGUSR2 upgrades the binary, SIGTERM and SIGINT drain, SIGUSR1
+// reopens the error log and SIGCHLD collects CGI scripts. The worker
+// processes of a master inherit SIG_IGN for some of them: back to the
+// default, after blocking, so none is lost in between.
+void Server::add_signal_channel(bool binary_upgrade)
+{
+	sigset_t signals;
+
+	loop_signals(signals, binary_upgrade);
+	if (sigprocmask(SIG_BLOCK, &signals, NULL) == -1)
+		throw std::runtime_error("Failed to block the signals of the event loop");
+	for (int sig = 1; sig < NSIG; ++sig)
+	{
+		if (sigismember(&signals, sig) == 1)
+			signal(sig, SIG_DFL);
+	}
+	signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd == -1 || !io->add(signal_fd, global.edgeTriggered ? EPOLLIN | EPOLLET : EPOLLIN))
+		throw std::runtime_error("Failed to set up the event loop's signalfd");
+	fds.add_signal(signal_fd);
+}
+
+// Take every pending signal off the signalfd. What they ask for waits for
+// the end of the turn, once this turn's events are served.
+void Server::read_signals()
+{
+	struct signalfd_siginfo info;
+
+	while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+	{
+		LOG_DEBUG("Signal " << info.ssi_signo << " from pid " << info.ssi_pid);
+		switch (info.ssi_signo)
+		{
+		case SIGHUP:
+			reload_requested = true;
+			break;
+		case SIGUSR2:
+			upgrade_requested = true;
+			break;
+		case SIGTERM:
+		case SIGINT:
+			shutdown_requested = true;
+			break;
+		case SIGUSR1:
+		{
+			const GlobalContext &current = active->getGlobal();
+			if (!Logger::configure(current.errorLogPath, current.logLevel))
+				LOG_ERROR("Cannot reopen error_log " << current.errorLogPath);
+			break;
+		}
+		case SIGCHLD:
+			reap_cgi();
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// A SIGTERM during the drain gives up on the connections still open
+void Server::act_on_signals()
+{
+	if (shutdown_requested)
+	{
+		shutdown_requested = false;
+		if (draining)
+			close_connections();
+		else
+		{
+			LOG_INFO("Shutting down");
+			drain(active->getGlobal().shutdownTimeout);
+		}
+	}
+	if (reload_requested && !draining)
+		reload();
+	if (upgrade_requested && !draining)
+		upgrade();
+	reload_requested = false;
+	upgrade_requested = false;
+}
+
+// Answer the clients of scripts that exited after closing their output
+void Server::reap_cgi()
+{
+	std::vector<int> exited;
+
+	cgi_runner.reap_children(exited);
+	for (size_t i = 0; i < exited.size(); ++i)
+		handle_cgi_event(exited[i], EPOLLIN);
+}
@@ -1,22 +1,71 @@
 #include "server.hpp"
+#include "../utils/logger.hpp"
 
-int Server::setup_Socket_with_host(int port, const std::string& host)
+// Apply the port parameters to a listener. Accepted sockets copy buffer
+// sizes, TCP_NODELAY and TCP_NOTSENT_LOWAT from it, so connections need no
+// calls of their own. Run again on a reload: options that were dropped go
+// back to the kernel default, except buffer sizes, which stay until a
+// restart. An option the kernel refuses is logged and skipped.
+void Server::tune_listener(int fd, const ListenOptions& options, int port)
 {
-    std::cout << "=== SETTING UP SERVER ON " << host << ":" << port << " ===" << std::endl;
+    int nodelay = options.nodelay ? 1 : 0;
+    // The kernel holds a deferred connection for at most this many seconds
+    int defer = options.deferred ? 1 : 0;
 
-    int serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (options.rcvbuf > 0
+        && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options.rcvbuf, sizeof(options.rcvbuf)) == -1)
+        LOG_WARN("Failed to set rcvbuf on port " << port);
+    if (options.sndbuf > 0
+        && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options.sndbuf, sizeof(options.sndbuf)) == -1)
+        LOG_WARN("Failed to set sndbuf on port " << port);
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) == -1)
+        LOG_WARN("Failed to set nodelay on port " << port);
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &options.notsentLowat, sizeof(options.notsentLowat)) == -1)
+        LOG_WARN("Failed to set notsent_lowat on port " << port);
+    if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer, sizeof(defer)) == -1)
+        LOG_WARN("Failed to set deferred on port " << port);
+    if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &options.fastopen, sizeof(options.fastopen)) == -1
+        && options.fastopen > 0)
+        LOG_WARN("Failed to set fastopen on port " << port);
+}
+
+int Server::setup_Socket_with_host(int port, const std::string& host, const ListenOptions& options)
+{
+    LOG_INFO("=== SETTING UP SERVER ON " << host << ":" << port << " ===");
+
+    int serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (serverSocket == -1)
     {
-        std::cout << "Failed to create socket for " << host << ":" << port << std::endl;
+        LOG_ERROR("Failed to create socket for " << host << ":" << port);
         return (-1);
     }
-    std::cout << "Socket created for " << host << ":" << port << std::endl;
+    LOG_INFO("Socket created for " << host << ":" << port);
     int opt = 1;
     if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
     {
-        std::cout << "Warning: Failed to set SO_REUSEADDR" << std::endl;
+        LOG_WARN("Failed to set SO_REUSEADDR");
+    }
+    // Every worker binds its own listener; the kernel spreads incoming
+    // connections across them
+    if (global.workerProcesses != 1
+        && setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+    {
+        LOG_ERROR("Failed to set SO_REUSEPORT for " << host << ":" << port);
+        close(serverSocket);
+        return (-1);
+    }
+    // A worker pinned to one CPU asks for the connections whose packets
+    // that CPU receives
+    int cpu = affinity.single_cpu();
+    if (global.workerProcesses != 1 && cpu != -1
+        && setsockopt(serverSocket, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == -1)
+    {
+        LOG_WARN("Failed to set SO_INCOMING_CPU for " << host << ":" << port);
     }
-    std::cout << "Socket options set" << std::endl;
+    // Before listen(): the receive buffer fixes the window scale offered
+    // in the handshake
+    tune_listener(serverSocket, options, port);
+    LOG_INFO("Socket options set");
     sockaddr_in serverAddress;
     memset(&serverAddress, 0, sizeof(serverAddress));
     serverAddress.sin_family = AF_INET;
@@ -24,7 +73,7 @@ int Server::setup_Socket_with_host(int port, const std::string& host)
     if (host == "0.0.0.0" || host.empty())
     {
         serverAddress.sin_addr.s_addr = INADDR_ANY;
-        std::cout << "Using all interfaces (0.0.0.0)" << std::endl;
+        LOG_INFO("Using all interfaces (0.0.0.0)");
     }
     else
     {
@@ -36,7 +85,7 @@ int Server::setup_Socket_with_host(int port, const std::string& host)
         int status = getaddrinfo(host.c_str(), NULL, &hints, &result);
         if (status != 0)
         {
-            std::cout << "Invalid address/hostname: " << host << std::endl;
+            LOG_INFO("Invalid address/hostname: " << host);
             close(serverSocket);
             return (-1);
         }
@@ -44,24 +93,35 @@ int Server::setup_Socket_with_host(int port, const std::string& host)
         struct sockaddr_in* addr_in = (struct sockaddr_in*)result->ai_addr;
         serverAddress.sin_addr = addr_in->sin_addr;
         freeaddrinfo(result);
-        std::cout << "Using specific address: " << host << std::endl;
+        LOG_INFO("Using specific address: " << host);
     }
 
     if (bind(serverSocket, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) == -1)
     {
-        std::cout << "Failed to bind to " << host << ":" << port << std::endl;
+        LOG_ERROR("Failed to bind to " << host << ":" << port);
         close(serverSocket);
         return (-1);
     }
-    std::cout << "Socket bound to " << host << ":" << port << std::endl;
+    LOG_INFO("Socket bound to " << host << ":" << port);
 
-    if (listen(serverSocket, SOMAXCONN) == -1)
+    if (listen(serverSocket, options.backlog < 0 ? SOMAXCONN : options.backlog) == -1)
     {
-        std::cout << "Failed to listen on " << host << ":" << port << std::endl;
+        LOG_ERROR("Failed to listen on " << host << ":" << port);
         close(serverSocket);
         return (-1);
     }
 
-    std::cout << "Server listening on " << host << ":" << port << "!" << std::endl;
+    LOG_INFO("Server listening on " << host << ":" << port << "!");
     return (serverSocket);
-}
\ No newline at end of file
+}
+
+// A listener that is already open: an inherited one, or one a reload kept.
+// listen() again takes the new backlog.
+void Server::retune_listener(int server_fd, const ServerContext& config)
+{
+    int port = atoi(config.port.c_str());
+
+    tune_listener(server_fd, config.listen, port);
+    if (listen(server_fd, config.listen.backlog < 0 ? SOMAXCONN : config.listen.backlog) == -1)
+        LOG_WARN("Failed to set backlog on port " << port);
+}
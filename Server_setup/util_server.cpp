@@ -1,142 +1,153 @@
 #include "server.hpp"
+#include "../utils/logger.hpp"
 
-Server::Server() : server_fd(-1), epoll_fd(-1)
+Server::Server() : server_fd(-1), io(NULL), inbox(NULL), handoff(NULL), reserve_fd(-1), active(NULL),
+	control_fd(-1), posted(NULL), drain_requested(false), drain_timeout(0), reap_requested(false),
+	draining(false), signal_fd(-1), reload_requested(false), upgrade_requested(false),
+	shutdown_requested(false)
 {
-	std::cout << "=== CREATING SERVER ===" << std::endl;
-	std::cout << "Server object created" << std::endl;
+	LOG_DEBUG("=== CREATING SERVER ===");
+	cgi_runner.set_timer_wheel(&timers);
+	LOG_DEBUG("Server object created");
 }
 
 Server::~Server()
 {
-	std::cout << "=== DESTROYING SERVER ===" << std::endl;
-	if (epoll_fd != -1)
-	{
-		close(epoll_fd);
-		std::cout << "Epoll closed" << std::endl;
-	}
+	LOG_DEBUG("=== DESTROYING SERVER ===");
+	delete io;
+	if (reserve_fd != -1)
+		close(reserve_fd);
+	if (control_fd != -1)
+		close(control_fd);
+	if (signal_fd != -1)
+		close(signal_fd);
+	if (posted)
+		posted->release();
+	if (active)
+		active->release();
 	for (size_t i = 0; i < server_fds.size(); i++)
 	{
 		if (server_fds[i] != -1)
 		{
 			close(server_fds[i]);
-			std::cout << "Server socket " << server_fds[i] << " closed" << std::endl;
+			LOG_DEBUG("Server socket " << server_fds[i] << " closed");
 		}
 	}
-	if (!active_clients.empty())
+	if (fds.clients() > 0)
 	{
-		std::cout << "Cleaning up " << active_clients.size() << " remaining clients" << std::endl;
-		active_clients.clear(); 
+		LOG_DEBUG("Cleaning up " << fds.clients() << " remaining clients");
 	}
-	client_to_server.clear();
-	fd_to_port.clear();
-	fd_to_config.clear();
-	std::cout << "Server object destroyed" << std::endl;
+	LOG_DEBUG("Server object destroyed");
 }
 
-bool Server::is_server_socket(int fd)
+// `loop` numbers this event loop for worker_cpu_affinity
+void Server::init_data(ConfigSnapshot *config, size_t loop)
 {
-	for (size_t i = 0; i < server_fds.size(); i++)
+	std::vector<ServerContext> &configs = config->getServers();
+
+	affinity.pin(config->getGlobal(), loop);
+	config->retain();
+	active = config;
+	init_event_loop(config->getGlobal());
+	add_signal_channel(global.workerProcesses == 1);
+	for (size_t i = 0; i < configs.size(); i++)
 	{
-		if (server_fds[i] == fd)
-		{
-			return (true);
-		}
+		LOG_DEBUG("=== SERVER " << (i + 1) << " SETUP ===");
+		add_listener(configs[i]);
 	}
-	return (false);
+	BinaryUpgrade::finish_startup();
 }
 
-bool Server::is_client_socket(int fd)
+// Acceptor thread of the threaded mode: watches one listener and hands every
+// accepted connection to one of the event-loop threads in `group`. Reloads
+// are posted to it by the thread that owns the acceptors.
+void Server::init_acceptor(ServerContext &config, HandoffGroup *group)
 {
-	return (active_clients.find(fd) != active_clients.end());
+	config.snapshot->retain();
+	active = config.snapshot;
+	init_event_loop(config.snapshot->getGlobal());
+	handoff = group;
+	add_listener(config);
+	add_control_channel();
 }
 
-bool Server::is_cgi_socket(int fd)
+// Threaded mode: lets the thread that owns the loops post reloads and
+// drain requests to this one
+void Server::add_control_channel()
 {
-	return cgi_runner.is_cgi_fd(fd);
+	control_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (control_fd == -1 || !io->add(control_fd, global.edgeTriggered ? EPOLLIN | EPOLLET : EPOLLIN))
+		throw std::runtime_error("Failed to set up the event loop's control eventfd");
+	fds.add_control(control_fd);
 }
-ServerContext *Server::get_server_config(int server_fd)
+
+// Event-loop thread of the threaded mode: serves the connections that
+// acceptors push to `queue`. Its thread gets started on the CPUs of `loop`.
+void Server::init_worker(HandoffQueue *queue, const GlobalContext &global_config, size_t loop)
 {
-	std::map<int, ServerContext *>::iterator it = fd_to_config.find(server_fd);
-	if (it != fd_to_config.end())
-	{
-		return (it->second);
-	}
-	return (NULL);
+	cpu_set_t cpus;
+
+	if (CpuAffinity::cpus_for(global_config, loop, cpus))
+		affinity.assign(cpus, loop);
+	init_event_loop(global_config);
+	inbox = queue;
+	if (!io->add(inbox->get_event_fd(), global.edgeTriggered ? EPOLLIN | EPOLLET : EPOLLIN))
+		throw std::runtime_error("Failed to add handoff eventfd to the I/O engine");
+	fds.add_wakeup(inbox->get_event_fd());
+	add_control_channel();
 }
 
-ServerContext *Server::get_client_config(int client_fd)
+int Server::loop_cpu() const
 {
-	int	server_fd;
+	return affinity.single_cpu();
+}
 
-	std::map<int, int>::iterator server_it = client_to_server.find(client_fd);
-	if (server_it != client_to_server.end())
+void Server::init_event_loop(const GlobalContext &global_config)
+{
+	global = global_config;
+	LOG_DEBUG("Event mode: " << (global.edgeTriggered ? "edge" : "level")
+			  << "-triggered, budget " << global.eventBudget << " operations per fd");
+
+	io = IoEngine::create(global.ioUring);
+	if (!io)
 	{
-		server_fd = server_it->second;
-		return (get_server_config(server_fd));
+		throw std::runtime_error("Failed to create an I/O engine");
 	}
-	return (NULL);
+	LOG_DEBUG("I/O engine: " << io->name());
+	reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
 }
-void Server::init_data(const std::vector<ServerContext> &configs)
+
+int Server::add_listener(const ServerContext &config)
 {
 	int					port;
 	int					server_fd;
-	struct epoll_event	event;
 
-	epoll_fd = setup_epoll();
-	if (epoll_fd == -1)
+	port = atoi(config.port.c_str());
+	LOG_DEBUG("Config host: '" << config.host << "'");
+	LOG_DEBUG("Config port: '" << config.port << "'");
+	// After a binary upgrade the socket is already open and listening
+	server_fd = BinaryUpgrade::take_inherited(config.host, config.port);
+	if (server_fd != -1)
 	{
-		throw std::runtime_error("Failed to create epoll instance");
+		LOG_INFO("Adopted inherited listener " << server_fd << " for " << config.host << ":" << port);
+		retune_listener(server_fd, config);
 	}
-	for (size_t i = 0; i < configs.size(); i++)
+	else
+		server_fd = setup_Socket_with_host(port, config.host, config.listen);
+	if (server_fd == -1)
 	{
-		const ServerContext &config = configs[i];
-		port = atoi(config.port.c_str());
-		std::cout << "=== SERVER " << (i + 1) << " SETUP ===" << std::endl;
-		std::cout << "Config host: '" << config.host << "'" << std::endl;
-		std::cout << "Config port: '" << config.port << "'" << std::endl;
-		server_fd = setup_Socket_with_host(port, config.host);
-		if (server_fd == -1)
-		{
-			throw std::runtime_error("Failed to setup socket for port "
-				+ config.port);
-		}
-		event.events = EPOLLIN;
-		event.data.fd = server_fd;
-		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &event) == -1)
-		{
-			close(server_fd);
-			throw std::runtime_error("Failed to add server socket to epoll");
-		}
-		std::cout << "Server socket " << server_fd << " added to epoll for port " << port << std::endl;
-		// store in mapping tables
-		server_fds.push_back(server_fd);
-		fd_to_port[server_fd] = port;
-		fd_to_config[server_fd] = const_cast<ServerContext *>(&configs[i]);
-		std::cout << "Server socket created on port " << port << " (fd: " << server_fd << ")" << std::endl;
+		throw std::runtime_error("Failed to setup socket for port "
+			+ config.port);
 	}
+	if (!io->add(server_fd, global.edgeTriggered ? EPOLLIN | EPOLLET : EPOLLIN))
+	{
+		close(server_fd);
+		throw std::runtime_error("Failed to add server socket to the I/O engine");
+	}
+	LOG_DEBUG("Server socket " << server_fd << " added to " << io->name() << " for port " << port);
+	// store in mapping tables
+	server_fds.push_back(server_fd);
+	fds.add_listener(server_fd, const_cast<ServerContext *>(&config), port);
+	LOG_DEBUG("Server socket created on port " << port << " (fd: " << server_fd << ")");
+	return server_fd;
 }
-void Server::check_client_timeouts(std::map<int, Client> &active_clients)
-{
-    const int TIMEOUT_SECONDS = 30;
-    std::vector<int> clients_to_remove;
-    
-    for (std::map<int, Client>::iterator it = active_clients.begin(); 
-         it != active_clients.end(); ++it)
-    {
-        if (it->second.is_timed_out(TIMEOUT_SECONDS))
-        {
-            std::cout << "Client " << it->first << " timed out after " << TIMEOUT_SECONDS << " seconds" << std::endl;
-            ServerContext* server_config = get_client_config(it->first);
-            it->second.send_timeout_response(server_config);
-            
-            clients_to_remove.push_back(it->first);
-        }
-    }
-    
-    for (std::vector<int>::iterator it = clients_to_remove.begin(); 
-         it != clients_to_remove.end(); ++it)
-    {
-        int client_fd = *it;
-        active_clients[client_fd].cleanup_connection(epoll_fd, active_clients);
-    }
-}
\ No newline at end of file
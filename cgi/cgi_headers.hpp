@@ -5,6 +5,7 @@
 #include <map>
 #include <vector>
 #include <ctime>
+#include "../utils/timer_wheel.hpp"
 
 struct CgiProcess
 {
@@ -13,12 +14,19 @@ struct CgiProcess
     int output_fd;     
     int client_fd;             
     std::string script_path;  
-    bool finished;             
+    bool finished;           // output read to EOF
+    bool reaped;             // exit status collected
+    int exit_status;
     std::string output_buffer;
     time_t start_time;       // When the CGI process started
     time_t last_activity;    // Last time we received data from this process
+    bool keep_alive;         // Whether the client connection survives this response
+    bool chunked;            // HTTP/1.1 client: a streamed body can be chunked
+    bool streaming;          // headers sent, output now goes out as it is read
+    int timeout_seconds;     // Silence allowed before the script is killed
+    TimerNode timer;         // Fires after timeout_seconds without output
 
-    CgiProcess() : pid(-1), input_fd(-1), output_fd(-1), client_fd(-1), finished(false) {
+    CgiProcess() : pid(-1), input_fd(-1), output_fd(-1), client_fd(-1), finished(false), reaped(false), exit_status(0), keep_alive(false), chunked(false), streaming(false), timeout_seconds(30) {
         start_time = time(NULL);
         last_activity = start_time;
     }
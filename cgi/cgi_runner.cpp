@@ -1,4 +1,7 @@
 #include "cgi_runner.hpp"
+#include "../utils/logger.hpp"
+#include "../Server_setup/load_limits.hpp"
+#include "../utils/scan.hpp"
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -14,26 +17,36 @@
 #include <sstream>
 #include <vector>
 
-CgiRunner::CgiRunner()
+CgiRunner::CgiRunner() : timers(NULL)
 {
 }
 
+void CgiRunner::set_timer_wheel(TimerWheel *wheel)
+{
+    timers = wheel;
+}
+
+// Scripts still running when the loop goes away are killed, not waited
+// for: a blocking waitpid here would hold up the shutdown
 CgiRunner::~CgiRunner()
 {
 
     for (std::map<int, CgiProcess>::iterator it = active_cgi_processes.begin();
          it != active_cgi_processes.end(); ++it)
     {
-        if (it->second.pid > 0)
+        if (it->second.pid > 0 && !it->second.reaped)
         {
-            kill(it->second.pid, SIGTERM);
-            waitpid(it->second.pid, NULL, 0);
+            kill(it->second.pid, SIGKILL);
+            waitpid(it->second.pid, NULL, WNOHANG);
         }
         if (it->second.input_fd >= 0)
             close(it->second.input_fd);
         if (it->second.output_fd >= 0)
             close(it->second.output_fd);
+        LoadLimits::release_cgi();
     }
+    for (size_t i = 0; i < unreaped.size(); ++i)
+        waitpid(unreaped[i], NULL, WNOHANG);
 }
 
 static std::vector<char *> vector_to_char_array(const std::vector<std::string> &vec)
@@ -47,6 +60,32 @@ static std::vector<char *> vector_to_char_array(const std::vector<std::string> &
     return result;
 }
 
+// Split CGI output into headers and body
+static void split_cgi_output(const std::string &cgi_output, std::string &headers, std::string &body)
+{
+    size_t header_end = Scan::find(cgi_output, "\r\n\r\n", 4);
+    if (header_end == std::string::npos)
+    {
+        header_end = Scan::find(cgi_output, "\n\n", 2);
+        if (header_end != std::string::npos)
+        {
+            headers = cgi_output.substr(0, header_end);
+            body = cgi_output.substr(header_end + 2);
+        }
+        else
+        {
+            // No headers found, treat entire output as body
+            headers = "";
+            body = cgi_output;
+        }
+    }
+    else
+    {
+        headers = cgi_output.substr(0, header_end);
+        body = cgi_output.substr(header_end + 4);
+    }
+}
+
 // Helper function to create error response for failed CGI execution
 static std::string create_error_response(int error_code, const std::string &message)
 {
@@ -172,12 +211,13 @@ std::vector<std::string> CgiRunner::build_cgi_env(const Request &request,
 //   -1 : generic internal error (pipe/fork failure, exec failure)
 //   -2 : script not found (404)
 //   -3 : script not readable (403)
+//   -4 : max_cgi_processes scripts already running (503)
 
-int CgiRunner::start_cgi_process(const Request &request, const LocationContext &location, int client_fd, const std::string &script_path)
+int CgiRunner::start_cgi_process(const Request &request, const LocationContext &location, int client_fd, const std::string &script_path, bool keep_alive, int timeout_seconds)
 {
 
     // message with green color
-    std::cout << "\033[32mStarting CGI process for script: " << script_path << "\033[0m" << std::endl;
+    LOG_DEBUG("Starting CGI process for script: " << script_path);
     // Find the appropriate interpreter for this script
     std::string interpreter_path;
     std::string file_ext;
@@ -215,10 +255,53 @@ int CgiRunner::start_cgi_process(const Request &request, const LocationContext &
         return -3; // FORBIDDEN
     }
 
-    // Create pipes for communication
+    // Everything that allocates is prepared before fork(): with event-loop
+    // threads another thread may hold the malloc lock at the time of the
+    // fork, and the child would deadlock on it
+    std::string script_dir;
+    std::string script_filename = script_path;
+    size_t last_slash = script_path.find_last_of('/');
+    if (last_slash != std::string::npos)
+    {
+        script_dir = script_path.substr(0, last_slash);
+        script_filename = script_path.substr(last_slash + 1);
+    }
+
+    // Build environment
+    std::vector<std::string> env_vars = build_cgi_env(request, "localhost", "8080", script_path);
+    std::vector<char *> envp = vector_to_char_array(env_vars);
+
+    // Build arguments
+    std::vector<std::string> args;
+    args.push_back(interpreter_path); // interpreter path
+    args.push_back(script_filename);  // script filename (relative to working directory)
+    std::vector<char *> argv = vector_to_char_array(args);
+
+    // The loop blocks the signals it reads from its signalfd, and the mask
+    // survives exec(): the script must be killable by SIGTERM
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+
+    // Released in cleanup_cgi_process()
+    if (!LoadLimits::acquire_cgi())
+    {
+        return -4;
+    }
+
+    // Create pipes for communication. O_CLOEXEC keeps them out of CGI
+    // children started concurrently by other threads, which would otherwise
+    // hold the write end open and delay EOF.
     int input_pipe[2], output_pipe[2];
-    if (pipe(input_pipe) == -1 || pipe(output_pipe) == -1)
+    if (pipe2(input_pipe, O_CLOEXEC) == -1)
+    {
+        LoadLimits::release_cgi();
+        return -1;
+    }
+    if (pipe2(output_pipe, O_CLOEXEC) == -1)
     {
+        close(input_pipe[0]);
+        close(input_pipe[1]);
+        LoadLimits::release_cgi();
         return -1;
     }
 
@@ -229,30 +312,24 @@ int CgiRunner::start_cgi_process(const Request &request, const LocationContext &
         close(input_pipe[1]);
         close(output_pipe[0]);
         close(output_pipe[1]);
+        LoadLimits::release_cgi();
         return -1;
     }
 
     if (pid == 0)
     {
         // Child process - execute CGI script
+        sigprocmask(SIG_SETMASK, &no_signals, NULL);
         close(input_pipe[1]);  // Close write end of input pipe (we read from it) we read from input_pipe[0]
         close(output_pipe[0]); // Close read end of output pipe (we write to it) we write to output_pipe[1]
 
         // Change to the directory containing the CGI script
-        std::string script_dir = script_path;
-        std::string script_filename = script_path;
-        size_t last_slash = script_dir.find_last_of('/');
-        if (last_slash != std::string::npos)
+        if (!script_dir.empty() && chdir(script_dir.c_str()) != 0)
         {
-            script_dir = script_dir.substr(0, last_slash);
-            script_filename = script_path.substr(last_slash + 1);
-            if (chdir(script_dir.c_str()) != 0)
-            {
-                _exit(1);
-            }
+            _exit(1);
         }
 
-        // Redirect stdin and stdout
+        // Redirect stdin and stdout (dup2 clears O_CLOEXEC on the copies)
         if (dup2(input_pipe[0], STDIN_FILENO) == -1 ||
             dup2(output_pipe[1], STDOUT_FILENO) == -1)
         {
@@ -263,16 +340,6 @@ int CgiRunner::start_cgi_process(const Request &request, const LocationContext &
         close(input_pipe[0]);
         close(output_pipe[1]);
 
-        // Build environment
-        std::vector<std::string> env_vars = build_cgi_env(request, "localhost", "8080", script_path);
-        std::vector<char *> envp = vector_to_char_array(env_vars);
-
-        // Build arguments
-        std::vector<std::string> args;
-        args.push_back(interpreter_path); // interpreter path
-        args.push_back(script_filename);  // script filename (relative to working directory)
-        std::vector<char *> argv = vector_to_char_array(args);
-
         // Execute the CGI script
         // execve will write in stdout which is  now redirected to output_pipe[1]
         execve(argv[0], &argv[0], &envp[0]);
@@ -295,8 +362,15 @@ int CgiRunner::start_cgi_process(const Request &request, const LocationContext &
     cgi_proc.client_fd = client_fd;
     cgi_proc.script_path = script_path;
     cgi_proc.finished = false;
-
-    active_cgi_processes[output_pipe[0]] = cgi_proc;
+    cgi_proc.keep_alive = keep_alive;
+    cgi_proc.chunked = request.get_http_version() == "HTTP/1.1";
+    cgi_proc.timeout_seconds = timeout_seconds;
+
+    CgiProcess &stored = active_cgi_processes[output_pipe[0]];
+    stored = cgi_proc;
+    stored.timer.fd = output_pipe[0];
+    if (timers)
+        timers->arm(&stored.timer, static_cast<uint64_t>(timeout_seconds) * 1000);
     
     debug_cgi_timing(output_pipe[0], "START");
 
@@ -323,8 +397,9 @@ int CgiRunner::start_cgi_process(const Request &request, const LocationContext &
     return output_pipe[0]; // Return output fd for epoll monitoring
 }
 
-bool CgiRunner::handle_cgi_output(int fd, std::string &response_data)
+bool CgiRunner::handle_cgi_output(int fd, std::string &response_data, int max_reads, bool &more)
 {
+    more = false;
 
     std::map<int, CgiProcess>::iterator it = active_cgi_processes.find(fd);
 
@@ -333,74 +408,167 @@ bool CgiRunner::handle_cgi_output(int fd, std::string &response_data)
         return false;
     }
 
-    // Check if process is already finished to prevent infinite loop
+    // Output complete: answer once the exit status is in
     if (it->second.finished)
     {
-        response_data = format_cgi_response(it->second.output_buffer);
+        if (!it->second.reaped && !reap(it->second))
+            return false;
+        build_response(it->second, response_data);
         return true;
     }
 
-    char buffer[4096];
-    ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+    // Drain the pipe: with edge-triggered epoll no new event comes for data
+    // that is already buffered. After max_reads the caller has to come back.
+    char buffer[65536];
+    ssize_t bytes_read = -1;
+    int reads = 0;
+    while (reads < max_reads)
+    {
+        bytes_read = read(fd, buffer, sizeof(buffer));
+        reads++;
+        if (bytes_read <= 0)
+            break;
+        debug_cgi_timing(fd, "DATA_RECEIVED", bytes_read);
+
+        if (it->second.streaming)
+            append_body(it->second, buffer, bytes_read, response_data);
+        else
+            it->second.output_buffer.append(buffer, bytes_read);
+    }
+    // Any output pushes the script's deadline back
+    if (reads > 1 || bytes_read > 0)
+        update_cgi_activity(fd);
+    if (bytes_read != 0 && !it->second.streaming && it->second.output_buffer.size() > STREAM_THRESHOLD)
+        start_streaming(it->second, response_data);
 
     if (bytes_read > 0)
     {
-        // Update activity timestamp when new data arrives
-        it->second.last_activity = time(NULL);
-        debug_cgi_timing(fd, "DATA_RECEIVED", bytes_read);
-        
-        it->second.output_buffer.append(buffer, bytes_read);
+        more = true;
         return false; // Continue reading, don't send response yet
     }
     else if (bytes_read == 0)
     {
-        // EOF - CGI process finished
+        // EOF - CGI process finished. It usually exits right after closing
+        // its output; if not yet, SIGCHLD brings us back via reap_children()
         it->second.finished = true;
+        if (!it->second.reaped && !reap(it->second))
+            return false;
+        build_response(it->second, response_data);
+        return true; // Response is ready
+    }
+    else
+    {
+        // Error occurred (bytes_read < 0)
+        return false; // Try again later - could be EAGAIN/EWOULDBLOCK
+    }
+}
 
-        // Wait for the child process to avoid zombies and check exit status
-        int exit_status = 0;
-        if (it->second.pid > 0)
-        {
-            int status;
-            pid_t result = waitpid(it->second.pid, &status, WNOHANG);
-            if (result == 0)
-            {
-                // Process still running, wait for it 
-                waitpid(it->second.pid, &status, 0); // Wait without WNOHANG
-            }
+// Collect the exit status if the script has exited. Never blocks.
+bool CgiRunner::reap(CgiProcess &process)
+{
+    int status;
 
-            // Extract exit code
-            if (WIFEXITED(status))
-            {
-                exit_status = WEXITSTATUS(status);
-            }
-        }
+    if (process.pid <= 0)
+    {
+        process.reaped = true;
+        return true;
+    }
+    if (waitpid(process.pid, &status, WNOHANG) != process.pid)
+        return false;
+    process.reaped = true;
+    process.exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+    return true;
+}
 
-        // Check if CGI execution failed based on exit status
-        if (exit_status != 0)
-        {
-            // Any non-zero exit code indicates CGI failure - return HTTP 500
-            std::cout << "\033[31mCGI script failed with exit code " << exit_status
-                      << " for: " << it->second.script_path << "\033[0m" << std::endl;
-            response_data = create_error_response(500, "Error 500 internal errors in the server");
-            return true;
-        }
-        else
+void CgiRunner::build_response(CgiProcess &process, std::string &response_data)
+{
+    // The status line is long gone: a failure can only cut the body short,
+    // which the client notices by the missing terminator or the close
+    if (process.streaming)
+    {
+        if (process.exit_status != 0)
         {
-            // Exit code 0 - success
-            std::cout << "\033[32mCGI script completed successfully for: "
-                      << it->second.script_path << "\033[0m" << std::endl;
+            LOG_ERROR("CGI script failed with exit code " << process.exit_status
+                      << " after its response started, for: " << process.script_path);
+            process.keep_alive = false;
         }
+        else if (process.chunked)
+            response_data += "0\r\n\r\n";
+        return;
+    }
+    // Check if CGI execution failed based on exit status
+    if (process.exit_status != 0)
+    {
+        // Any non-zero exit code indicates CGI failure - return HTTP 500
+        LOG_ERROR("CGI script failed with exit code " << process.exit_status
+                  << " for: " << process.script_path);
+        process.keep_alive = false;
+        response_data = create_error_response(500, "Error 500 internal errors in the server");
+        return;
+    }
+    LOG_DEBUG("CGI script completed successfully for: " << process.script_path);
 
-        // Format CGI output as HTTP response
-        response_data = format_cgi_response(it->second.output_buffer);
-        return true; // Response is ready
+    // Format CGI output as HTTP response
+    response_data = format_cgi_response(process.output_buffer, process.keep_alive);
+}
+
+// The output outgrew STREAM_THRESHOLD: send the headers and what is
+// buffered of the body, and pass the rest through as it is read. The body
+// is chunked for HTTP/1.1 clients and delimited by the close otherwise.
+void CgiRunner::start_streaming(CgiProcess &process, std::string &response_data)
+{
+    std::string headers;
+    std::string body;
+
+    split_cgi_output(process.output_buffer, headers, body);
+    process.streaming = true;
+    if (!process.chunked)
+        process.keep_alive = false;
+    LOG_DEBUG("CGI output of " << process.script_path << " exceeds "
+              << STREAM_THRESHOLD << " bytes, streaming it");
+    response_data = format_cgi_head(headers, process.keep_alive, process.chunked, -1);
+    std::string().swap(process.output_buffer);
+    append_body(process, body.data(), body.size(), response_data);
+}
+
+void CgiRunner::append_body(const CgiProcess &process, const char *data, size_t length, std::string &response_data)
+{
+    if (length == 0)
+        return;
+    if (process.chunked)
+    {
+        std::ostringstream size_line;
+        size_line << std::hex << length << "\r\n";
+        response_data += size_line.str();
     }
-    else
+    response_data.append(data, length);
+    if (process.chunked)
+        response_data += "\r\n";
+}
+
+bool CgiRunner::awaiting_exit(int fd) const
+{
+    std::map<int, CgiProcess>::const_iterator it = active_cgi_processes.find(fd);
+    return it != active_cgi_processes.end() && it->second.finished && !it->second.reaped;
+}
+
+// One SIGCHLD may stand for several exits, and in threaded mode for scripts
+// of other loops: only this runner's children are waited for, by pid
+void CgiRunner::reap_children(std::vector<int> &ready)
+{
+    for (std::map<int, CgiProcess>::iterator it = active_cgi_processes.begin();
+         it != active_cgi_processes.end(); ++it)
     {
-        // Error occurred (bytes_read < 0)
-        return false; // Try again later - could be EAGAIN/EWOULDBLOCK
+        if (!it->second.reaped && reap(it->second) && it->second.finished)
+            ready.push_back(it->first);
     }
+    size_t kept = 0;
+    for (size_t i = 0; i < unreaped.size(); ++i)
+    {
+        if (waitpid(unreaped[i], NULL, WNOHANG) != unreaped[i])
+            unreaped[kept++] = unreaped[i];
+    }
+    unreaped.resize(kept);
 }
 
 bool CgiRunner::handle_cgi_input(int fd, const std::string &data)
@@ -435,16 +603,24 @@ int CgiRunner::get_client_fd(int fd) const
     return -1;
 }
 
+bool CgiRunner::keeps_alive(int fd) const
+{
+    std::map<int, CgiProcess>::const_iterator it = active_cgi_processes.find(fd);
+    if (it != active_cgi_processes.end())
+    {
+        return it->second.keep_alive;
+    }
+    return false;
+}
+
 void CgiRunner::cleanup_cgi_process(int fd)
 {
     std::map<int, CgiProcess>::iterator it = active_cgi_processes.find(fd);
     if (it != active_cgi_processes.end())
     {
-        if (it->second.pid > 0)
-        {
-            int status;
-            waitpid(it->second.pid, &status, WNOHANG);
-        }
+        // A script that has not exited yet is collected on a later SIGCHLD
+        if (!it->second.reaped && !reap(it->second))
+            unreaped.push_back(it->second.pid);
 
         if (it->second.input_fd >= 0)
         {
@@ -455,7 +631,10 @@ void CgiRunner::cleanup_cgi_process(int fd)
             close(it->second.output_fd);
         }
 
+        if (timers)
+            timers->cancel(&it->second.timer);
         active_cgi_processes.erase(it);
+        LoadLimits::release_cgi();
     }
 }
 
@@ -478,32 +657,15 @@ void CgiRunner::check_finished_processes()
     }
 }
 
-std::string CgiRunner::format_cgi_response(const std::string &cgi_output)
+std::string CgiRunner::format_cgi_response(const std::string &cgi_output, bool keep_alive)
 {
-    // Split CGI output into headers and body
     std::string headers, body;
-    size_t header_end = cgi_output.find("\r\n\r\n");
-    if (header_end == std::string::npos)
-    {
-        header_end = cgi_output.find("\n\n");
-        if (header_end != std::string::npos)
-        {
-            headers = cgi_output.substr(0, header_end);
-            body = cgi_output.substr(header_end + 2);
-        }
-        else
-        {
-            // No headers found, treat entire output as body
-            headers = "";
-            body = cgi_output;
-        }
-    }
-    else
-    {
-        headers = cgi_output.substr(0, header_end);
-        body = cgi_output.substr(header_end + 4);
-    }
+    split_cgi_output(cgi_output, headers, body);
+    return format_cgi_head(headers, keep_alive, false, static_cast<long>(body.size())) + body;
+}
 
+std::string CgiRunner::format_cgi_head(const std::string &headers, bool keep_alive, bool chunked, long body_length)
+{
     // Parse ALL CGI headers and collect them
     std::string content_type = "text/html; charset=utf-8"; // Default content type
     std::vector<std::string> all_headers;
@@ -604,19 +766,26 @@ std::string CgiRunner::format_cgi_response(const std::string &cgi_output)
         response << all_headers[i] << "\r\n";
     }
 
-    // Add Content-Length and Connection headers
-    response << "Content-Length: " << body.size() << "\r\n";
-    response << "Connection: close\r\n";
+    // Add Content-Length (or the streamed framing) and Connection headers
+    if (body_length >= 0)
+        response << "Content-Length: " << body_length << "\r\n";
+    else if (chunked)
+        response << "Transfer-Encoding: chunked\r\n";
+    if (keep_alive)
+        response << "Connection: keep-alive\r\n";
+    else
+        response << "Connection: close\r\n";
     response << "\r\n";
-    response << body;
 
     return response.str();
 }
 
+// Called when the process's timer fires: the script has been silent for
+// timeout_seconds. Kills it and builds the error response for the client.
 bool CgiRunner::check_cgi_timeout(int fd, std::string& response_data)
 {
     std::map<int, CgiProcess>::iterator it = active_cgi_processes.find(fd);
-    if (it == active_cgi_processes.end())
+    if (it == active_cgi_processes.end() || (it->second.finished && it->second.reaped) || it->second.timer.armed())
     {
         return false;
     }
@@ -627,38 +796,36 @@ bool CgiRunner::check_cgi_timeout(int fd, std::string& response_data)
     
     debug_cgi_timing(fd, "TIMEOUT_CHECK");
     
-    // Timeout after 30 seconds of no activity
-    if (elapsed >= 30)
-    {
-        std::cout << "\033[31mCGI process timed out after " << elapsed 
-                  << " seconds of inactivity (total: " << total_elapsed << "s) for: " << it->second.script_path << "\033[0m" << std::endl;
-        
-        // Kill the CGI process
-        if (it->second.pid > 0)
-        {
-            kill(it->second.pid, SIGTERM);
-            // Give it a moment to terminate gracefully
-            usleep(100000); // 100ms
-            // Force kill if still alive
-            kill(it->second.pid, SIGKILL);
-        }
-        
-        // Create timeout error response
-        std::ostringstream error_response;
-        error_response << "HTTP/1.1 500 Internal Server Error\r\n";
-        error_response << "Content-Type: text/html; charset=utf-8\r\n";
-        error_response << "Connection: close\r\n";
-        
-        std::string body = "<html><body><h1>CGI Timeout</h1><p>The CGI script exceeded the maximum execution time of 30 seconds.</p></body></html>";
-        error_response << "Content-Length: " << body.size() << "\r\n";
-        error_response << "\r\n";
-        error_response << body;
-        
-        response_data = error_response.str();
-        return true; // Timeout occurred
+    it->second.keep_alive = false;
+    LOG_WARN("CGI process timed out after " << elapsed 
+              << " seconds of inactivity (total: " << total_elapsed << "s) for: " << it->second.script_path);
+    
+    // Kill the CGI process; SIGCHLD collects it later, no need to wait here
+    if (it->second.pid > 0 && !it->second.reaped)
+        kill(it->second.pid, SIGKILL);
+
+    // Part of the response is out already: all that is left is to close
+    if (it->second.streaming)
+    {
+        response_data.clear();
+        return true;
     }
     
-    return false; // No timeout
+    // Create timeout error response
+    std::ostringstream error_response;
+    error_response << "HTTP/1.1 500 Internal Server Error\r\n";
+    error_response << "Content-Type: text/html; charset=utf-8\r\n";
+    error_response << "Connection: close\r\n";
+    
+    std::ostringstream body;
+    body << "<html><body><h1>CGI Timeout</h1><p>The CGI script produced no output for "
+         << it->second.timeout_seconds << " seconds.</p></body></html>";
+    error_response << "Content-Length: " << body.str().size() << "\r\n";
+    error_response << "\r\n";
+    error_response << body.str();
+    
+    response_data = error_response.str();
+    return true; // Timeout occurred
 }
 
 void CgiRunner::update_cgi_activity(int fd)
@@ -667,33 +834,22 @@ void CgiRunner::update_cgi_activity(int fd)
     if (it != active_cgi_processes.end())
     {
         it->second.last_activity = time(NULL);
+        if (timers && !it->second.finished)
+            timers->arm(&it->second.timer, static_cast<uint64_t>(it->second.timeout_seconds) * 1000);
         debug_cgi_timing(fd, "ACTIVITY_RESET");
     }
 }
 
-std::vector<int> CgiRunner::get_timed_out_cgi_fds() const
+void CgiRunner::pause_cgi(int fd)
 {
-    std::vector<int> timed_out_fds;
-    time_t current_time = time(NULL);
-    
-    for (std::map<int, CgiProcess>::const_iterator it = active_cgi_processes.begin();
-         it != active_cgi_processes.end(); ++it)
-    {
-        if (!it->second.finished)
-        {
-            time_t elapsed = current_time - it->second.last_activity;
-            if (elapsed >= 30)
-            {
-                timed_out_fds.push_back(it->first);
-            }
-        }
-    }
-    
-    return timed_out_fds;
+    std::map<int, CgiProcess>::iterator it = active_cgi_processes.find(fd);
+    if (it != active_cgi_processes.end() && timers)
+        timers->cancel(&it->second.timer);
 }
 
 void CgiRunner::debug_cgi_timing(int fd, const std::string& event, time_t bytes) const
 {
+#ifdef DEBUG
     std::map<int, CgiProcess>::const_iterator it = active_cgi_processes.find(fd);
     if (it == active_cgi_processes.end())
         return;
@@ -702,31 +858,22 @@ void CgiRunner::debug_cgi_timing(int fd, const std::string& event, time_t bytes)
     time_t total_elapsed = current_time - it->second.start_time;
     time_t gap = current_time - it->second.last_activity;
     
-    // Color codes for different events
-    std::string color;
-    if (event == "START") color = "\033[35m";        // Magenta
-    else if (event == "DATA_RECEIVED") color = "\033[32m";  // Green
-    else if (event == "ACTIVITY_RESET") color = "\033[33m"; // Yellow
-    else if (event == "TIMEOUT_CHECK") color = "\033[36m";  // Cyan
-    else color = "\033[37m";                          // White
-    
-    std::cout << color << "[" << event << "] CGI fd=" << fd;
-    
+    std::ostringstream line;
+    line << "[" << event << "] CGI fd=" << fd;
     if (bytes >= 0)
-        std::cout << ", bytes=" << bytes;
-    
+        line << ", bytes=" << bytes;
     if (event != "START")
-    {
-        std::cout << ", gap=" << gap << "s"
-                  << ", total_time=" << total_elapsed << "s"
-                  << " (start+" << total_elapsed << "s)";
-    }
+        line << ", gap=" << gap << "s, total_time=" << total_elapsed << "s";
     else
     {
-        std::cout << ", time=0s (start)";
+        line << ", time=0s (start)";
         if (!it->second.script_path.empty())
-            std::cout << ", script=" << it->second.script_path;
-    }
-    
-    std::cout << "\033[0m" << std::endl;
+            line << ", script=" << it->second.script_path;
+    }
+    LOG_DEBUG(line.str());
+#else
+    (void)fd;
+    (void)event;
+    (void)bytes;
+#endif
 }
@@ -7,8 +7,14 @@
 #include <map>
 
 class CgiRunner {
+public:
+    // Output buffered before the response starts going out as it is read
+    static const size_t STREAM_THRESHOLD = 256 * 1024;
+
 private:
     std::map<int, CgiProcess> active_cgi_processes; // fd -> CgiProcess
+    std::vector<pid_t> unreaped;    // scripts cleaned up before they exited
+    TimerWheel *timers;
     
     std::vector<std::string> build_cgi_env(const Request& request, 
                                           const std::string& server_name,
@@ -18,15 +24,22 @@ private:
 public:
     CgiRunner();
     ~CgiRunner();
+
+    void set_timer_wheel(TimerWheel *wheel);
     
     // Start a CGI process and return the output fd for epoll monitoring
     int start_cgi_process(const Request& request, 
                          const LocationContext& location,
                          int client_fd,
-                         const std::string& script_path);
+                         const std::string& script_path,
+                         bool keep_alive,
+                         int timeout_seconds);
     
-    // Handle I/O on CGI file descriptors
-    bool handle_cgi_output(int fd, std::string& response_data);
+    // Handle I/O on CGI file descriptors. Reads at most max_reads times;
+    // `more` is set when the pipe may still hold data after that. Returns
+    // true once the response is complete. Output past STREAM_THRESHOLD is
+    // not buffered: it comes back in response_data while returning false.
+    bool handle_cgi_output(int fd, std::string& response_data, int max_reads, bool& more);
     bool handle_cgi_input(int fd, const std::string& data);
     
     // Check if fd belongs to a CGI process
@@ -34,21 +47,40 @@ public:
     
     // Get client fd associated with CGI process
     int get_client_fd(int fd) const;
+
+    // Whether the client connection stays open after this CGI response
+    bool keeps_alive(int fd) const;
     
     // Clean up finished CGI process
     void cleanup_cgi_process(int fd);
     
     // Check for finished processes
     void check_finished_processes();
+
+    // Output read to EOF, exit status not collected yet
+    bool awaiting_exit(int fd) const;
+
+    // Collect the scripts that exited (on SIGCHLD) without blocking. `ready`
+    // gets the output fds whose response can now be built.
+    void reap_children(std::vector<int>& ready);
     
-    // Timeout management
+    // Timeout management: each process has a timer on the wheel, re-armed
+    // whenever the script writes something
     bool check_cgi_timeout(int fd, std::string& response_data);
     void update_cgi_activity(int fd);
-    std::vector<int> get_timed_out_cgi_fds() const;
+    // The client is not taking output: no timeout while the pipe is not read
+    void pause_cgi(int fd);
     
 private:
+    bool reap(CgiProcess& process);
+    void build_response(CgiProcess& process, std::string& response_data);
+    void start_streaming(CgiProcess& process, std::string& response_data);
+    void append_body(const CgiProcess& process, const char* data, size_t length, std::string& response_data);
+
     // Format CGI output into HTTP response
-    std::string format_cgi_response(const std::string& cgi_output);
+    std::string format_cgi_response(const std::string& cgi_output, bool keep_alive);
+    // Status line and headers; body_length < 0 for a streamed body
+    std::string format_cgi_head(const std::string& cgi_headers, bool keep_alive, bool chunked, long body_length);
     
     // Debug helper function
     void debug_cgi_timing(int fd, const std::string& event, time_t bytes = -1) const;
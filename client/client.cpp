@@ -1,263 +1,745 @@
 #include "client.hpp"
+#include "../utils/logger.hpp"
+#include "../Server_setup/load_limits.hpp"
+#include "../Server_setup/peer_limits.hpp"
 
-Client::Client() : client_fd(-1), request_status(NEED_MORE_DATA), last_activity(time(NULL))
+Client::Client() : client_fd(-1), exchange(NULL), exchanges(NULL), read_buffer(NULL), buffer_pool(NULL), requests_served(0), waiting_for_request(false), keepalive_timeout(0),
+	close_after_flush(false), awaiting_cgi(false), cgi_fd(-1), cgi_paused(false), armed_events(EPOLLIN), server_config(NULL),
+	edge_triggered(false), io_budget(1), readable(false), writable(true), peer_shutdown(false),
+	draining(false), peer(0), peer_counted(false), request_held(false),
+	resume_request(false),
+	timers(NULL), timer_phase(TIMER_NONE), timer_request(-1), send_timeout(0)
 {
-	std::cout << "Client constructor called" << std::endl;
+	LOG_DEBUG("Client constructor called");
 }
 
-void Client::update_last_activity()
+void Client::release_read_buffer()
 {
-    last_activity = time(NULL);
+	if (read_buffer && buffer_pool)
+		buffer_pool->release(read_buffer);
+	read_buffer = NULL;
 }
 
-bool Client::is_timed_out(int timeout_seconds) const
+// The request state lives in a pooled exchange from the first byte of a
+// request until its response is produced
+Exchange &Client::begin_exchange()
 {
-    time_t current_time = time(NULL);
-    return (current_time - last_activity) >= timeout_seconds;
+	if (!exchange)
+		exchange = exchanges->acquire();
+	return *exchange;
+}
+
+void Client::end_exchange()
+{
+	exchanges->release(exchange);
+	exchange = NULL;
 }
 
 void Client::send_timeout_response(const ServerContext* server_config)
 {
+    Response &response = begin_exchange().response;
+
     if (server_config != NULL)
-        current_response.set_server_config(server_config);
+        response.set_server_config(server_config);
+
+    response.set_error_response(REQUEST_TIMEOUT);
+    response.set_keep_alive(false, 0);
 
-    current_response.set_error_response(REQUEST_TIMEOUT);
-    current_response.handle_response(client_fd);
+    // Best effort: the connection is closed right after this
+    OutboundQueue response_data;
+    bool socket_full;
+    response.handle_response(response_data);
+    response_data.write_to(client_fd, socket_full);
 }
 Client::~Client()
 {
+	if (exchange)
+		end_exchange();
+	if (timers)
+		timers->cancel(&timer);
+	if (peer_counted)
+		PeerLimits::close_connection(peer);
+	if (server_config)
+		server_config->snapshot->release();
+}
+
+// Accept one pending connection, non-blocking and close-on-exec from the
+// start. Returns the new fd or an AcceptResult; `peer` gets the client's
+// address.
+int Client::accept_connection(int server_fd, uint32_t *peer)
+{
+	struct sockaddr_in address;
+	socklen_t length = sizeof(address);
+	int client_fd = accept4(server_fd, reinterpret_cast<struct sockaddr *>(&address), &length,
+		SOCK_NONBLOCK | SOCK_CLOEXEC);
 
+	if (client_fd >= 0)
+	{
+		if (peer)
+			*peer = address.sin_addr.s_addr;
+		return client_fd;
+	}
+	switch (errno)
+	{
+	case EMFILE:
+	case ENFILE:
+	case ENOBUFS:
+	case ENOMEM:
+		return ACCEPT_NO_FDS;
+	case ECONNABORTED:
+	case EINTR:
+	case EPROTO:
+	case EPERM:
+		return ACCEPT_DROPPED;
+	default:
+		return ACCEPT_DRAINED; // EAGAIN, or nothing more to get from this listener
+	}
 }
 
-int Client::handle_new_connection(int server_fd, int epoll_fd, std::map<int, Client> &active_clients)
+// Start serving an accepted connection on this event loop. Returns false
+// (and closes the fd) if it could not be registered. A connection over the
+// server block's limit_conn is answered 503 and closed here.
+bool Client::adopt_connection(int fd, ServerContext *config, uint32_t peer, IoEngine &io, FdTable &fds,
+	const GlobalContext &global, TimerWheel &timers, ExchangePool &exchanges)
 {
-	Client client;
-	struct sockaddr_in client_addr;
-	socklen_t client_len;
-	struct epoll_event client_event;
+	PeerLimits::Verdict verdict = PeerLimits::UNTRACKED;
 
-	client_len = sizeof(client_addr);
-	client.client_fd = accept(server_fd, (struct sockaddr *)&client_addr,
-							  &client_len);
-	if (client.client_fd == -1)
+	if (config->countsPeers)
+		verdict = PeerLimits::open_connection(peer, config->limitConn);
+	if (verdict == PeerLimits::REJECTED)
 	{
-		std::cout << "ERROR: Failed to accept connection" << std::endl;
-		return -1;
+		LOG_DEBUG("limit_conn reached for client " << fd << ", answering 503");
+		LoadLimits::connection_closed();
+		LoadLimits::refuse_connection(fd);
+		return true;
 	}
-	int flags = fcntl(client.client_fd, F_GETFL, 0);
-	if (flags == -1)
+
+	Client *client = fds.add_client(fd);
+
+	client->client_fd = fd;
+	client->peer = peer;
+	client->exchanges = &exchanges;
+	client->peer_counted = verdict == PeerLimits::COUNTED;
+	LOG_DEBUG("New client connected: " << fd);
+	// Keeps this config alive across reloads until the connection closes
+	config->snapshot->retain();
+	client->server_config = config;
+	client->edge_triggered = global.edgeTriggered;
+	client->io_budget = global.eventBudget;
+	// Edge-triggered sockets are registered for both directions once and
+	// never modified again; readiness is tracked in readable/writable
+	if (client->edge_triggered)
+		client->armed_events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	if (!io.add(fd, client->armed_events))
 	{
-		std::cout << "ERROR: fcntl F_GETFL failed" << std::endl;
-		close(client.client_fd);
-		return -1;
+		LOG_ERROR("Failed to add client to " << io.name());
+		fds.release(fd);
+		close(fd);
+		return false;
 	}
+	client->timers = &timers;
+	client->timer.fd = fd;
+	client->refresh_timer();
+	LOG_DEBUG("Client " << fd << " added to fd table");
+	LOG_DEBUG("Total active clients: " << fds.clients());
+	return true;
+}
 
-	if (fcntl(client.client_fd, F_SETFL, flags | O_NONBLOCK) == -1)
+// Entry point for epoll events on the connection (events is 0 when the
+// server resumes a connection that ran out of budget). Runs the connection
+// until it would block or io_budget steps are spent. Returns true when work
+// is left over: with edge-triggered epoll nothing would announce it again,
+// so the server has to come back on its own.
+bool Client::handle_events(uint32_t events, IoEngine &io, FdTable &fds,
+	CgiRunner &cgi_runner, BufferPool &pool)
+{
+	if (events & (EPOLLERR | EPOLLHUP))
 	{
-		std::cout << "ERROR: fcntl F_SETFL failed" << std::endl;
-		close(client.client_fd);
-		return -1;
+		LOG_DEBUG("Client " << client_fd << " hung up");
+		cleanup_connection(io, fds);
+		return false;
 	}
+	if (events & EPOLLRDHUP)
+		peer_shutdown = true;
+	if (events & (EPOLLIN | EPOLLRDHUP))
+		readable = true;
+	if (events & EPOLLOUT)
+		writable = true;
 
-	std::cout << "New client connected: " << client.client_fd << std::endl;
-	client_event.events = EPOLLIN;
-	client_event.data.fd = client.client_fd;
-	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client.client_fd, &client_event) == -1)
+	for (int budget = io_budget; budget > 0; budget--)
 	{
-		std::cout << "ERROR: Failed to add client to epoll" << std::endl;
-		close(client.client_fd);
-		return -1;
+		StepResult result = step(io, fds, *server_config, cgi_runner, pool);
+		if (result == STEP_CLOSED)
+			return false;
+		if (result == STEP_BLOCKED)
+		{
+			refresh_timer();
+			update_interest(io, fds);
+			return false;
+		}
+	}
+	refresh_timer();
+	return update_interest(io, fds);
+}
+
+// One unit of work, in the order responses must leave: pending output
+// first, then pipelined bytes, then the socket.
+Client::StepResult Client::step(IoEngine &io, FdTable &fds,
+	ServerContext &server_config, CgiRunner &cgi_runner, BufferPool &pool)
+{
+	if (!outbound.empty())
+	{
+		if (!writable)
+			return STEP_BLOCKED;
+		StepResult result = flush_outbound(io, fds);
+		if (result != STEP_CLOSED && cgi_paused && outbound.below_low_water())
+			resume_cgi(io, cgi_runner);
+		return result;
+	}
+	if (close_after_flush || (draining && waiting_for_request))
+	{
+		LOG_DEBUG("Response complete - closing connection");
+		cleanup_connection(io, fds);
+		return STEP_CLOSED;
+	}
+	if (awaiting_cgi || request_held)
+		return STEP_BLOCKED;
+	if (resume_request)
+	{
+		resume_request = false;
+		process_requests(HEADERS_ARE_READY, io, fds, server_config, cgi_runner);
+		return STEP_PROGRESS;
+	}
+	if (!pipelined.empty())
+	{
+		std::string next;
+		next.swap(pipelined);
+		process_requests(begin_exchange().request.add_new_data(next.data(), next.size()),
+			io, fds, server_config, cgi_runner);
+		return STEP_PROGRESS;
 	}
-	active_clients[client.client_fd] = client;
-	std::cout << "Client " << client.client_fd << " added to map" << std::endl;
-	std::cout << "Total active clients: " << active_clients.size() << std::endl;
-	return client.client_fd; 
+	if (!readable)
+		return STEP_BLOCKED;
+	return read_input(io, fds, server_config, cgi_runner, pool);
 }
 
-void Client::handle_client_data_input(int epoll_fd, std::map<int, Client> &active_clients, ServerContext &server_config, CgiRunner &cgi_runner)
+// One recv() into a pooled slab. A read that does not fill the slab means
+// the socket is drained, which saves the recv() that would only report
+// EAGAIN; the next edge re-arms it. Socket errors arrive as EPOLLERR, so a
+// failed recv is treated as "nothing to read".
+Client::StepResult Client::read_input(IoEngine &io, FdTable &fds,
+	ServerContext &server_config, CgiRunner &cgi_runner, BufferPool &pool)
 {
-	char buffer[7000000] = {0};
 	ssize_t bytes_received;
-	struct epoll_event ev;
 
-	bytes_received = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-	if (bytes_received > 0)
+	if (!read_buffer)
+	{
+		buffer_pool = &pool;
+		read_buffer = pool.acquire();
+		if (!read_buffer)
+		{
+			LOG_ERROR("Buffer pool exhausted for client " << client_fd);
+			cleanup_connection(io, fds);
+			return STEP_CLOSED;
+		}
+	}
+	bytes_received = recv(client_fd, read_buffer->data, read_buffer->capacity, 0);
+	if (bytes_received == 0)
 	{
-		buffer[bytes_received] = '\0';
-		std::cout << "=== CLIENT " << client_fd << ": PROCESSING REQUEST ===" << std::endl;
+		LOG_DEBUG("Client " << client_fd << " closed connection gracefully");
+		cleanup_connection(io, fds);
+		return STEP_CLOSED;
+	}
+	if (bytes_received < 0)
+	{
+		readable = false;
+		release_read_buffer();
+		return STEP_BLOCKED;
+	}
 
-		RequestStatus result = current_request.add_new_data(buffer, bytes_received);
+	read_buffer->size = bytes_received;
+	if (read_buffer->size < read_buffer->capacity && !peer_shutdown)
+		readable = false;
+	LOG_DEBUG("=== CLIENT " << client_fd << ": PROCESSING REQUEST ===");
 
+	RequestStatus result = begin_exchange().request.add_new_data(read_buffer->data, read_buffer->size);
+
+	// A full slab means the peer is streaming a large header/body: grow the
+	// slab and keep it for the next read. Otherwise hand it back while idle.
+	if (read_buffer->size == read_buffer->capacity)
+		pool.grow(read_buffer, read_buffer->capacity * 2);
+	else
+		release_read_buffer();
+
+	process_requests(result, io, fds, server_config, cgi_runner);
+	return STEP_PROGRESS;
+}
+
+// Drive the request parser: handle the request that `result` reports on and,
+// as long as each response is produced in one go, every pipelined request
+// that follows it in the same read. Responses are appended to `outbound` in
+// request order. Stops when a request needs more bytes, waits on a CGI
+// script, pipeline_depth requests have been queued or the queue is above
+// its high-water mark.
+void Client::process_requests(RequestStatus result, IoEngine &io, FdTable &fds,
+	ServerContext &server_config, CgiRunner &cgi_runner)
+{
+	int queued = 0;
+
+	waiting_for_request = false;
+	while (true)
+	{
 		switch (result)
 		{
 		case NEED_MORE_DATA:
-			std::cout << "We need more data from the client" << std::endl;
+			LOG_DEBUG("We need more data from the client");
 			return;
-		case BAD_REQUEST:
-			request_status = result;
-			break;
 		case HEADERS_ARE_READY:
 		{
-			current_request.set_config(server_config);
-			request_status = current_request.figure_out_http_method();
-
-			if (request_status == BODY_BEING_READ)
+			exchange->request.set_config(server_config);
+			if (!exchange->admitted)
 			{
-				std::cout << "Need more body data - waiting for more..." << std::endl;
-				return;
+				long delay = admit_request(server_config);
+				exchange->admitted = true;
+				if (delay > 0)
+				{
+					hold_request(delay);
+					return;
+				}
+				if (delay < 0)
+				{
+					exchange->status = SERVICE_UNAVAILABLE;
+					break;
+				}
 			}
+			exchange->status = exchange->request.figure_out_http_method();
 
-			std::cout << "Request fully processed and ready!" << std::endl;
-			std::cout << "Final request - Method: " << current_request.get_http_method()
-					  << " Path: " << current_request.get_requested_path() << std::endl;
-			if (current_request.is_cgi_request())
+			if (exchange->status == BODY_BEING_READ)
 			{
-				std::cout << "Detected CGI request - starting CGI process" << std::endl;
-				LocationContext *location = current_request.get_location();
-
-				if (location)
-				{
-					std::string script_path = resolve_file_path(current_request.get_requested_path(), location);
-					int cgi_output_fd = cgi_runner.start_cgi_process(current_request, *location, client_fd, script_path);
-					if (cgi_output_fd >= 0)
-					{
-						struct epoll_event cgi_ev;
-						cgi_ev.events = EPOLLIN;
-						cgi_ev.data.fd = cgi_output_fd;
-						if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, cgi_output_fd, &cgi_ev) == -1)
-						{
-							std::cerr << "Failed to add CGI output fd to epoll" << std::endl;
-							cgi_runner.cleanup_cgi_process(cgi_output_fd);
-						}
-						else
-						{
-							std::cout << "CGI process started, monitoring output fd: " << cgi_output_fd << std::endl;
-							return;
-						}
-					}
-					else
-					{
-						if (cgi_output_fd == -2) 
-						{
-							request_status = NOT_FOUND;
-							std::cerr << "CGI script resulted in 404 Not Found" << std::endl;
-						}
-						else if (cgi_output_fd == -3)
-						{ 
-							request_status = FORBIDDEN;
-							std::cerr << "CGI script resulted in 403 Forbidden" << std::endl;
-						}
-						else
-						{
-							request_status = INTERNAL_ERROR;
-							std::cerr << "Failed to start CGI process (internal error)" << std::endl;
-						}
-					}
-				}
+				LOG_DEBUG("Need more body data - waiting for more...");
+				return;
 			}
+
+			LOG_DEBUG("Request fully processed and ready!");
+			LOG_DEBUG("Final request - Method: " << exchange->request.get_http_method()
+					  << " Path: " << exchange->request.get_requested_path());
+			if (exchange->request.is_cgi_request() && start_cgi(io, fds, server_config, cgi_runner))
+				return;
 			break;
 		}
 		default:
-			std::cout << "UNKNOWN" << std::endl;
+			exchange->status = result;
 			break;
 		}
-		ev.events = EPOLLOUT;
-		ev.data.fd = client_fd;
-		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client_fd, &ev) == -1)
-		{
-			cleanup_connection(epoll_fd, active_clients);
-			std::cout << "Failed to modify client socket to EPOLLOUT mode" << std::endl;
+
+		build_response(server_config);
+		queued++;
+		if (!complete_request(exchange->response.keeps_alive())
+			|| pipelined.empty() || queued >= server_config.pipelineDepth
+			|| outbound.above_high_water())
 			return;
+
+		LOG_DEBUG("Parsing pipelined request " << queued + 1 << " from client " << client_fd);
+		std::string next;
+		next.swap(pipelined);
+		result = begin_exchange().request.add_new_data(next.data(), next.size());
+	}
+}
+
+// Returns true when the script is running and the client must wait for it.
+// On failure the exchange's status is set to the error to answer with.
+bool Client::start_cgi(IoEngine &io, FdTable &fds, ServerContext &server_config, CgiRunner &cgi_runner)
+{
+	LOG_DEBUG("Detected CGI request - starting CGI process");
+	LocationContext *location = exchange->request.get_location();
+
+	if (!location)
+		return false;
+	std::string script_path = resolve_file_path(exchange->request.get_requested_path(), location);
+	int cgi_timeout = location->cgiTimeout >= 0 ? location->cgiTimeout : server_config.cgiTimeout;
+	int cgi_output_fd = cgi_runner.start_cgi_process(exchange->request, *location, client_fd, script_path,
+		decide_keep_alive(server_config), cgi_timeout);
+	if (cgi_output_fd >= 0)
+	{
+		if (!io.add(cgi_output_fd, edge_triggered ? EPOLLIN | EPOLLET : EPOLLIN))
+		{
+			LOG_ERROR("Failed to add CGI output fd to " << io.name());
+			cgi_runner.cleanup_cgi_process(cgi_output_fd);
+			exchange->status = INTERNAL_ERROR;
+			return false;
 		}
+		fds.add_cgi(cgi_output_fd);
+		LOG_DEBUG("CGI process started, monitoring output fd: " << cgi_output_fd);
+		awaiting_cgi = true;
+		cgi_fd = cgi_output_fd;
+		return true;
 	}
-	else if (bytes_received == 0)
+	if (cgi_output_fd == -2) 
 	{
-		std::cout << "Client " << client_fd << " closed connection gracefully" << std::endl;
-		cleanup_connection(epoll_fd, active_clients);
+		exchange->status = NOT_FOUND;
+		LOG_WARN("CGI script resulted in 404 Not Found");
+	}
+	else if (cgi_output_fd == -3)
+	{ 
+		exchange->status = FORBIDDEN;
+		LOG_WARN("CGI script resulted in 403 Forbidden");
+	}
+	else if (cgi_output_fd == -4)
+	{
+		exchange->status = SERVICE_UNAVAILABLE;
+		LOG_DEBUG("max_cgi_processes reached, answering 503");
 	}
 	else
 	{
-		std::cout << "Error receiving data from client " << client_fd << std::endl;
-		cleanup_connection(epoll_fd, active_clients);
+		exchange->status = INTERNAL_ERROR;
+		LOG_ERROR("Failed to start CGI process (internal error)");
 	}
+	return false;
 }
 
-void Client::handle_client_data_output(int client_fd, int epoll_fd,
-									   std::map<int, Client> &active_clients, ServerContext &server_config)
+// Turn the finished request into a response and append it to the outbound
+// queue
+void Client::build_response(ServerContext &server_config)
 {
-	std::cout << "GENERATING RESPONSE FOR CLIENT " << client_fd << " ===" << std::endl;
+	LOG_DEBUG("GENERATING RESPONSE FOR CLIENT " << client_fd << " ===");
+
+	Request &current_request = exchange->request;
+	Response &current_response = exchange->response;
+	RequestStatus request_status = exchange->status;
 
 	current_response.set_server_config(&server_config);
 
-	if (current_response.is_still_streaming())
+	if (request_status == DELETED_SUCCESSFULLY)
+	{
+		current_response.set_code(200);
+		current_response.set_content("<html><body><h1>200 OK</h1><p>File deleted successfully.</p></body></html>");
+		current_response.set_header("Content-Type", "text/html");
+	}
+	else if (request_status == POSTED_SUCCESSFULLY)
+	{
+		current_response.set_code(201);
+		current_response.set_content("<html><body><h1>201 Created</h1><p>File created successfully.</p></body></html>");
+		current_response.set_header("Content-Type", "text/html");
+	}
+	else if (request_status != EVERYTHING_IS_OK)
 	{
-		std::cout << "Continuing file streaming..." << std::endl;
-		current_response.handle_response(client_fd);
+		LOG_DEBUG("Setting error response for status: " << request_status);
+		current_response.set_error_response(request_status);
 	}
 	else
 	{
+		std::string request_path = current_request.get_requested_path();
+		LOG_DEBUG("=== ANALYZING REQUEST PATH: " << request_path << " ===");
 
-		if (request_status == DELETED_SUCCESSFULLY)
-		{
-			current_response.set_code(200);
-			current_response.set_content("<html><body><h1>200 OK</h1><p>File deleted successfully.</p></body></html>");
-			current_response.set_header("Content-Type", "text/html");
-			current_response.set_header("Connection", "close");
-		}
-		else if (request_status == POSTED_SUCCESSFULLY)
-		{
-			current_response.set_code(201);
-			current_response.set_content("<html><body><h1>201 Created</h1><p>File created successfully.</p></body></html>");
-			current_response.set_header("Content-Type", "text/html");
-			current_response.set_header("Connection", "close");
-		}
-		else if (request_status != EVERYTHING_IS_OK)
-		{
-			std::cout << "Setting error response for status: " << request_status << std::endl;
-			current_response.set_error_response(request_status);
-		}
-		else
-		{
-			std::string request_path = current_request.get_requested_path();
-			std::cout << "=== ANALYZING REQUEST PATH: " << request_path << " ===" << std::endl;
+		LocationContext *location = current_request.get_location();
+		LOG_DEBUG("Creating normal response for path: " << request_path);
+		current_response.analyze_request_and_set_response(request_path, location);
+	}
 
-			LocationContext *location = current_request.get_location();
-			std::cout << "Creating normal response for path: " << request_path << std::endl;
-			current_response.analyze_request_and_set_response(request_path, location);
-		}
+	bool keep_alive = decide_keep_alive(server_config);
+	current_response.set_keep_alive(keep_alive, keepalive_timeout);
+	current_response.handle_response(outbound);
+}
+
+// Queue the formatted output of a finished CGI script behind whatever the
+// connection is already sending
+void Client::queue_cgi_response(const std::string &response_data, bool keep_alive)
+{
+	awaiting_cgi = false;
+	cgi_fd = -1;
+	cgi_paused = false;
+	outbound.append(response_data);
+	complete_request(keep_alive);
+}
+
+// Part of the response of a script that is still running. Returns true
+// when the queue is over its high-water mark: the server stops reading the
+// script's pipe until the client catches up.
+bool Client::queue_cgi_output(const std::string &output)
+{
+	outbound.append(output);
+	cgi_paused = outbound.above_high_water();
+	return cgi_paused;
+}
+
+bool Client::cgi_output_paused() const
+{
+	return cgi_paused;
+}
 
-		current_response.handle_response(client_fd);
+void Client::resume_cgi(IoEngine &io, CgiRunner &cgi_runner)
+{
+	LOG_DEBUG("Client " << client_fd << " drained, reading CGI fd " << cgi_fd << " again");
+	cgi_paused = false;
+	io.modify(cgi_fd, edge_triggered ? EPOLLIN | EPOLLET : EPOLLIN);
+	cgi_runner.update_cgi_activity(cgi_fd);
+}
+
+// One writev() or sendfile() of the pending output. A short write means
+// the socket buffer is full: the rest waits for the next EPOLLOUT.
+Client::StepResult Client::flush_outbound(IoEngine &io, FdTable &fds)
+{
+	bool socket_full;
+	ssize_t bytes_sent = outbound.write_to(client_fd, socket_full);
+	if (bytes_sent < 0)
+	{
+		writable = false;
+		return STEP_BLOCKED;
 	}
+	if (bytes_sent == 0)
+	{
+		LOG_INFO("Failed to send response to client " << client_fd);
+		cleanup_connection(io, fds);
+		return STEP_CLOSED;
+	}
+	LOG_DEBUG("Sent " << bytes_sent << " bytes to client " << client_fd);
+	if (socket_full)
+	{
+		writable = false;
+		return STEP_BLOCKED;
+	}
+	return STEP_PROGRESS;
+}
+
+// Point the I/O engine at what the connection is waiting for: the socket becoming
+// writable while output is pending, nothing while a CGI script runs, and
+// otherwise more request bytes. Skips the syscall when nothing changes, and
+// always for edge-triggered sockets, which stay armed for both directions.
+bool Client::update_interest(IoEngine &io, FdTable &fds)
+{
+	uint32_t wanted;
+
+	if (edge_triggered)
+		return true;
+	if (!outbound.empty())
+		wanted = EPOLLOUT;
+	else if (awaiting_cgi || request_held)
+		wanted = 0;
+	else
+		wanted = EPOLLIN;
+	if (wanted == armed_events)
+		return true;
+
+	if (!io.modify(client_fd, wanted))
+	{
+		LOG_ERROR("Failed to update " << io.name() << " events for client " << client_fd);
+		cleanup_connection(io, fds);
+		return false;
+	}
+	armed_events = wanted;
+	return true;
+}
+
+// Put the connection's timer on the deadline for what it is waiting on.
+// Header and keep-alive deadlines count from the start of the wait; body
+// and send deadlines restart on every turn, i.e. they bound the silence
+// between two reads or writes. A running CGI script has its own timer,
+// suspended while its output waits on this connection.
+void Client::refresh_timer()
+{
+	LocationContext *location = exchange ? exchange->request.get_location() : NULL;
 
-	if (!current_response.is_still_streaming())
+	if (!timers || request_held)
+		return;
+	if (!outbound.empty())
+		set_timer(TIMER_SEND, send_timeout);
+	else if (awaiting_cgi)
+		set_timer(TIMER_NONE, 0);
+	else if (waiting_for_request)
+		set_timer(TIMER_IDLE, keepalive_timeout);
+	else if (exchange && exchange->request.headers_complete())
 	{
-		std::cout << "Response complete - cleaning up connection" << std::endl;
-		cleanup_connection(epoll_fd, active_clients);
+		if (location && location->clientBodyTimeout >= 0)
+			set_timer(TIMER_BODY, location->clientBodyTimeout);
+		else
+			set_timer(TIMER_BODY, server_config->clientBodyTimeout);
 	}
 	else
-		std::cout << "File streaming in progress - keeping connection alive" << std::endl;
+		set_timer(TIMER_HEADER, server_config->clientHeaderTimeout);
+}
+
+void Client::set_timer(TimerPhase phase, int seconds)
+{
+	if (phase == timer_phase && timer_request == requests_served && timer.armed()
+		&& (phase == TIMER_HEADER || phase == TIMER_IDLE))
+		return;
+	timer_phase = phase;
+	timer_request = requests_served;
+	if (phase == TIMER_NONE || seconds <= 0)
+		timers->cancel(&timer);
+	else
+		timers->arm(&timer, static_cast<uint64_t>(seconds) * 1000);
 }
 
-void Client::cleanup_connection(int epoll_fd, std::map<int,
-													   Client> &active_clients)
+// The timer ran out. Idle keep-alive connections and stalled writes are
+// closed quietly; a client that is too slow sending its request gets a 408.
+// Returns true when a held request is due and the server must resume the
+// connection.
+bool Client::handle_timeout(IoEngine &io, FdTable &fds)
 {
-	std::cout << "=== CLEANING UP CLIENT " << client_fd << " ===" << std::endl;
-	if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, NULL) == -1)
+	if (timer.armed())
+		return false; // re-armed by activity earlier in this turn
+	switch (timer_phase)
 	{
-		std::cout << "Warning: Failed to remove client " << client_fd << " from epoll" << std::endl;
+	case TIMER_HOLD:
+		request_held = false;
+		resume_request = true;
+		return true;
+	case TIMER_IDLE:
+		LOG_DEBUG("Keep-alive client " << client_fd << " idle for " << keepalive_timeout << " seconds");
+		break;
+	case TIMER_SEND:
+		LOG_WARN("Client " << client_fd << " timed out receiving the response");
+		break;
+	case TIMER_HEADER:
+	case TIMER_BODY:
+		LOG_WARN("Client " << client_fd << " timed out sending the request");
+		send_timeout_response(server_config);
+		break;
+	default:
+		return false;
+	}
+	cleanup_connection(io, fds);
+	return false;
+}
+
+// limit_conn and limit_req of the matched location, else of the server
+// block. Returns how many ms to hold the request back, 0 to serve it now
+// or -1 to answer 503.
+long Client::admit_request(const ServerContext &server_config)
+{
+	LocationContext *location = exchange->request.get_location();
+	int limit_conn = server_config.limitConn;
+	const LimitReq *limit_req = &server_config.limitReq;
+
+	if (location && location->limitConn >= 0)
+		limit_conn = location->limitConn;
+	if (location && location->limitReq.rate >= 0)
+		limit_req = &location->limitReq;
+	if (limit_conn > 0 && peer_counted && PeerLimits::over_limit(peer, limit_conn))
+		return -1;
+	if (limit_req->rate > 0)
+		return PeerLimits::admit_request(peer, *limit_req);
+	return 0;
+}
+
+// Park the request until the limit_req delay has passed. The socket is not
+// watched meanwhile; handle_timeout() hands the request back.
+void Client::hold_request(long delay_ms)
+{
+	LOG_DEBUG("limit_req: holding client " << client_fd << " for " << delay_ms << " ms");
+	request_held = true;
+	timer_phase = TIMER_HOLD;
+	timer_request = requests_served;
+	timers->arm(&timer, static_cast<uint64_t>(delay_ms));
+}
+
+// Persistence rules for the response that is about to be sent. Resolves the
+// keepalive_timeout/keepalive_requests of the matched location (falling back
+// to the server block) into keepalive_timeout as a side effect, and the
+// send_timeout that applies while the response goes out.
+bool Client::decide_keep_alive(const ServerContext &server_config)
+{
+	LocationContext *location = exchange->request.get_location();
+	int max_requests = server_config.keepaliveRequests;
+
+	send_timeout = server_config.sendTimeout;
+	if (location && location->sendTimeout >= 0)
+		send_timeout = location->sendTimeout;
+
+	keepalive_timeout = server_config.keepaliveTimeout;
+	if (location && location->keepaliveTimeout >= 0)
+		keepalive_timeout = location->keepaliveTimeout;
+	if (location && location->keepaliveRequests > 0)
+		max_requests = location->keepaliveRequests;
+
+	if (draining || keepalive_timeout <= 0 || requests_served + 1 >= max_requests)
+		return false;
+	if (!exchange->request.wants_keep_alive())
+		return false;
+
+	// After these errors the rest of the request may still be on the wire,
+	// so the start of the next request cannot be found reliably
+	switch (exchange->status)
+	{
+	case BAD_REQUEST:
+	case LENGTH_REQUIRED:
+	case PAYLOAD_TOO_LARGE:
+	case URI_TOO_LONG:
+	case HEADER_TOO_LARGE:
+	case REQUEST_TIMEOUT:
+	case INTERNAL_ERROR:
+	case NOT_IMPLEMENTED:
+		return false;
+	default:
+		break;
+	}
+	if (exchange->request.get_http_method() == "POST" && exchange->status >= BAD_REQUEST)
+		return false;
+	return true;
+}
+
+// Called once a response has been fully produced (it may still sit in the
+// outbound buffer). Without keep-alive the connection closes after the
+// flush; otherwise per-request state is reset and the bytes the parser read
+// past this request become the start of the next one.
+bool Client::complete_request(bool keep_alive)
+{
+	requests_served++;
+	if (!keep_alive)
+	{
+		close_after_flush = true;
+		pipelined.clear();
+		return false;
+	}
+	pipelined.insert(0, exchange->request.take_pipelined_data());
+	// An idle connection holds no request state
+	end_exchange();
+	waiting_for_request = pipelined.empty();
+	LOG_DEBUG("Client " << client_fd << " kept alive (" << requests_served << " requests served)");
+	return true;
+}
+
+void Client::cleanup_connection(IoEngine &io, FdTable &fds)
+{
+	LOG_DEBUG("=== CLEANING UP CLIENT " << client_fd << " ===");
+	release_read_buffer();
+	// Let the script run to its end; its output is discarded
+	if (cgi_paused)
+		io.modify(cgi_fd, edge_triggered ? EPOLLIN | EPOLLET : EPOLLIN);
+	if (!io.remove(client_fd))
+	{
+		LOG_WARN("Failed to remove client " << client_fd << " from " << io.name());
 	}
 	else
 	{
-		std::cout << "Client " << client_fd << " removed from epoll" << std::endl;
+		LOG_DEBUG("Client " << client_fd << " removed from " << io.name());
 	}
 	if (close(client_fd) == -1)
 	{
-		std::cout << "Warning: Failed to close client " << client_fd << " socket" << std::endl;
+		LOG_WARN("Failed to close client " << client_fd << " socket");
 	}
 	else
 	{
-		std::cout << "Client " << client_fd << " socket closed" << std::endl;
+		LOG_DEBUG("Client " << client_fd << " socket closed");
 	}
-	active_clients.erase(client_fd);
-	std::cout << "Client removed from active clients map" << std::endl;
+	LOG_DEBUG("Client " << client_fd << " removed from fd table");
+	fds.release(client_fd); // destroys this Client
+}
+
+// The server is draining: a connection idle between requests closes now,
+// one with a request in flight after its response. Returns true when the
+// connection was closed (and this Client destroyed).
+bool Client::stop_keep_alive(IoEngine &io, FdTable &fds)
+{
+	draining = true;
+	if (!waiting_for_request || !outbound.empty())
+		return false;
+	cleanup_connection(io, fds);
+	return true;
+}
+
+ServerContext *Client::get_server_config() const
+{
+	return server_config;
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 # include "../cgi/cgi_runner.hpp"
 # include <arpa/inet.h>
 # include <cstring>
+# include <cerrno>
 # include <ctime>
 # include <exception>
 # include <fcntl.h>
@@ -17,8 +18,13 @@
 # include <sys/epoll.h>
 # include <sys/socket.h>
 # include <unistd.h>
-#include "../config/parser.hpp"
+#include "../config/config_snapshot.hpp"
 #include "../utils/utils.hpp"
+#include "../utils/buffer_pool.hpp"
+#include "exchange.hpp"
+#include "../utils/timer_wheel.hpp"
+#include "../Server_setup/fd_table.hpp"
+#include "../Server_setup/io_engine.hpp"
 
 class	Response;
 class	Request;
@@ -28,23 +34,102 @@ class Client
   private:
 	time_t connect_time;
 	int client_fd;
-	Request current_request;
-	Response current_response;
-	RequestStatus request_status;
-	time_t last_activity;
+	Exchange *exchange;       // request in flight, NULL while idle
+	ExchangePool *exchanges;
+	Buffer *read_buffer;
+	BufferPool *buffer_pool;
+	int requests_served;
+	bool waiting_for_request;
+	int keepalive_timeout;
+	OutboundQueue outbound;   // responses waiting to be sent, in request order
+	std::string pipelined;    // bytes received past the current request
+	bool close_after_flush;
+	bool awaiting_cgi;
+	int cgi_fd;               // output pipe of the script answering this request
+	bool cgi_paused;          // pipe not read until outbound drains below LOW_WATER
+	uint32_t armed_events;    // events currently registered with the I/O engine
+	ServerContext *server_config; // server block of the listener that accepted us
+	bool edge_triggered;
+	int io_budget;            // socket operations per turn before yielding
+	bool readable;            // the socket may have bytes to recv
+	bool writable;            // the socket may take more bytes
+	bool peer_shutdown;       // EPOLLRDHUP seen, a read will reach EOF
+	bool draining;            // the server is going away: no further requests
+	uint32_t peer;            // client IPv4 address, network order
+	bool peer_counted;        // counted by PeerLimits until destroyed
+	bool request_held;        // limit_req delay running
+	bool resume_request;      // delay over: process the held request
+
+	// What the connection is currently waiting on, which decides the
+	// timeout that applies and what happens when it fires
+	enum TimerPhase
+	{
+		TIMER_NONE,
+		TIMER_HEADER,
+		TIMER_BODY,
+		TIMER_SEND,
+		TIMER_IDLE,
+		TIMER_HOLD           // limit_req delay
+	};
+
+	TimerNode timer;
+	TimerWheel *timers;
+	TimerPhase timer_phase;
+	int timer_request;        // requests_served when the phase was entered
+	int send_timeout;         // resolved for the current response
+
+	enum StepResult
+	{
+		STEP_PROGRESS,
+		STEP_BLOCKED,
+		STEP_CLOSED
+	};
+
+	void release_read_buffer();
+	Exchange &begin_exchange();
+	void end_exchange();
+	StepResult step(IoEngine &io, FdTable &fds,
+		ServerContext &server_config, CgiRunner &cgi_runner, BufferPool &pool);
+	StepResult read_input(IoEngine &io, FdTable &fds,
+		ServerContext &server_config, CgiRunner &cgi_runner, BufferPool &pool);
+	bool decide_keep_alive(const ServerContext &server_config);
+	long admit_request(const ServerContext &server_config);
+	void hold_request(long delay_ms);
+	void process_requests(RequestStatus result, IoEngine &io, FdTable &fds,
+		ServerContext &server_config, CgiRunner &cgi_runner);
+	bool start_cgi(IoEngine &io, FdTable &fds, ServerContext &server_config, CgiRunner &cgi_runner);
+	void build_response(ServerContext &server_config);
+	bool complete_request(bool keep_alive);
+	StepResult flush_outbound(IoEngine &io, FdTable &fds);
+	void resume_cgi(IoEngine &io, CgiRunner &cgi_runner);
+	bool update_interest(IoEngine &io, FdTable &fds);
+	void refresh_timer();
+	void set_timer(TimerPhase phase, int seconds);
 	
   public:
 	Client();
 	~Client();
 
-	static int handle_new_connection(int server_fd, int epoll_fd, std::map<int,
-		Client> &active_clients);
-	void handle_client_data_input(int epoll_fd,std::map<int, Client> &active_clients,ServerContext& server_config, CgiRunner& cgi_runner);
-	void handle_client_data_output(int client_fd, int epoll_fd, std::map<int,
-		Client> &active_clients,ServerContext& server_config);
-	void cleanup_connection(int epoll_fd, std::map<int, Client> &active_clients);
-	void update_last_activity();
-	bool is_timed_out(int timeout_seconds) const;
+	// accept_connection results other than a new fd
+	enum AcceptResult
+	{
+		ACCEPT_DRAINED = -1,   // backlog empty
+		ACCEPT_DROPPED = -2,   // this connection went away, try the next one
+		ACCEPT_NO_FDS = -3     // out of descriptors (EMFILE/ENFILE)
+	};
+
+	static int accept_connection(int server_fd, uint32_t *peer = NULL);
+	static bool adopt_connection(int fd, ServerContext *config, uint32_t peer, IoEngine &io, FdTable &fds,
+		const GlobalContext &global, TimerWheel &timers, ExchangePool &exchanges);
+	bool handle_events(uint32_t events, IoEngine &io, FdTable &fds,
+		CgiRunner &cgi_runner, BufferPool &pool);
+	void queue_cgi_response(const std::string &response_data, bool keep_alive);
+	bool queue_cgi_output(const std::string &output);
+	bool cgi_output_paused() const;
+	void cleanup_connection(IoEngine &io, FdTable &fds);
+	bool handle_timeout(IoEngine &io, FdTable &fds);
+	bool stop_keep_alive(IoEngine &io, FdTable &fds);
+	ServerContext *get_server_config() const;
 	void send_timeout_response(const ServerContext* server_config = NULL);
 };
 
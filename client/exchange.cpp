@@ -0,0 +1,76 @@
+#include "exchange.hpp"
+#include "client.hpp"
+#include "../utils/logger.hpp"
+#include <cstring>
+
+ExchangePool::ExchangePool(size_t max_free) : max_free(max_free)
+{
+	std::memset(&stats, 0, sizeof(stats));
+}
+
+ExchangePool::~ExchangePool()
+{
+	for (size_t i = 0; i < free_list.size(); ++i)
+		delete free_list[i];
+	free_list.clear();
+}
+
+Exchange *ExchangePool::acquire()
+{
+	Exchange *exchange;
+
+	stats.checkouts++;
+	if (!free_list.empty())
+	{
+		exchange = free_list.back();
+		free_list.pop_back();
+	}
+	else
+	{
+		stats.misses++;
+		exchange = new Exchange;
+		stats.allocated++;
+	}
+	stats.in_use++;
+	if (stats.in_use > stats.peak_in_use)
+		stats.peak_in_use = stats.in_use;
+	return exchange;
+}
+
+void ExchangePool::release(Exchange *exchange)
+{
+	if (!exchange)
+		return;
+	stats.in_use--;
+	if (free_list.size() >= max_free || exchange->request.retained_bytes() > MAX_POOLED_BYTES)
+	{
+		delete exchange;
+		stats.allocated--;
+		return;
+	}
+	exchange->request.reset();
+	exchange->response.reset();
+	exchange->status = NEED_MORE_DATA;
+	exchange->admitted = false;
+	free_list.push_back(exchange);
+}
+
+const ExchangePoolStats &ExchangePool::get_stats() const
+{
+	return stats;
+}
+
+// idle_bytes is what a connection between two requests costs in user
+// space: its Client and its slot in the fd table
+void ExchangePool::print_stats(size_t open_connections) const
+{
+	LOG_INFO("[CONNECTIONS] open=" << open_connections
+			  << " idle_bytes=" << sizeof(Client) + sizeof(FdHandle)
+			  << " exchange_bytes=" << sizeof(Exchange)
+			  << " exchanges=" << stats.allocated
+			  << " in_use=" << stats.in_use
+			  << " free=" << free_list.size()
+			  << " peak=" << stats.peak_in_use
+			  << " checkouts=" << stats.checkouts
+			  << " misses=" << stats.misses);
+}
@@ -0,0 +1,61 @@
+#ifndef EXCHANGE_HPP
+# define EXCHANGE_HPP
+
+# include "../request/request.hpp"
+# include "../response/response.hpp"
+# include <cstddef>
+# include <vector>
+
+// Per-request state of a connection: the parser with its method handlers,
+// the response builder and the outcome so far. Only a connection with a
+// request in flight holds one; between requests it goes back to the pool.
+struct Exchange
+{
+	Request request;
+	Response response;
+	RequestStatus status;
+	bool admitted;           // limit_req/limit_conn already checked for this request
+
+	Exchange() : status(NEED_MORE_DATA), admitted(false) {}
+};
+
+// Occupancy counters, used to size the pool
+struct ExchangePoolStats
+{
+	size_t allocated;        // exchanges currently owned by the pool (free + in use)
+	size_t in_use;           // exchanges held by connections
+	size_t peak_in_use;      // high-water mark of in_use
+	size_t checkouts;        // total acquire() calls
+	size_t misses;           // acquire() calls that had to allocate
+};
+
+// Free list of exchanges of one event loop. An idle keep-alive connection
+// costs only its Client; the request state comes from here when bytes
+// arrive.
+class ExchangePool
+{
+  private:
+	size_t max_free;
+	std::vector<Exchange *> free_list;
+	ExchangePoolStats stats;
+
+	ExchangePool(const ExchangePool &);
+	ExchangePool &operator=(const ExchangePool &);
+
+  public:
+	static const size_t DEFAULT_MAX_FREE = 1024;
+	// Exchanges whose buffers grew past this are freed rather than kept
+	static const size_t MAX_POOLED_BYTES = 64 * 1024;
+
+	explicit ExchangePool(size_t max_free = DEFAULT_MAX_FREE);
+	~ExchangePool();
+
+	Exchange *acquire();
+	// Reset and keep for the next request, or free
+	void release(Exchange *exchange);
+
+	const ExchangePoolStats &get_stats() const;
+	void print_stats(size_t open_connections) const;
+};
+
+#endif
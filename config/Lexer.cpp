@@ -1,5 +1,6 @@
 // Lexer.cpp – C++98-compliant implementation of the NGINX-style lexer
 #include "Lexer.hpp"
+#include "../utils/logger.hpp"
 #include <cctype>
 #include <string>
 #include <iostream>
@@ -37,6 +38,46 @@ static TokenType keywordLookup(const std::string &word)
         return CGI_PATH_KEYWORD;
     if (word == "upload_store")
         return UPLOAD_STORE_KEYWORD;
+    if (word == "keepalive_timeout")
+        return KEEPALIVE_TIMEOUT_KEYWORD;
+    if (word == "keepalive_requests")
+        return KEEPALIVE_REQUESTS_KEYWORD;
+    if (word == "pipeline_depth")
+        return PIPELINE_DEPTH_KEYWORD;
+    if (word == "client_header_timeout")
+        return CLIENT_HEADER_TIMEOUT_KEYWORD;
+    if (word == "client_body_timeout")
+        return CLIENT_BODY_TIMEOUT_KEYWORD;
+    if (word == "send_timeout")
+        return SEND_TIMEOUT_KEYWORD;
+    if (word == "cgi_timeout")
+        return CGI_TIMEOUT_KEYWORD;
+    if (word == "event_mode")
+        return EVENT_MODE_KEYWORD;
+    if (word == "event_budget")
+        return EVENT_BUDGET_KEYWORD;
+    if (word == "worker_processes")
+        return WORKER_PROCESSES_KEYWORD;
+    if (word == "worker_threads")
+        return WORKER_THREADS_KEYWORD;
+    if (word == "worker_cpu_affinity")
+        return WORKER_CPU_AFFINITY_KEYWORD;
+    if (word == "io_engine")
+        return IO_ENGINE_KEYWORD;
+    if (word == "accept_batch")
+        return ACCEPT_BATCH_KEYWORD;
+    if (word == "error_log")
+        return ERROR_LOG_KEYWORD;
+    if (word == "max_connections")
+        return MAX_CONNECTIONS_KEYWORD;
+    if (word == "max_cgi_processes")
+        return MAX_CGI_PROCESSES_KEYWORD;
+    if (word == "shutdown_timeout")
+        return SHUTDOWN_TIMEOUT_KEYWORD;
+    if (word == "limit_conn")
+        return LIMIT_CONN_KEYWORD;
+    if (word == "limit_req")
+        return LIMIT_REQ_KEYWORD;
 
     // HTTP methods as their own token (handy for allowed_methods)
     if (word == "GET" || word == "POST" || word == "PUT" ||
@@ -195,11 +236,13 @@ Token Lexer::readWordOrPath()
         return t;
     }
 
-    // Bare word (allow '.', '_', '-', ':' so that 'index.html', '404.html', 'www.example.com', 'http://example.com' stay whole)
+    // Bare word (allow '.', '_', '-', ':' so that 'index.html', '404.html', 'www.example.com', 'http://example.com' stay whole,
+    // and '=' for parameters such as 'rate=10r/s')
     bool hasDot = false;
     while (!isAtEnd() &&
            (std::isalnum(static_cast<unsigned char>(currentChar())) ||
-            currentChar() == '_' || currentChar() == '-' || currentChar() == '.' || currentChar() == ':' || currentChar() == '/'))
+            currentChar() == '_' || currentChar() == '-' || currentChar() == '.' || currentChar() == ':' || currentChar() == '/' ||
+            currentChar() == '='))
     {
         if (currentChar() == '.')
             hasDot = true;
@@ -364,7 +407,7 @@ Lexer::Lexer(const std::string &filePath)
     buffer << file.rdbuf();
     input = buffer.str();
 
-    std::cout << "File content loaded from: " << filePath << std::endl;
+    LOG_INFO("File content loaded from: " << filePath);
 }
 
 Lexer::Lexer(std::istream &in)
@@ -27,6 +27,26 @@ enum TokenType
     CGI_EXTENSION_KEYWORD,
     CGI_PATH_KEYWORD,
     UPLOAD_STORE_KEYWORD,
+    KEEPALIVE_TIMEOUT_KEYWORD,
+    KEEPALIVE_REQUESTS_KEYWORD,
+    PIPELINE_DEPTH_KEYWORD,
+    CLIENT_HEADER_TIMEOUT_KEYWORD,
+    CLIENT_BODY_TIMEOUT_KEYWORD,
+    SEND_TIMEOUT_KEYWORD,
+    CGI_TIMEOUT_KEYWORD,
+    EVENT_MODE_KEYWORD,
+    EVENT_BUDGET_KEYWORD,
+    WORKER_PROCESSES_KEYWORD,
+    WORKER_THREADS_KEYWORD,
+    WORKER_CPU_AFFINITY_KEYWORD,
+    IO_ENGINE_KEYWORD,
+    ACCEPT_BATCH_KEYWORD,
+    ERROR_LOG_KEYWORD,
+    MAX_CONNECTIONS_KEYWORD,
+    MAX_CGI_PROCESSES_KEYWORD,
+    SHUTDOWN_TIMEOUT_KEYWORD,
+    LIMIT_CONN_KEYWORD,
+    LIMIT_REQ_KEYWORD,
     HTTP_METHOD_KEYWORD, // GET, POST, PUT, DELETE, HEAD, OPTIONS, PATCH
 
     // Symbols
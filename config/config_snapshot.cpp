@@ -0,0 +1,73 @@
+#include "config_snapshot.hpp"
+#include "Lexer.hpp"
+#include <stdexcept>
+
+ConfigSnapshot::ConfigSnapshot(const std::string &path) : path(path), refs(1)
+{
+}
+
+ConfigSnapshot::~ConfigSnapshot()
+{
+}
+
+ConfigSnapshot *ConfigSnapshot::load(const std::string &path)
+{
+    Lexer lexer(path);
+    Parser parser(lexer.tokenizeAll());
+
+    parser.parse();
+    if (parser.getServers().empty())
+        throw std::runtime_error("No server blocks found in config.");
+
+    ConfigSnapshot *snapshot = new ConfigSnapshot(path);
+    snapshot->servers = parser.getServers();
+    snapshot->global = parser.getGlobal();
+    for (size_t i = 0; i < snapshot->servers.size(); ++i)
+        snapshot->servers[i].snapshot = snapshot;
+    return snapshot;
+}
+
+// Connections are retained and released by whichever event loop thread
+// serves them
+void ConfigSnapshot::retain()
+{
+    __sync_add_and_fetch(&refs, 1);
+}
+
+void ConfigSnapshot::release()
+{
+    if (__sync_sub_and_fetch(&refs, 1) == 0)
+        delete this;
+}
+
+const std::string &ConfigSnapshot::getPath() const
+{
+    return path;
+}
+
+std::vector<ServerContext> &ConfigSnapshot::getServers()
+{
+    return servers;
+}
+
+const GlobalContext &ConfigSnapshot::getGlobal() const
+{
+    return global;
+}
+
+std::string ConfigSnapshot::restartOnlyChanges(const GlobalContext &running) const
+{
+    std::string changed;
+
+    if (global.edgeTriggered != running.edgeTriggered)
+        changed += ", event_mode";
+    if (global.workerProcesses != running.workerProcesses)
+        changed += ", worker_processes";
+    if (global.workerThreads != running.workerThreads)
+        changed += ", worker_threads";
+    if (global.cpuAffinity != running.cpuAffinity)
+        changed += ", worker_cpu_affinity";
+    if (global.ioUring != running.ioUring)
+        changed += ", io_engine";
+    return changed.empty() ? changed : changed.substr(2);
+}
@@ -0,0 +1,42 @@
+#ifndef CONFIG_SNAPSHOT_HPP
+#define CONFIG_SNAPSHOT_HPP
+
+#include "parser.hpp"
+#include <string>
+#include <vector>
+
+// One parsed configuration file, never modified once loaded. Listeners
+// serve new connections from the current snapshot and every connection
+// holds a reference to the one it was accepted under, so a reload swaps the
+// snapshot without changing the config of a request in flight. The last
+// release deletes it.
+class ConfigSnapshot
+{
+private:
+    std::string path;
+    std::vector<ServerContext> servers;
+    GlobalContext global;
+    volatile int refs;
+
+    ConfigSnapshot(const std::string &path);
+    ~ConfigSnapshot();
+    ConfigSnapshot(const ConfigSnapshot &);
+    ConfigSnapshot &operator=(const ConfigSnapshot &);
+
+public:
+    // Lex and parse `path`. Throws std::runtime_error on any error; the
+    // caller owns the one reference of the result.
+    static ConfigSnapshot *load(const std::string &path);
+
+    void retain();
+    void release();
+
+    const std::string &getPath() const;
+    std::vector<ServerContext> &getServers();
+    const GlobalContext &getGlobal() const;
+    // Top-level settings that differ from `running` but only take effect
+    // on a restart, comma separated ("" when there are none)
+    std::string restartOnlyChanges(const GlobalContext &running) const;
+};
+
+#endif
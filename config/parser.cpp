@@ -4,6 +4,7 @@
 #include <sstream>
 #include <cstdlib>
 #include <iostream>
+#include <sched.h>
 
 static std::string toString(int number)
 {
@@ -15,6 +16,7 @@ static std::string toString(int number)
 Parser::Parser(const std::vector<Token> &tokenStream)
 {
     current = 0;
+    limitReqZones = 0;
     tokens = tokenStream;
 }
 
@@ -57,6 +59,31 @@ void Parser::parse()
             break;
         if (peek().type == SERVER_KEYWORD)
             parseServerBlock();
+        else if (peek().type == EVENT_MODE_KEYWORD)
+            parseEventModeDirective();
+        else if (peek().type == EVENT_BUDGET_KEYWORD)
+            parseEventBudgetDirective();
+        else if (peek().type == WORKER_PROCESSES_KEYWORD)
+            parseWorkerProcessesDirective();
+        else if (peek().type == WORKER_THREADS_KEYWORD)
+            parseWorkerThreadsDirective();
+        else if (peek().type == WORKER_CPU_AFFINITY_KEYWORD)
+            parseWorkerCpuAffinityDirective();
+        else if (peek().type == IO_ENGINE_KEYWORD)
+            parseIoEngineDirective();
+        else if (peek().type == ACCEPT_BATCH_KEYWORD)
+            parseAcceptBatchDirective();
+        else if (peek().type == ERROR_LOG_KEYWORD)
+            parseErrorLogDirective();
+        else if (peek().type == MAX_CONNECTIONS_KEYWORD)
+            global.maxConnections = parseLimitDirective(MAX_CONNECTIONS_KEYWORD, "max_connections");
+        else if (peek().type == MAX_CGI_PROCESSES_KEYWORD)
+            global.maxCgiProcesses = parseLimitDirective(MAX_CGI_PROCESSES_KEYWORD, "max_cgi_processes");
+        else if (peek().type == SHUTDOWN_TIMEOUT_KEYWORD)
+        {
+            advance(); // consume 'shutdown_timeout'
+            parseTimeoutDirective("shutdown_timeout", global.shutdownTimeout);
+        }
         else
         {
             std::ostringstream oss;
@@ -69,6 +96,191 @@ const std::vector<ServerContext> &Parser::getServers() const
 {
     return servers;
 }
+
+const GlobalContext &Parser::getGlobal() const
+{
+    return global;
+}
+
+// event_mode edge|level; edge (the default) registers every fd once with
+// EPOLLET and drains it, level falls back to level-triggered interest
+void Parser::parseEventModeDirective()
+{
+    expect(EVENT_MODE_KEYWORD, "Expected 'event_mode' directive");
+
+    const Token &mode = advance();
+    if (mode.value == "edge")
+        global.edgeTriggered = true;
+    else if (mode.value == "level")
+        global.edgeTriggered = false;
+    else
+        throw std::runtime_error("'event_mode' must be 'edge' or 'level' at line " + toString(mode.line));
+
+    expect(SEMICOLON, "Expected ';' after event_mode");
+}
+
+// event_budget <count>; how many reads/writes/accepts one fd gets per turn
+// before the other ready fds are served
+void Parser::parseEventBudgetDirective()
+{
+    expect(EVENT_BUDGET_KEYWORD, "Expected 'event_budget' directive");
+
+    if (peek().type != NUMBER)
+        throw std::runtime_error("Expected operation count after 'event_budget' at line " + toString(peek().line));
+
+    long value = std::strtol(advance().value.c_str(), 0, 10);
+    if (value < 1 || value > 4096)
+        throw std::runtime_error("'event_budget' must be between 1 and 4096 at line " + toString(previous().line));
+
+    expect(SEMICOLON, "Expected ';' after event_budget");
+    global.eventBudget = static_cast<int>(value);
+}
+
+// worker_processes <count>|auto; more than one worker puts a master process
+// in front that forks and supervises them
+void Parser::parseWorkerProcessesDirective()
+{
+    expect(WORKER_PROCESSES_KEYWORD, "Expected 'worker_processes' directive");
+
+    const Token &count = advance();
+    if (count.type == STRING && count.value == "auto")
+        global.workerProcesses = 0;
+    else if (count.type == NUMBER)
+    {
+        long value = std::strtol(count.value.c_str(), 0, 10);
+        if (value < 1 || value > 512)
+            throw std::runtime_error("'worker_processes' must be between 1 and 512 at line " + toString(count.line));
+        global.workerProcesses = static_cast<int>(value);
+    }
+    else
+        throw std::runtime_error("Expected worker count or 'auto' after 'worker_processes' at line " + toString(count.line));
+
+    expect(SEMICOLON, "Expected ';' after worker_processes");
+}
+
+// worker_threads <count>|auto; runs that many event-loop threads fed by one
+// acceptor thread per listener (0, the default, keeps a single loop)
+void Parser::parseWorkerThreadsDirective()
+{
+    expect(WORKER_THREADS_KEYWORD, "Expected 'worker_threads' directive");
+
+    const Token &count = advance();
+    if (count.type == STRING && count.value == "auto")
+        global.workerThreads = -1;
+    else if (count.type == NUMBER)
+    {
+        long value = std::strtol(count.value.c_str(), 0, 10);
+        if (value > 512)
+            throw std::runtime_error("'worker_threads' must be between 0 and 512 at line " + toString(count.line));
+        global.workerThreads = static_cast<int>(value);
+    }
+    else
+        throw std::runtime_error("Expected thread count or 'auto' after 'worker_threads' at line " + toString(count.line));
+
+    expect(SEMICOLON, "Expected ';' after worker_threads");
+}
+
+// worker_cpu_affinity auto|<mask>...; pins every event loop (worker process,
+// or loop thread with worker_threads) to CPUs. auto gives each its own
+// CPU; a mask is binary with CPU 0 rightmost, one per loop, the last one
+// repeated for the loops past it.
+void Parser::parseWorkerCpuAffinityDirective()
+{
+    expect(WORKER_CPU_AFFINITY_KEYWORD, "Expected 'worker_cpu_affinity' directive");
+
+    std::vector<std::string> masks;
+    if (peek().type == STRING && peek().value == "auto")
+        masks.push_back(advance().value);
+    else
+    {
+        while (peek().type == NUMBER)
+        {
+            const Token &mask = advance();
+            if (mask.value.find_first_not_of("01") != std::string::npos || mask.value.size() > CPU_SETSIZE)
+                throw std::runtime_error("Invalid CPU mask '" + mask.value + "' at line " + toString(mask.line));
+            if (mask.value.find('1') == std::string::npos)
+                throw std::runtime_error("CPU mask without any CPU at line " + toString(mask.line));
+            masks.push_back(mask.value);
+        }
+    }
+    if (masks.empty())
+        throw std::runtime_error("Expected 'auto' or CPU masks after 'worker_cpu_affinity' at line " + toString(peek().line));
+
+    expect(SEMICOLON, "Expected ';' after worker_cpu_affinity");
+    global.cpuAffinity = masks;
+}
+
+// io_engine epoll|io_uring; io_uring batches interest changes with the wait
+// and falls back to epoll when the kernel cannot provide it
+void Parser::parseIoEngineDirective()
+{
+    expect(IO_ENGINE_KEYWORD, "Expected 'io_engine' directive");
+
+    const Token &engine = advance();
+    if (engine.value == "epoll")
+        global.ioUring = false;
+    else if (engine.value == "io_uring")
+        global.ioUring = true;
+    else
+        throw std::runtime_error("'io_engine' must be 'epoll' or 'io_uring' at line " + toString(engine.line));
+
+    expect(SEMICOLON, "Expected ';' after io_engine");
+}
+
+// accept_batch <count>; connections taken from a listener's backlog per
+// wakeup before other fds get a turn
+void Parser::parseAcceptBatchDirective()
+{
+    expect(ACCEPT_BATCH_KEYWORD, "Expected 'accept_batch' directive");
+
+    if (peek().type != NUMBER)
+        throw std::runtime_error("Expected connection count after 'accept_batch' at line " + toString(peek().line));
+
+    long value = std::strtol(advance().value.c_str(), 0, 10);
+    if (value < 1 || value > 4096)
+        throw std::runtime_error("'accept_batch' must be between 1 and 4096 at line " + toString(previous().line));
+
+    expect(SEMICOLON, "Expected ';' after accept_batch");
+    global.acceptBatch = static_cast<int>(value);
+}
+
+// error_log <file|stderr|stdout> [debug|info|warn|error]; debug lines are
+// only compiled into `make debug` builds
+void Parser::parseErrorLogDirective()
+{
+    expect(ERROR_LOG_KEYWORD, "Expected 'error_log' directive");
+
+    if (peek().type != STRING)
+        throw std::runtime_error("Expected a file after 'error_log' at line " + toString(peek().line));
+    global.errorLogPath = advance().value;
+
+    if (peek().type == STRING)
+    {
+        const Token &level = advance();
+        if (!Logger::parse_level(level.value, global.logLevel))
+            throw std::runtime_error("'error_log' level must be debug, info, warn or error at line " + toString(level.line));
+    }
+
+    expect(SEMICOLON, "Expected ';' after error_log");
+}
+
+// max_connections <count>; and max_cgi_processes <count>; per process,
+// 0 (the default) for no limit
+int Parser::parseLimitDirective(TokenType keyword, const std::string &name)
+{
+    expect(keyword, "Expected '" + name + "' directive");
+
+    if (peek().type != NUMBER)
+        throw std::runtime_error("Expected a count after '" + name + "' at line " + toString(peek().line));
+
+    long value = std::strtol(advance().value.c_str(), 0, 10);
+    if (value < 0 || value > 1000000)
+        throw std::runtime_error("'" + name + "' must be between 0 and 1000000 at line " + toString(previous().line));
+
+    expect(SEMICOLON, "Expected ';' after " + name);
+    return static_cast<int>(value);
+}
+
 void Parser::parseServerBlock()
 {
     expect(SERVER_KEYWORD, "Expected 'server' keyword");
@@ -107,6 +319,41 @@ void Parser::parseServerBlock()
         case AUTOINDEX_KEYWORD:
             parseAutoindexDirective();
             break;
+        case KEEPALIVE_TIMEOUT_KEYWORD:
+            advance(); // consume 'keepalive_timeout'
+            parseKeepaliveTimeoutDirective(currentServer.keepaliveTimeout);
+            break;
+        case KEEPALIVE_REQUESTS_KEYWORD:
+            advance(); // consume 'keepalive_requests'
+            parseKeepaliveRequestsDirective(currentServer.keepaliveRequests);
+            break;
+        case PIPELINE_DEPTH_KEYWORD:
+            parsePipelineDepthDirective();
+            break;
+        case CLIENT_HEADER_TIMEOUT_KEYWORD:
+            advance(); // consume 'client_header_timeout'
+            parseTimeoutDirective("client_header_timeout", currentServer.clientHeaderTimeout);
+            break;
+        case CLIENT_BODY_TIMEOUT_KEYWORD:
+            advance(); // consume 'client_body_timeout'
+            parseTimeoutDirective("client_body_timeout", currentServer.clientBodyTimeout);
+            break;
+        case SEND_TIMEOUT_KEYWORD:
+            advance(); // consume 'send_timeout'
+            parseTimeoutDirective("send_timeout", currentServer.sendTimeout);
+            break;
+        case CGI_TIMEOUT_KEYWORD:
+            advance(); // consume 'cgi_timeout'
+            parseTimeoutDirective("cgi_timeout", currentServer.cgiTimeout);
+            break;
+        case LIMIT_CONN_KEYWORD:
+            advance(); // consume 'limit_conn'
+            parseLimitConnDirective(currentServer.limitConn);
+            break;
+        case LIMIT_REQ_KEYWORD:
+            advance(); // consume 'limit_req'
+            parseLimitReqDirective(currentServer.limitReq);
+            break;
         case LOCATION_KEYWORD:
             parseLocationBlock();
             break;
@@ -116,6 +363,12 @@ void Parser::parseServerBlock()
     }
 
     expect(RIGHT_BRACE, "Expected '}' to close server block");
+    currentServer.countsPeers = currentServer.limitConn > 0;
+    for (size_t i = 0; i < currentServer.locations.size(); ++i)
+    {
+        if (currentServer.locations[i].limitConn > 0)
+            currentServer.countsPeers = true;
+    }
     servers.push_back(currentServer); // Store the completed server context
 }
 
@@ -171,6 +424,29 @@ void Parser::parseHostDirective()
         currentServer.port = "80";
 }
 
+// <n>, <n>K or <n>M bytes for a port parameter, at most 64M
+static int parseListenSize(const std::string &value, const std::string &name, int line)
+{
+    char *end = 0;
+    long bytes = std::strtol(value.c_str(), &end, 10);
+
+    if (*end == 'K' || *end == 'k')
+    {
+        bytes *= 1024;
+        end++;
+    }
+    else if (*end == 'M' || *end == 'm')
+    {
+        bytes *= 1024 * 1024;
+        end++;
+    }
+    if (end == value.c_str() || *end != '\0' || bytes < 1 || bytes > 64L * 1024 * 1024)
+        throw std::runtime_error("'" + name + "' must be a size up to 64M at line " + toString(line));
+    return static_cast<int>(bytes);
+}
+
+// port <n> [backlog=<n>] [deferred] [fastopen=<n>] [rcvbuf=<size>]
+// [sndbuf=<size>] [nodelay] [notsent_lowat=<size>];
 void Parser::parsePortDirective()
 {
     expect(PORT_KEYWORD, "Expected 'port' directive");
@@ -183,12 +459,51 @@ void Parser::parsePortDirective()
         throw std::runtime_error("Invalid port number '" + port +
                                  "' in port directive at line " + toString(peek().line));
 
+    ListenOptions options;
+    while (peek().type == STRING)
+    {
+        const Token &param = advance();
+        const std::string &value = param.value;
+        size_t equals = value.find('=');
+        std::string name = value.substr(0, equals);
+        std::string argument = equals == std::string::npos ? "" : value.substr(equals + 1);
+        char *end = 0;
+
+        if (name == "backlog" && !argument.empty())
+        {
+            long backlog = std::strtol(argument.c_str(), &end, 10);
+            if (*end != '\0' || backlog < 1 || backlog > 65535)
+                throw std::runtime_error("'backlog' must be between 1 and 65535 at line " + toString(param.line));
+            options.backlog = static_cast<int>(backlog);
+        }
+        else if (name == "fastopen" && !argument.empty())
+        {
+            long queue = std::strtol(argument.c_str(), &end, 10);
+            if (*end != '\0' || queue < 0 || queue > 65535)
+                throw std::runtime_error("'fastopen' must be between 0 and 65535 at line " + toString(param.line));
+            options.fastopen = static_cast<int>(queue);
+        }
+        else if (name == "rcvbuf" && !argument.empty())
+            options.rcvbuf = parseListenSize(argument, name, param.line);
+        else if (name == "sndbuf" && !argument.empty())
+            options.sndbuf = parseListenSize(argument, name, param.line);
+        else if (name == "notsent_lowat" && !argument.empty())
+            options.notsentLowat = parseListenSize(argument, name, param.line);
+        else if (value == "deferred")
+            options.deferred = true;
+        else if (value == "nodelay")
+            options.nodelay = true;
+        else
+            throw std::runtime_error("Unknown 'port' parameter '" + value + "' at line " + toString(param.line));
+    }
+
     expect(SEMICOLON, "Expected ';' after port directive");
 
     // Store the port (keep existing host or default)
     if (currentServer.host.empty())
         currentServer.host = "0.0.0.0";
     currentServer.port = port;
+    currentServer.listen = options;
 }
 
 void Parser::parseRootDirective()
@@ -327,6 +642,127 @@ void Parser::parseAutoindexDirective()
     currentServer.autoindex = value; // Store in currentServer
 }
 
+// keepalive_timeout <seconds>; (0 disables keep-alive)
+// client_header_timeout / client_body_timeout / send_timeout / cgi_timeout <seconds>;
+void Parser::parseTimeoutDirective(const std::string &name, int &target)
+{
+    if (peek().type != NUMBER)
+        throw std::runtime_error("Expected number of seconds after '" + name + "' at line " + toString(peek().line));
+
+    long value = std::strtol(advance().value.c_str(), 0, 10);
+    if (value < 1 || value > 3600)
+        throw std::runtime_error("'" + name + "' must be between 1 and 3600 seconds at line " + toString(previous().line));
+
+    expect(SEMICOLON, "Expected ';' after " + name);
+    target = static_cast<int>(value);
+}
+
+void Parser::parseKeepaliveTimeoutDirective(int &target)
+{
+    if (peek().type != NUMBER)
+        throw std::runtime_error("Expected number of seconds after 'keepalive_timeout' at line " + toString(peek().line));
+
+    long value = std::strtol(advance().value.c_str(), 0, 10);
+    if (value > 3600)
+        throw std::runtime_error("'keepalive_timeout' must be between 0 and 3600 seconds at line " + toString(previous().line));
+
+    expect(SEMICOLON, "Expected ';' after keepalive_timeout");
+    target = static_cast<int>(value);
+}
+
+// keepalive_requests <count>;
+void Parser::parseKeepaliveRequestsDirective(int &target)
+{
+    if (peek().type != NUMBER)
+        throw std::runtime_error("Expected request count after 'keepalive_requests' at line " + toString(peek().line));
+
+    long value = std::strtol(advance().value.c_str(), 0, 10);
+    if (value < 1 || value > 1000000)
+        throw std::runtime_error("'keepalive_requests' must be between 1 and 1000000 at line " + toString(previous().line));
+
+    expect(SEMICOLON, "Expected ';' after keepalive_requests");
+    target = static_cast<int>(value);
+}
+
+// limit_conn <count>; connections open at once from one client address,
+// 0 for no limit
+void Parser::parseLimitConnDirective(int &target)
+{
+    if (peek().type != NUMBER)
+        throw std::runtime_error("Expected connection count after 'limit_conn' at line " + toString(peek().line));
+
+    long value = std::strtol(advance().value.c_str(), 0, 10);
+    if (value > 1000000)
+        throw std::runtime_error("'limit_conn' must be between 0 and 1000000 at line " + toString(previous().line));
+
+    expect(SEMICOLON, "Expected ';' after limit_conn");
+    target = static_cast<int>(value);
+}
+
+// limit_req rate=<n>r/s|r/m [burst=<n>] [nodelay]; requests from one client
+// address beyond the rate wait their turn, past the burst they get a 503.
+// Every directive keeps its own bucket per address.
+void Parser::parseLimitReqDirective(LimitReq &target)
+{
+    LimitReq limit;
+    bool seenRate = false;
+
+    while (peek().type == STRING)
+    {
+        const Token &param = advance();
+        const std::string &value = param.value;
+        char *end = 0;
+
+        if (value.compare(0, 5, "rate=") == 0)
+        {
+            long rate = std::strtol(value.c_str() + 5, &end, 10);
+            std::string unit = end ? end : "";
+            if (rate < 1 || rate > 1000000 || (unit != "r/s" && unit != "r/m"))
+                throw std::runtime_error("'limit_req' rate must look like 10r/s or 30r/m at line " + toString(param.line));
+            limit.rate = static_cast<int>(unit == "r/s" ? rate * 1000 : rate * 1000 / 60);
+            if (limit.rate == 0)
+                limit.rate = 1;
+            seenRate = true;
+        }
+        else if (value.compare(0, 6, "burst=") == 0)
+        {
+            long burst = std::strtol(value.c_str() + 6, &end, 10);
+            if (*end != '\0' || burst < 0 || burst > 1000000)
+                throw std::runtime_error("'limit_req' burst must be between 0 and 1000000 at line " + toString(param.line));
+            limit.burst = static_cast<int>(burst);
+        }
+        else if (value == "nodelay")
+            limit.nodelay = true;
+        else
+            throw std::runtime_error("Unknown 'limit_req' parameter '" + value + "' at line " + toString(param.line));
+    }
+    if (!seenRate)
+        throw std::runtime_error("'limit_req' needs rate=<n>r/s at line " + toString(peek().line));
+
+    expect(SEMICOLON, "Expected ';' after limit_req");
+    // Numbered in file order, so a reload keeps the buckets of a directive
+    // that did not move
+    limit.zone = ++limitReqZones;
+    target = limit;
+}
+
+// pipeline_depth <count>; how many pipelined requests are answered from one
+// read before the queued responses are flushed
+void Parser::parsePipelineDepthDirective()
+{
+    expect(PIPELINE_DEPTH_KEYWORD, "Expected 'pipeline_depth' directive");
+
+    if (peek().type != NUMBER)
+        throw std::runtime_error("Expected request count after 'pipeline_depth' at line " + toString(peek().line));
+
+    long value = std::strtol(advance().value.c_str(), 0, 10);
+    if (value < 1 || value > 1024)
+        throw std::runtime_error("'pipeline_depth' must be between 1 and 1024 at line " + toString(previous().line));
+
+    expect(SEMICOLON, "Expected ';' after pipeline_depth");
+    currentServer.pipelineDepth = static_cast<int>(value);
+}
+
 void Parser::parseLocationBlock()
 {
     expect(LOCATION_KEYWORD, "Expected 'location' keyword");
@@ -409,6 +845,48 @@ void Parser::parseLocationBlock()
             break;
         }
 
+        case KEEPALIVE_TIMEOUT_KEYWORD:
+        {
+            parseKeepaliveTimeoutDirective(location.keepaliveTimeout);
+            break;
+        }
+
+        case KEEPALIVE_REQUESTS_KEYWORD:
+        {
+            parseKeepaliveRequestsDirective(location.keepaliveRequests);
+            break;
+        }
+
+        case CLIENT_BODY_TIMEOUT_KEYWORD:
+        {
+            parseTimeoutDirective("client_body_timeout", location.clientBodyTimeout);
+            break;
+        }
+
+        case SEND_TIMEOUT_KEYWORD:
+        {
+            parseTimeoutDirective("send_timeout", location.sendTimeout);
+            break;
+        }
+
+        case CGI_TIMEOUT_KEYWORD:
+        {
+            parseTimeoutDirective("cgi_timeout", location.cgiTimeout);
+            break;
+        }
+
+        case LIMIT_CONN_KEYWORD:
+        {
+            parseLimitConnDirective(location.limitConn);
+            break;
+        }
+
+        case LIMIT_REQ_KEYWORD:
+        {
+            parseLimitReqDirective(location.limitReq);
+            break;
+        }
+
         default:
             throw std::runtime_error("Unknown directive '" + token.value + "' in location block at line " + toString(token.line));
         }
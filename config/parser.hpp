@@ -4,6 +4,35 @@
 #include <vector>
 #include <sstream> // Add at top of your parser.cpp
 #include "Lexer.hpp"
+#include "../utils/logger.hpp"
+
+// limit_req rate=<n>r/s|r/m [burst=<n>] [nodelay];
+struct LimitReq
+{
+    int rate;                // thousandths of a request per second, 0 = no limit, -1 = inherit
+    int burst;               // requests allowed above the rate before refusing
+    bool nodelay;            // serve the burst at once instead of spacing it out
+    int zone;                // numbers the directive: each one has its own bucket per address
+
+    LimitReq() : rate(0), burst(0), nodelay(false), zone(0) {}
+};
+
+// Parameters of the port directive, applied to the listening socket.
+// Accepted sockets inherit them from it.
+struct ListenOptions
+{
+    int backlog;             // listen() queue length, -1 = SOMAXCONN
+    bool deferred;           // TCP_DEFER_ACCEPT: wake up once request bytes arrived
+    int fastopen;            // TCP_FASTOPEN queue length, 0 = off
+    int rcvbuf;              // SO_RCVBUF bytes, 0 = kernel default
+    int sndbuf;              // SO_SNDBUF bytes, 0 = kernel default
+    bool nodelay;            // TCP_NODELAY
+    int notsentLowat;        // TCP_NOTSENT_LOWAT bytes, 0 = kernel default
+
+    ListenOptions() : backlog(-1), deferred(false), fastopen(0), rcvbuf(0), sndbuf(0),
+        nodelay(false), notsentLowat(0) {}
+};
+
 struct LocationContext
 {
     std::string path;
@@ -15,20 +44,72 @@ struct LocationContext
     std::vector<std::string> cgiExtensions;  // Changed to vector for multiple extensions
     std::vector<std::string> cgiPaths;       // Changed to vector for multiple interpreters
     std::string uploadStore; // Directory where uploaded files are stored
+    int keepaliveTimeout;    // Seconds an idle keep-alive connection is kept (-1 = inherit from server)
+    int keepaliveRequests;   // Requests served per connection before closing (-1 = inherit from server)
+    int clientBodyTimeout;   // Seconds allowed between two reads of a request body (-1 = inherit)
+    int sendTimeout;         // Seconds allowed between two writes of a response (-1 = inherit)
+    int cgiTimeout;          // Seconds a CGI script may stay silent (-1 = inherit)
+    int limitConn;           // Connections per client address (-1 = inherit, 0 = none)
+    LimitReq limitReq;       // Request rate per client address (rate -1 = inherit)
+
+    LocationContext() : keepaliveTimeout(-1), keepaliveRequests(-1), clientBodyTimeout(-1),
+        sendTimeout(-1), cgiTimeout(-1), limitConn(-1)
+    {
+        limitReq.rate = -1;
+    }
 };
 
 typedef std::pair<std::vector<int>, std::string> ErrorPagePair;
 
+class ConfigSnapshot;
+
 struct ServerContext
 {
     std::string host;
     std::string port;
+    ListenOptions listen;    // port directive parameters
     std::string root;
     std::vector<std::string> indexes;
     std::vector<ErrorPagePair> errorPages; 
     std::string clientMaxBodySize;
     std::string autoindex;
     std::vector<LocationContext> locations;
+    int keepaliveTimeout;    // 0 disables keep-alive
+    int keepaliveRequests;
+    int pipelineDepth;       // pipelined requests answered per batch before flushing
+    int clientHeaderTimeout; // seconds to receive a request's headers
+    int clientBodyTimeout;
+    int sendTimeout;
+    int cgiTimeout;
+    int limitConn;           // connections per client address, 0 = none
+    LimitReq limitReq;
+    bool countsPeers;        // limit_conn here or in a location: count connections per address
+    ConfigSnapshot *snapshot; // the loaded config this block belongs to
+
+    ServerContext() : keepaliveTimeout(75), keepaliveRequests(1000), pipelineDepth(32),
+        clientHeaderTimeout(30), clientBodyTimeout(30), sendTimeout(30), cgiTimeout(30),
+        limitConn(0), countsPeers(false), snapshot(NULL) {}
+};
+
+// Directives that sit outside every server block and apply to the whole process
+struct GlobalContext
+{
+    bool edgeTriggered;      // event_mode edge|level
+    int eventBudget;         // socket/pipe operations per fd before yielding to others
+    int workerProcesses;     // 1 = no master process, 0 = auto (one per online CPU)
+    int workerThreads;       // event-loop threads per process, 0 = loop in the main thread, -1 = auto
+    bool ioUring;            // io_engine epoll|io_uring
+    int acceptBatch;         // connections accepted per listener wakeup
+    std::string errorLogPath; // error_log target: a file, "stderr" or "stdout"
+    LogLevel logLevel;       // lowest level written to the error log
+    int maxConnections;      // open connections per process, 0 = unlimited
+    int maxCgiProcesses;     // running CGI scripts per process, 0 = unlimited
+    std::vector<std::string> cpuAffinity; // worker_cpu_affinity: empty, {"auto"} or one binary mask per loop
+    int shutdownTimeout;     // seconds a draining loop waits for open connections before closing them
+
+    GlobalContext() : edgeTriggered(true), eventBudget(16), workerProcesses(1), workerThreads(0),
+        ioUring(false), acceptBatch(64), errorLogPath("stderr"), logLevel(LOG_LEVEL_INFO),
+        maxConnections(0), maxCgiProcesses(0), shutdownTimeout(30) {}
 };
 
 class Parser
@@ -38,6 +119,8 @@ private:
     std::vector<Token> tokens;
     ServerContext currentServer;
     std::vector<ServerContext> servers;
+    GlobalContext global;
+    int limitReqZones;       // limit_req directives seen so far
 
     // Private helper methods
     const Token &peek();
@@ -64,11 +147,27 @@ private:
     void parseCgiExtensionDirective(LocationContext& location);
     void parseCgiPathDirective(LocationContext& location);
     void parseUploadStoreDirective(LocationContext& location);
+    void parseKeepaliveTimeoutDirective(int& target);
+    void parseKeepaliveRequestsDirective(int& target);
+    void parsePipelineDepthDirective();
+    void parseTimeoutDirective(const std::string& name, int& target);
+    void parseEventModeDirective();
+    void parseEventBudgetDirective();
+    void parseWorkerProcessesDirective();
+    void parseWorkerThreadsDirective();
+    void parseWorkerCpuAffinityDirective();
+    void parseIoEngineDirective();
+    void parseAcceptBatchDirective();
+    void parseErrorLogDirective();
+    int parseLimitDirective(TokenType keyword, const std::string &name);
+    void parseLimitConnDirective(int &target);
+    void parseLimitReqDirective(LimitReq &target);
 
 public:
     Parser(const std::vector<Token> &tokenStream);
     void parse();
     const std::vector<ServerContext> &getServers() const;
+    const GlobalContext &getGlobal() const;
 };
 
 #endif
@@ -1,13 +1,24 @@
 #include "Server_setup/server.hpp"
-#include "config/Lexer.hpp"
-#include "config/parser.hpp"
+#include "utils/logger.hpp"
+#include "Server_setup/master.hpp"
+#include "Server_setup/reactor_threads.hpp"
+#include "Server_setup/binary_upgrade.hpp"
+#include "Server_setup/load_limits.hpp"
+#include "Server_setup/cpu_affinity.hpp"
+#include "config/config_snapshot.hpp"
+#include "utils/scan.hpp"
 #include <vector>
 #include <signal.h>
+#include <cerrno>
+#include <cstring>
 
 int	main(int argc, char **argv)
 {    
 	
     signal(SIGPIPE, SIG_IGN);
+    BinaryUpgrade::remember_binary();
+    CpuAffinity::remember_cpus();
+    Scan::select();
 
     if (argc != 2)
     {
@@ -16,40 +27,56 @@ int	main(int argc, char **argv)
         return (1);
     }
     
-    Lexer lexer(argv[1]);
-    std::vector<ServerContext> servers_config;
-    std::vector<Token> tokens = lexer.tokenizeAll();
-    std::cout << "-------------------------" << std::endl;
-    Parser parser(tokens);
+    ConfigSnapshot *config;
     try
     {
-        parser.parse();
-        servers_config = parser.getServers();
-        std::cout << "Parsing completed successfully!" << std::endl;
-        std::cout << "Found " << servers_config.size() << " server configurations" << std::endl;
+        config = ConfigSnapshot::load(argv[1]);
+        LOG_INFO("Parsing completed successfully!");
+        LOG_INFO("Found " << config->getServers().size() << " server configurations");
     }
     catch (const std::runtime_error &e)
     {
-        std::cerr << e.what() << std::endl;
+        LOG_ERROR(e.what());
         return 1;
     }
-	Server server;
+    const GlobalContext &global_config = config->getGlobal();
+    if (!Logger::configure(global_config.errorLogPath, global_config.logLevel))
+    {
+        LOG_ERROR("Cannot open error_log " << global_config.errorLogPath << ": " << std::strerror(errno));
+        return 1;
+    }
+#ifndef DEBUG
+    if (global_config.logLevel == LOG_LEVEL_DEBUG)
+        LOG_WARN("error_log level debug needs a debug build (make debug)");
+#endif
+    Logger::start();
+    LOG_INFO("Byte scanning kernels: " << Scan::level_name());
+    LoadLimits::configure(global_config.maxConnections, global_config.maxCgiProcesses);
+	int status = 0;
 	try
 	{
-		if (servers_config.empty())
+		if (global_config.workerProcesses != 1)
+		{
+			Master master(config);
+			status = master.run();
+		}
+		else if (global_config.workerThreads != 0)
 		{
-			std::cerr << "No server blocks found in config." << std::endl;
-			return 1;
+			ReactorThreads threads(config);
+			status = threads.run();
+		}
+		else
+		{
+			Server server;
+			server.init_data(config);
+			server.run();
 		}
-		server.init_data(servers_config);
-		server.run();
 	}
 	catch (const std::exception &e)
 	{
-		std::cerr << "Error: " << e.what() << std::endl;
-		return (-1);
+		LOG_ERROR("Error: " << e.what());
+		status = -1;
 	}
-	return (0);
+	config->release();
+	return (status);
 }
-
-
@@ -1,4 +1,5 @@
 #include "delete_handler.hpp"
+#include "../utils/logger.hpp"
 #include "request_status.hpp"
 #include <iostream>
 #include <string>
@@ -18,8 +19,8 @@ DeleteHandler::~DeleteHandler()
 RequestStatus DeleteHandler::handle_delete_request(
     const std::string& file_path)
 {
-    std::cout << "=== DELETE HANDLER ===" << std::endl;
-    std::cout << "Deleting: " << file_path << std::endl;
+    LOG_DEBUG("=== DELETE HANDLER ===");
+    LOG_DEBUG("Deleting: " << file_path);
     
     if (file_path.empty())
         return FORBIDDEN;
@@ -33,7 +34,7 @@ RequestStatus DeleteHandler::handle_delete_request(
     
     if (unlink(file_path.c_str()) == 0)
     {
-        std::cout << "File deleted successfully" << std::endl;
+        LOG_DEBUG("File deleted successfully");
         return DELETED_SUCCESSFULLY;
     }
     
@@ -1,4 +1,5 @@
 #include "get_handler.hpp"
+#include "../utils/logger.hpp"
 #include "request_status.hpp"
 #include <iostream>
 
@@ -15,18 +16,18 @@ RequestStatus GetHandler::handle_get_request(const std::string &requested_path)
 
     if (requested_path.empty())
     {
-        std::cout << "ERROR: Empty path provided" << std::endl;
+        LOG_ERROR("Empty path provided");
         return BAD_REQUEST;
     }
     if (requested_path.find("..") != std::string::npos)
     {
-        std::cout << "ERROR: Path traversal attempt detected: " << requested_path << std::endl;
+        LOG_WARN("Path traversal attempt detected: " << requested_path);
         return BAD_REQUEST;
     }
 
     if (requested_path.length() > 2048)
     {
-        std::cout << " ERROR: Path too long (" << requested_path.length() << " chars) - max 2048" << std::endl;
+        LOG_WARN("Path too long (" << requested_path.length() << " chars) - max 2048");
         return BAD_REQUEST;
     }
 
@@ -0,0 +1,183 @@
+#include "http_parser.hpp"
+#include "../utils/scan.hpp"
+#include <cstring>
+
+HttpParser::HttpParser() : state(REQUEST_START), position(0), value_end(0)
+{
+}
+
+void HttpParser::reset()
+{
+	state = REQUEST_START;
+	position = 0;
+	value_end = 0;
+	method_slice = Slice();
+	target_slice = Slice();
+	version_slice = Slice();
+	field = HeaderSlice();
+	fields.clear();
+}
+
+// Origin-form target and a version this server speaks
+bool HttpParser::valid_request_line(const char *data) const
+{
+	if (data[target_slice.offset] != '/')
+		return false;
+	if (version_slice.length != 8)
+		return false;
+	return std::memcmp(data + version_slice.offset, "HTTP/1.1", 8) == 0
+		|| std::memcmp(data + version_slice.offset, "HTTP/1.0", 8) == 0;
+}
+
+// Runs of ordinary bytes (method, target, version, header name and value)
+// are skipped by the vector kernels; the switch only sees the byte that
+// ends a run.
+HttpParser::Result HttpParser::parse(const char *data, size_t size)
+{
+	while (position < size)
+	{
+		switch (state)
+		{
+		case METHOD:
+		case FIELD_NAME:
+			position = Scan::skip_token(data + position, data + size) - data;
+			break;
+		case TARGET:
+		case VERSION:
+			position = Scan::skip_visible(data + position, data + size) - data;
+			break;
+		case VALUE:
+			skip_value(data, size);
+			break;
+		default:
+			break;
+		}
+		if (position == size)
+			break;
+
+		unsigned char c = data[position];
+		switch (state)
+		{
+		case REQUEST_START:
+			if (c == '\r')
+				state = REQUEST_START_LF;
+			else
+			{
+				method_slice.offset = position;
+				state = METHOD;
+				continue;
+			}
+			break;
+		case REQUEST_START_LF:
+			if (c != '\n')
+				return PARSE_ERROR;
+			state = REQUEST_START;
+			break;
+		case METHOD:
+			if (c != ' ' || position == method_slice.offset)
+				return PARSE_ERROR;
+			method_slice.length = position - method_slice.offset;
+			state = TARGET_START;
+			break;
+		case TARGET_START:
+			if (c != ' ')
+			{
+				target_slice.offset = position;
+				state = TARGET;
+				continue;
+			}
+			break;
+		case TARGET:
+			if (c != ' ' || position == target_slice.offset)
+				return PARSE_ERROR;
+			target_slice.length = position - target_slice.offset;
+			state = VERSION_START;
+			break;
+		case VERSION_START:
+			if (c != ' ')
+			{
+				version_slice.offset = position;
+				state = VERSION;
+				continue;
+			}
+			break;
+		case VERSION:
+			if (c != '\r')
+				return PARSE_ERROR;
+			version_slice.length = position - version_slice.offset;
+			if (!valid_request_line(data))
+				return PARSE_ERROR;
+			state = REQUEST_LINE_LF;
+			break;
+		case REQUEST_LINE_LF:
+			if (c != '\n')
+				return PARSE_ERROR;
+			state = FIELD_START;
+			break;
+		case FIELD_START:
+			if (c == '\r')
+				state = HEAD_END_LF;
+			else
+			{
+				field.name.offset = position;
+				state = FIELD_NAME;
+				continue;
+			}
+			break;
+		case FIELD_NAME:
+			// Also rejects whitespace before the colon and obsolete line
+			// folding (a line starting with whitespace)
+			if (c != ':' || position == field.name.offset)
+				return PARSE_ERROR;
+			field.name.length = position - field.name.offset;
+			state = VALUE_START;
+			break;
+		case VALUE_START:
+			if (c != ' ' && c != '\t')
+			{
+				field.value.offset = position;
+				value_end = position;
+				state = VALUE;
+				continue;
+			}
+			break;
+		case VALUE:
+			if (c != '\r')
+				return PARSE_ERROR;
+			field.value.length = value_end - field.value.offset;
+			state = FIELD_LF;
+			break;
+		case FIELD_LF:
+			if (c != '\n')
+				return PARSE_ERROR;
+			fields.push_back(field);
+			state = FIELD_START;
+			break;
+		case HEAD_END_LF:
+			if (c != '\n')
+				return PARSE_ERROR;
+			state = HEAD_DONE;
+			++position;
+			return PARSE_DONE;
+		case HEAD_DONE:
+			return PARSE_DONE;
+		}
+		++position;
+	}
+	return state == HEAD_DONE ? PARSE_DONE : PARSE_INCOMPLETE;
+}
+
+// Skip value bytes, keeping value_end just past the last one that is not
+// trailing whitespace
+void HttpParser::skip_value(const char *data, size_t size)
+{
+	const char *run = data + position;
+	const char *stop = Scan::skip_field_value(run, data + size);
+	const char *last = stop;
+
+	while (last > run && (last[-1] == ' ' || last[-1] == '\t'))
+		--last;
+	if (last > run)
+		value_end = last - data;
+	position = stop - data;
+}
@@ -0,0 +1,89 @@
+#ifndef HTTP_PARSER_HPP
+#define HTTP_PARSER_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// A byte range of the buffer the request head was parsed from
+struct Slice
+{
+	size_t offset;
+	size_t length;
+
+	Slice() : offset(0), length(0) {}
+};
+
+struct HeaderSlice
+{
+	Slice name;
+	Slice value;              // without surrounding whitespace
+};
+
+// Resumable parser for an HTTP/1.x request line and header block. Each call
+// to parse() continues at the byte where the previous one stopped, so a
+// head that trickles in is scanned once in total. Nothing is copied: the
+// parts are recorded as offsets into the caller's buffer.
+class HttpParser
+{
+  public:
+	enum Result
+	{
+		PARSE_INCOMPLETE,
+		PARSE_DONE,
+		PARSE_ERROR
+	};
+
+  private:
+	enum State
+	{
+		REQUEST_START,        // empty lines before the request line are skipped
+		REQUEST_START_LF,
+		METHOD,
+		TARGET_START,
+		TARGET,
+		VERSION_START,
+		VERSION,
+		REQUEST_LINE_LF,
+		FIELD_START,
+		FIELD_NAME,
+		VALUE_START,
+		VALUE,
+		FIELD_LF,
+		HEAD_END_LF,
+		HEAD_DONE
+	};
+
+	State state;
+	size_t position;          // next byte to look at
+	size_t value_end;         // end of the current value before trailing whitespace
+	Slice method_slice;
+	Slice target_slice;
+	Slice version_slice;
+	HeaderSlice field;
+	std::vector<HeaderSlice> fields;
+
+	bool valid_request_line(const char *data) const;
+	void skip_value(const char *data, size_t size);
+
+  public:
+	HttpParser();
+
+	void reset();
+	// `data` holds everything received for this head so far
+	Result parse(const char *data, size_t size);
+
+	const Slice &method() const { return method_slice; }
+	const Slice &target() const { return target_slice; }
+	const Slice &version() const { return version_slice; }
+	const std::vector<HeaderSlice> &headers() const { return fields; }
+	// Bytes of the head, final empty line included; valid after PARSE_DONE
+	size_t head_length() const { return position; }
+
+	static std::string text(const std::string &buffer, const Slice &slice)
+	{
+		return buffer.substr(slice.offset, slice.length);
+	}
+};
+
+#endif
@@ -1,4 +1,6 @@
 #include "post_handler.hpp"
+#include "../utils/logger.hpp"
+#include "../utils/scan.hpp"
 
 RequestStatus PostHandler::parse_form_data(const std::string &body,
 	const std::string &content_type, const LocationContext *loc,
@@ -6,38 +8,38 @@ RequestStatus PostHandler::parse_form_data(const std::string &body,
 {
 	size_t	end_position;
 	RequestStatus status;
-	std::cout << "Parsing multipart data..." << std::endl;
+	LOG_DEBUG("Parsing multipart data...");
 	if (!boundary_found)
 	{
 		boundary = extract_boundary(content_type);
 		if (boundary.empty())
 		{
-			std::cout << "ERROR: Failed to extract boundary" << std::endl;
+			LOG_WARN("Failed to extract boundary");
 			return (BAD_REQUEST);
 		}
 		boundary_found = true;
-		std::cout << "Extracted boundary: " << boundary << std::endl;
+		LOG_DEBUG("Extracted boundary: " << boundary);
 	}
 	if (!file_name_found)
 	{
 		file_name = extract_filename(body);
 		if (file_name.empty())
 		{
-			std::cout << "ERROR: Failed to extract filename" << std::endl;
+			LOG_WARN("Failed to extract filename");
 			return (BAD_REQUEST);
 		}
 		file_name_found = true;
-		std::cout << "Extracted filename: " << file_name << std::endl;
+		LOG_DEBUG("Extracted filename: " << file_name);
 	}
 	if (!data_start)
 	{
-		start_position = body.find("\r\n\r\n");
+		start_position = Scan::find(body, "\r\n\r\n", 4);
 		if (start_position == std::string::npos)
 		{
-			start_position = body.find("\n\n");
+			start_position = Scan::find(body, "\n\n", 2);
 			if (start_position == std::string::npos)
 			{
-				std::cout << "ERROR: Cannot find data start!" << std::endl;
+				LOG_WARN("Cannot find data start!");
 				status = save_request_body("debug_error.txt", body, loc);
 				if(status != POSTED_SUCCESSFULLY)
 					return status;
@@ -52,13 +54,13 @@ RequestStatus PostHandler::parse_form_data(const std::string &body,
 		data_start = true;
 		// handle case small data
 		std::string closing_boundary = "--" + boundary + "--";  // try final boundary first
-		end_position = body.find(closing_boundary, start_position);
+		end_position = Scan::find(body, closing_boundary, start_position);
 		if (end_position == std::string::npos)
 		{
 			closing_boundary = "--" + boundary;  // try regular boundary
-			end_position = body.find(closing_boundary, start_position);
+			end_position = Scan::find(body, closing_boundary, start_position);
 		}
-		std::cout << "Looking for boundary: '" << closing_boundary << "'" << std::endl;
+		LOG_DEBUG("Looking for boundary: '" << closing_boundary << "'");
 		if (end_position != std::string::npos)
 		{
 			if (end_position >= 2 && body.substr(end_position - 2, 2) == "\r\n")
@@ -81,25 +83,25 @@ RequestStatus PostHandler::parse_form_data(const std::string &body,
 	if (total_received_size == expected_body_size)
 	{
 		std::string boundary_marker = "--" + boundary + "--";
-		end_position = body.find(boundary_marker);
-		std::cout << "Final chunk detected." << std::endl;
-		std::cout << "Looking for final boundary: '" << boundary_marker << "'" << std::endl;
-		std::cout << "End position: " << end_position << std::endl;
+		end_position = Scan::find(body, boundary_marker);
+		LOG_DEBUG("Final chunk detected.");
+		LOG_DEBUG("Looking for final boundary: '" << boundary_marker << "'");
+		LOG_DEBUG("End position: " << end_position);
 		
 		// If final boundary not found, try regular boundary
 		if (end_position == std::string::npos)
 		{
 			boundary_marker = "--" + boundary;
-			end_position = body.find(boundary_marker);
-			std::cout << "Trying regular boundary: '" << boundary_marker << "'" << std::endl;
-			std::cout << "End position with regular boundary: " << end_position << std::endl;
+			end_position = Scan::find(body, boundary_marker);
+			LOG_DEBUG("Trying regular boundary: '" << boundary_marker << "'");
+			LOG_DEBUG("End position with regular boundary: " << end_position);
 		}
 		
 		if (end_position == std::string::npos)
 		{
-			std::cout << "ERROR: Cannot find data end!" << std::endl;
-			std::cout << "Body content (first 200 chars): " << body.substr(0, 200) << std::endl;
-			std::cout << "Body size: " << body.size() << std::endl;
+			LOG_WARN("Cannot find data end!");
+			LOG_DEBUG("Body content (first 200 chars): " << body.substr(0, 200));
+			LOG_DEBUG("Body size: " << body.size());
 			status = save_request_body("debug_error.txt", body, loc);
 			if (status != POSTED_SUCCESSFULLY)
 				return status;
@@ -132,7 +134,7 @@ RequestStatus PostHandler::parse_type_body(const std::string &body,
 		std::string content_type = http_headers.at("content-type");
 		if (content_type.find("multipart/form-data") != std::string::npos)
 		{
-			std::cout << "Parsing as multipart/form-data" << std::endl;
+			LOG_DEBUG("Parsing as multipart/form-data");
 			status = parse_form_data(body, content_type, loc, expected_body_size);
 		}
 		else
@@ -142,7 +144,7 @@ RequestStatus PostHandler::parse_type_body(const std::string &body,
 	}
 	else
 	{
-		std::cout << "No Content-Type header found- saving to file" << std::endl;
+		LOG_DEBUG("No Content-Type header found- saving to file");
 		status = save_request_body("post_body_default.txt", body, loc);
 	}
 	return status;
@@ -155,8 +157,8 @@ RequestStatus PostHandler::handle_post_request_with_chunked(const std::map<std::
 	size_t	processed_pos;
 	size_t	crlf_pos;
 	RequestStatus status;
-	std::cout << "=== CHUNKED HANDLER CALLED ===" << std::endl;
-	std::cout << "Incoming data size: " << incoming_data.size() << std::endl;
+	LOG_DEBUG("=== CHUNKED HANDLER CALLED ===");
+	LOG_DEBUG("Incoming data size: " << incoming_data.size());
 	buffer_not_parser += incoming_data;
 	incoming_data.clear();
 	processed_pos = 0;
@@ -164,7 +166,7 @@ RequestStatus PostHandler::handle_post_request_with_chunked(const std::map<std::
 	{
 		if (chunk_size == 0)
 		{
-			crlf_pos = buffer_not_parser.find("\r\n", processed_pos);
+			crlf_pos = Scan::find(buffer_not_parser, "\r\n", 2, processed_pos);
 			if (crlf_pos == std::string::npos)
 				break ; // need more data
 			std::string size_str = buffer_not_parser.substr(processed_pos,
@@ -175,11 +177,12 @@ RequestStatus PostHandler::handle_post_request_with_chunked(const std::map<std::
 			{
 				if (parse_size(cfg, chunk_body_parser) == 0)
 				{
-					std::cout << "ERROR: POST body size is too large!" << std::endl;
+					LOG_WARN("POST body size is too large!");
 					remove_file_data(file_path);
 					return (PAYLOAD_TOO_LARGE);
 				}
 				status = parse_type_body(chunk_body_parser, http_headers, loc);
+				leftover_data = buffer_not_parser.substr(processed_pos);
 				buffer_not_parser.clear();
 				chunk_body_parser.clear();
 				if (status != POSTED_SUCCESSFULLY)
@@ -193,7 +196,7 @@ RequestStatus PostHandler::handle_post_request_with_chunked(const std::map<std::
 		std::string chunk_data = buffer_not_parser.substr(processed_pos, chunk_size);
 		if(total_received_size > parse_max_body_size(cfg->clientMaxBodySize))
 		{
-			std::cout << "ERROR: POST body size is too large!" << std::endl;
+			LOG_WARN("POST body size is too large!");
 			remove_file_data(file_path);
 			return (PAYLOAD_TOO_LARGE);
 		}
@@ -217,7 +220,7 @@ RequestStatus PostHandler::handle_post_request(const std::map<std::string,
 
 	if (is_cgi_request(loc, requested_path))
 	{
-		std::cout << "=== CGI POST REQUEST DETECTED ===" << std::endl;
+		LOG_DEBUG("=== CGI POST REQUEST DETECTED ===");
 		if (http_headers.find("transfer-encoding") != http_headers.end())
 		{
 			std::string transfer_encoding = http_headers.at("transfer-encoding");
@@ -230,7 +233,7 @@ RequestStatus PostHandler::handle_post_request(const std::map<std::string,
 			
 			if (transfer_encoding == "chunked")
 			{
-				std::cout << "CGI POST: Using chunked transfer encoding" << std::endl;
+				LOG_DEBUG("CGI POST: Using chunked transfer encoding");
 				return handle_cgi_chunked_post(incoming_data, cfg, http_headers);
 			}
 		}
@@ -244,7 +247,7 @@ RequestStatus PostHandler::handle_post_request(const std::map<std::string,
 				return status;
 			if (total_received_size > parse_max_body_size(cfg->clientMaxBodySize))
 			{
-				std::cout << "ERROR: CGI POST body size too large!" << std::endl;
+				LOG_WARN("CGI POST body size too large!");
 				std::string filename;
 				if(cgi_filename.empty())
 					filename = "cgi_post_data.txt";
@@ -256,20 +259,20 @@ RequestStatus PostHandler::handle_post_request(const std::map<std::string,
 			
 			if (total_received_size < expected_body_size)
 			{
-				std::cout << "CGI POST: Need more body data (" << total_received_size 
-						  << "/" << expected_body_size << " bytes)" << std::endl;
+				LOG_DEBUG("CGI POST: Need more body data (" << total_received_size 
+						  << "/" << expected_body_size << " bytes)");
 				return BODY_BEING_READ;
 			}
 			
-			std::cout << "CGI POST: Received complete body (" << total_received_size << " bytes)" << std::endl;
+			LOG_DEBUG("CGI POST: Received complete body (" << total_received_size << " bytes)");
 			return POSTED_SUCCESSFULLY;
 		}
-		std::cout << "CGI POST: No body expected" << std::endl;
+		LOG_DEBUG("CGI POST: No body expected");
 		return POSTED_SUCCESSFULLY;
 	}
 	if(loc->uploadStore.empty())
 	{
-		std::cout << "No upload store configured, skipping file save." << std::endl;
+		LOG_DEBUG("No upload store configured, skipping file save.");
 		return (BAD_REQUEST);
 	}
 	if (http_headers.find("transfer-encoding") != http_headers.end())
@@ -282,10 +285,10 @@ RequestStatus PostHandler::handle_post_request(const std::map<std::string,
 			transfer_encoding = transfer_encoding.substr(start, end - start
 					+ 1);
 		}
-		std::cout << "Found transfer-encoding: '" << transfer_encoding << "'" << std::endl;
+		LOG_DEBUG("Found transfer-encoding: '" << transfer_encoding << "'");
 		if (transfer_encoding == "chunked")
 		{
-			std::cout << "Using chunked transfer encoding!" << std::endl;
+			LOG_DEBUG("Using chunked transfer encoding!");
 			return (handle_post_request_with_chunked(http_headers,
 					incoming_data, cfg, loc));
 		}
@@ -299,18 +302,24 @@ RequestStatus PostHandler::handle_post_request(const std::map<std::string,
 			return status;
 		if (total_received_size > parse_max_body_size(cfg->clientMaxBodySize))
 		{
-			std::cout << "ERROR: POST body size is too large!" << std::endl;
+			LOG_WARN("POST body size is too large!");
 			remove_file_data(file_path);
 			return (PAYLOAD_TOO_LARGE);
 		}
 		if (total_received_size < expected_body_size)
 		{
-			std::cout << "⏳ WAITING FOR MORE POST BODY DATA..." << std::endl;
+			LOG_DEBUG("⏳ WAITING FOR MORE POST BODY DATA...");
 			return (BODY_BEING_READ);
 		}
 	}
-	std::cout << "Total received size: " << total_received_size << std::endl;
-	std::cout << "Expected body size: " << expected_body_size << std::endl;
+	else if (total_received_size < expected_body_size)
+	{
+		// Headers came alone (e.g. client waiting on "Expect: 100-continue")
+		LOG_DEBUG("⏳ WAITING FOR POST BODY DATA...");
+		return (BODY_BEING_READ);
+	}
+	LOG_DEBUG("Total received size: " << total_received_size);
+	LOG_DEBUG("Expected body size: " << expected_body_size);
 	return (POSTED_SUCCESSFULLY);
 }
 
@@ -318,8 +327,8 @@ RequestStatus PostHandler::handle_post_request(const std::map<std::string,
 RequestStatus PostHandler::handle_cgi_chunked_post(std::string &incoming_data,
 	const ServerContext *cfg, const std::map<std::string, std::string> &http_headers)
 {
-	std::cout << "=== CGI CHUNKED POST HANDLER ===" << std::endl;
-	std::cout << "Incoming data size: " << incoming_data.size() << std::endl;
+	LOG_DEBUG("=== CGI CHUNKED POST HANDLER ===");
+	LOG_DEBUG("Incoming data size: " << incoming_data.size());
 	
 	buffer_not_parser += incoming_data;
 	incoming_data.clear();
@@ -330,7 +339,7 @@ RequestStatus PostHandler::handle_cgi_chunked_post(std::string &incoming_data,
 	{
 		if (chunk_size == 0)
 		{
-			size_t crlf_pos = buffer_not_parser.find("\r\n", processed_pos);
+			size_t crlf_pos = Scan::find(buffer_not_parser, "\r\n", 2, processed_pos);
 			if (crlf_pos == std::string::npos)
 				break;
 				
@@ -341,7 +350,8 @@ RequestStatus PostHandler::handle_cgi_chunked_post(std::string &incoming_data,
 			if (chunk_size == 0)
 			{
 				// End of chunks
-				std::cout << "CGI POST: Received complete chunked body (" << total_received_size << " bytes)" << std::endl;
+				LOG_DEBUG("CGI POST: Received complete chunked body (" << total_received_size << " bytes)");
+				leftover_data = buffer_not_parser.substr(processed_pos);
 				buffer_not_parser.clear();
 				return POSTED_SUCCESSFULLY;
 			}
@@ -356,7 +366,7 @@ RequestStatus PostHandler::handle_cgi_chunked_post(std::string &incoming_data,
 			return status;
 		if (total_received_size > parse_max_body_size(cfg->clientMaxBodySize))
 		{
-			std::cout << "ERROR: CGI POST chunked body size too large!" << std::endl;
+			LOG_WARN("CGI POST chunked body size too large!");
 			std::string filename;
 			if(cgi_filename.empty())
 				filename = "cgi_post_data.txt";
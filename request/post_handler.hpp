@@ -19,7 +19,7 @@ class PostHandler
 	size_t chunk_size;
 	std::string buffer_not_parser; 
 	std::string chunk_body_parser;
-	static size_t total_received_size;
+	size_t total_received_size;   // body bytes of this request seen so far
 	bool first_chunk;
 	bool file_name_found;
 	bool boundary_found;
@@ -34,10 +34,14 @@ class PostHandler
 	std::string cgi_body_buffer;
 	bool cgi_first_write;         
 	std::string cgi_filename;     
+	std::string leftover_data;    // bytes after the terminating chunk
   public:
 	PostHandler();
 	~PostHandler();
 
+	void reset();
+	std::string take_leftover_data();
+
 	RequestStatus handle_post_request(const std::map<std::string, std::string> &http_headers,
 		std::string &incoming_data, size_t expected_body_size, const ServerContext *cfg, const LocationContext *loc, const std::string &requested_path);
 	RequestStatus parse_type_body(const std::string &body,
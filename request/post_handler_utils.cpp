@@ -1,4 +1,5 @@
 #include "post_handler.hpp"
+#include "../utils/logger.hpp"
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
@@ -9,8 +10,6 @@
 #include <unistd.h>
 
 
-size_t PostHandler::total_received_size = 0;
-
 size_t PostHandler::parse_max_body_size(const std::string &size_str)
 {
 	char	unit;
@@ -46,12 +45,41 @@ PostHandler::PostHandler()
 	data_start = false;
 	cgi_first_write = true;
 	cgi_filename = "";
-	std::cout << "PostHandler initialized." << std::endl;
+	LOG_DEBUG("PostHandler initialized.");
+}
+
+void PostHandler::reset()
+{
+	chunk_buffer.clear();
+	chunk_size = 0;
+	buffer_not_parser.clear();
+	chunk_body_parser.clear();
+	total_received_size = 0;
+	first_chunk = true;
+	file_name_found = false;
+	boundary_found = false;
+	boundary.clear();
+	file_name.clear();
+	start_position = 0;
+	data_start = false;
+	file_path.clear();
+	cgi_body_buffer.clear();
+	cgi_first_write = true;
+	cgi_filename = "";
+	leftover_data.clear();
+}
+
+std::string PostHandler::take_leftover_data()
+{
+	std::string data;
+
+	data.swap(leftover_data);
+	return data;
 }
 
 PostHandler::~PostHandler()
 {
-	std::cout << "PostHandler destroyed." << std::endl;
+	LOG_DEBUG("PostHandler destroyed.");
 }
 
 RequestStatus PostHandler::save_request_body(const std::string &filename,
@@ -60,13 +88,13 @@ RequestStatus PostHandler::save_request_body(const std::string &filename,
 	DIR* dir = opendir(loc->uploadStore.c_str());
     if (!dir)
     {
-		std::cout << "Could not open upload directory: " << loc->uploadStore << std::endl;
+		LOG_DEBUG("Could not open upload directory: " << loc->uploadStore);
         return (NOT_FOUND);
     }
 	closedir(dir);
 	if (access(loc->uploadStore.c_str(), W_OK) != 0)
 	{
-		std::cout << "Upload directory is not writable: " << loc->uploadStore << std::endl;
+		LOG_DEBUG("Upload directory is not writable: " << loc->uploadStore);
 		return (FORBIDDEN);
 	}
 	std::string full_path;
@@ -84,16 +112,16 @@ RequestStatus PostHandler::save_request_body(const std::string &filename,
 	{
 		file.open(full_path.c_str(), std::ios::binary | std::ios::app);
 	}
-	std::cout << "Saving request body to: " << full_path << std::endl;
+	LOG_DEBUG("Saving request body to: " << full_path);
     if (!file.is_open())
     {
-		std::cout << "Could not open file for writing: " << full_path << std::endl;
+		LOG_DEBUG("Could not open file for writing: " << full_path);
         return (FORBIDDEN);
     }
     file.write(body.data(), body.size());
     file.close();
     
-    std::cout << "File saved: " << full_path << std::endl;
+    LOG_DEBUG("File saved: " << full_path);
 	return (POSTED_SUCCESSFULLY);
 }
 
@@ -106,7 +134,7 @@ std::string PostHandler::extract_boundary(const std::string &content_type)
 	pos = content_type.find("boundary=");
 	if (pos == std::string::npos)
 	{
-		std::cout << "Boundary not found in Content-Type header." << std::endl;
+		LOG_DEBUG("Boundary not found in Content-Type header.");
 		return "";
 	}
 	
@@ -150,7 +178,7 @@ std::string PostHandler::extract_boundary(const std::string &content_type)
 	}
 	
 	boundary_found = true;
-	std::cout << "Extracted boundary: '" << boundary_value << "'" << std::endl;
+	LOG_DEBUG("Extracted boundary: '" << boundary_value << "'");
 	return boundary_value;
 }
 std::string PostHandler::extract_filename(const std::string &body)
@@ -161,14 +189,14 @@ std::string PostHandler::extract_filename(const std::string &body)
 	pos = body.find("filename=\"");
 	if (pos == std::string::npos)
 	{
-		std::cout << "Filename not found in body, using default." << std::endl;
+		LOG_DEBUG("Filename not found in body, using default.");
 		return "post_body_default.txt";
 	}
 	pos += 10;
 	end_pos = body.find("\"", pos);
 	if (end_pos == std::string::npos)
 	{
-		std::cout << "ERROR: End quote for filename not found" << std::endl;
+		LOG_WARN("End quote for filename not found");
 		return "";
 	}
 	file_name_found = true;
@@ -179,9 +207,9 @@ int PostHandler::parse_size(const ServerContext *cfg, std::string &incoming_data
 		if (cfg->clientMaxBodySize != "0"
 		&& incoming_data.size() > parse_max_body_size(cfg->clientMaxBodySize))
 	{
-		std::cout << "ERROR: POST body size is too large!" << std::endl;
-		std::cout << "Received body size: " << incoming_data.size() << std::endl;
-		std::cout << "Max allowed body size: " << parse_max_body_size(cfg->clientMaxBodySize) << std::endl;
+		LOG_WARN("POST body size is too large!");
+		LOG_DEBUG("Received body size: " << incoming_data.size());
+		LOG_DEBUG("Max allowed body size: " << parse_max_body_size(cfg->clientMaxBodySize));
 		return  0;
 	}
 	return 1;;
@@ -199,7 +227,7 @@ std::string PostHandler::get_cgi_body() const
 	std::ifstream file(full_path.c_str(), std::ios::binary);
 	if (!file)
 	{
-		std::cout << "No CGI POST data file found at: " << full_path << std::endl;
+		LOG_DEBUG("No CGI POST data file found at: " << full_path);
 		return "";
 	}
 	
@@ -215,7 +243,7 @@ std::string PostHandler::get_cgi_body() const
 	}
 	
 	file.close();
-	std::cout << "Read " << content.size() << " bytes from CGI POST data file: " << full_path << std::endl;
+	LOG_DEBUG("Read " << content.size() << " bytes from CGI POST data file: " << full_path);
 	return content;
 }
 
@@ -229,7 +257,7 @@ void PostHandler::clear_cgi_body()
 	std::string full_path = "/tmp/" + filename;
 	if (remove(full_path.c_str()) == 0)
 	{
-		std::cout << "CGI POST data file cleared: " << full_path << std::endl;
+		LOG_DEBUG("CGI POST data file cleared: " << full_path);
 	}
 	cgi_filename = "";
 }
@@ -251,14 +279,14 @@ RequestStatus PostHandler::save_cgi_body(const std::string &data)
 	
 	if (!file.is_open())
 	{
-		std::cout << "ERROR: Could not open CGI data file: " << full_path << std::endl;
+		LOG_ERROR("Could not open CGI data file: " << full_path);
 		return FORBIDDEN;
 	}
 	
 	file.write(data.data(), data.size());
 	file.close();
 	
-	std::cout << "CGI data saved: " << full_path << " (" << data.size() << " bytes)" << std::endl;
+	LOG_DEBUG("CGI data saved: " << full_path << " (" << data.size() << " bytes)");
 	return POSTED_SUCCESSFULLY;
 }
 
@@ -285,14 +313,14 @@ RequestStatus PostHandler::save_cgi_body_with_filename(const std::string &data,
 	
 	if (!file.is_open())
 	{
-		std::cout << "ERROR: Could not open CGI data file: " << full_path << std::endl;
+		LOG_ERROR("Could not open CGI data file: " << full_path);
 		return FORBIDDEN;
 	}
 	
 	file.write(data.data(), data.size());
 	file.close();
 	
-	std::cout << "CGI data saved: " << full_path << " (" << data.size() << " bytes)" << std::endl;
+	LOG_DEBUG("CGI data saved: " << full_path << " (" << data.size() << " bytes)");
 	return POSTED_SUCCESSFULLY;
 }
 
@@ -313,10 +341,10 @@ std::string PostHandler::get_cgi_filename_from_headers(const std::map<std::strin
 			filename = filename.substr(start);
 		}
 		
-		std::cout << "Found filename in headers: '" << filename << "'" << std::endl;
+		LOG_DEBUG("Found filename in headers: '" << filename << "'");
 		return filename;
 	}
-	std::cout << "No filename found in headers, using default" << std::endl;
+	LOG_DEBUG("No filename found in headers, using default");
 	return "cgi_post_data.txt";
 }
 
@@ -353,7 +381,7 @@ void PostHandler::remove_file_data(const std::string &full_path)
 	std::ofstream file(full_path.c_str(), std::ios::trunc);
 	if (!file)
 	{
-		std::cerr << "ERROR: Failed to clear file: " << full_path << std::endl;
+		LOG_ERROR("Failed to clear file: " << full_path);
 		return;
 	}
 	// file is now empty
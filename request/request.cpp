@@ -1,4 +1,5 @@
 #include "request.hpp"
+#include "../utils/logger.hpp"
 #include "get_handler.hpp"
 #include "post_handler.hpp"
 #include "delete_handler.hpp"
@@ -6,17 +7,49 @@
 #include <iostream>
 #include <cstdlib>
 #include <cctype>
+#include <cstring>
 #include "../utils/utils.hpp"
 
-Request::Request() : http_method(""), requested_path(""), http_version(""), got_all_headers(false), expected_body_size(0), request_body(""), config(0), location(0), get_handler(), post_handler(), delete_handler()
+Request::Request() : http_method(""), requested_path(""), http_version(""), got_all_headers(false), expected_body_size(0), body_bytes_we_have(0), chunked_body(false), request_body(""), config(0), location(0), get_handler(), post_handler(), delete_handler()
 {
-	std::cout << "Creating a new HTTP request parser with modular handlers" << std::endl;
+	LOG_DEBUG("Creating a new HTTP request parser with modular handlers");
 }
 
 Request::~Request()
 {
 }
 
+// Forget everything about the previous request so the same connection can
+// parse the next one (keep-alive)
+void Request::reset()
+{
+	http_method.clear();
+	requested_path.clear();
+	http_version.clear();
+	full_path.clear();
+	query_string.clear();
+	query_params.clear();
+	http_headers.clear();
+	incoming_data.clear();
+	parser.reset();
+	head.clear();
+	got_all_headers = false;
+	expected_body_size = 0;
+	body_bytes_we_have = 0;
+	chunked_body = false;
+	pipelined_data.clear();
+	request_body.clear();
+	config = 0;
+	location = 0;
+	post_handler.reset();
+}
+
+// Heap kept by the buffers a large request grew; reset() does not give it back
+size_t Request::retained_bytes() const
+{
+	return incoming_data.capacity() + head.capacity() + request_body.capacity() + pipelined_data.capacity();
+}
+
 std::string remove_spaces_and_lower(const std::string &str)
 {
 
@@ -33,17 +66,31 @@ std::string remove_spaces_and_lower(const std::string &str)
 	return lower_str;
 }
 
+// HTTP/1.1 is persistent unless the client sends "Connection: close",
+// HTTP/1.0 only when it explicitly asks for "Connection: keep-alive"
+bool Request::wants_keep_alive() const
+{
+	std::string connection;
+	std::map<std::string, std::string>::const_iterator it = http_headers.find("connection");
+	if (it != http_headers.end())
+		connection = remove_spaces_and_lower(it->second);
+
+	if (http_version == "HTTP/1.0")
+		return connection.find("keep-alive") != std::string::npos;
+	return connection.find("close") == std::string::npos;
+}
+
 void Request::set_config(ServerContext &cfg)
 {
 	config = &cfg;
-	std::cout << " config is up \n";
+	LOG_DEBUG("config is up");
 	if (!requested_path.empty())
 	{
 		location = match_location(requested_path);
 		if (location)
-			std::cout << " location found: " << location->path << "\n";
+			LOG_DEBUG("location found: " << location->path);
 		else
-			std::cout << " location not found for path: " << requested_path << "\n";
+			LOG_DEBUG("location not found for path: " << requested_path);
 	}
 }
 
@@ -54,7 +101,7 @@ LocationContext *Request::match_location(const std::string &resquested_path)
 	LocationContext *matched_location = 0;
 	size_t longest_len = 0;
 
-	std::cout << "Matching path '" << resquested_path << "' against locations:" << std::endl;
+	LOG_DEBUG("Matching path '" << resquested_path << "' against locations:");
 	std::vector<LocationContext>::iterator it_location = config->locations.begin();
 	while (it_location != config->locations.end())
 	{
@@ -69,7 +116,7 @@ LocationContext *Request::match_location(const std::string &resquested_path)
 				(it_location->path[it_location->path.length() - 1] == '/') ||
 				resquested_path[it_location->path.length()] == '/')
 			{
-				std::cout << "matched location: " << it_location->path << std::endl;
+				LOG_DEBUG("matched location: " << it_location->path);
 				if (it_location->path.size() > longest_len)
 				{
 					matched_location = &(*it_location);
@@ -83,121 +130,139 @@ LocationContext *Request::match_location(const std::string &resquested_path)
 	return matched_location;
 }
 
+// Feed bytes read from the connection. Only the bytes that belong to this
+// request are kept: anything past the end of its headers (or of its body for
+// POST) is the start of a pipelined request and is kept aside for
+// take_pipelined_data().
 RequestStatus Request::add_new_data(const char *new_data, size_t data_size)
 {
-	std::cout << "=== GOT " << data_size << " NEW BYTES FROM CLIENT ===" << std::endl;
+	LOG_DEBUG("=== GOT " << data_size << " NEW BYTES FROM CLIENT ===");
 
-	incoming_data.append(new_data, data_size);
-	std::cout << "Total data we have now: " << incoming_data.size() << " bytes" << std::endl;
-
-	if (!got_all_headers)
+	if (got_all_headers)
 	{
-		size_t headers_end_position = incoming_data.find("\r\n\r\n");
-		if (headers_end_position == std::string::npos)
+		size_t body_part = data_size;
+		if (http_method != "POST")
+			body_part = 0;
+		else if (!chunked_body)
 		{
-			if (!check_for_valid_http_start())
-			{
-				std::cout << "Invalid HTTP request format detected" << std::endl;
-				return BAD_REQUEST;
-			}
-			std::cout << "Headers are not complete yet - waiting for more data" << std::endl;
-			return NEED_MORE_DATA;
+			size_t missing = 0;
+			if (expected_body_size > body_bytes_we_have)
+				missing = expected_body_size - body_bytes_we_have;
+			if (body_part > missing)
+				body_part = missing;
 		}
+		incoming_data.append(new_data, body_part);
+		body_bytes_we_have += body_part;
+		pipelined_data.append(new_data + body_part, data_size - body_part);
+		LOG_DEBUG("Total data we have now: " << incoming_data.size() << " bytes");
+		return HEADERS_ARE_READY;
+	}
 
-		std::cout << "Found all headers! Now reading them..." << std::endl;
+	incoming_data.append(new_data, data_size);
+	LOG_DEBUG("Total data we have now: " << incoming_data.size() << " bytes");
 
-		std::string just_the_headers = incoming_data.substr(0, headers_end_position);
+	// The parser picks up where the previous read left it
+	HttpParser::Result parsed = parser.parse(incoming_data.data(), incoming_data.size());
+	if (parsed == HttpParser::PARSE_INCOMPLETE)
+	{
+		LOG_DEBUG("Headers are not complete yet - waiting for more data");
+		return NEED_MORE_DATA;
+	}
+	if (parsed == HttpParser::PARSE_ERROR)
+	{
+		LOG_DEBUG("Invalid HTTP request format detected");
+		return BAD_REQUEST;
+	}
 
-		if (!parse_http_headers(just_the_headers))
-		{
-			std::cout << "Something went wrong reading the headers!" << std::endl;
-			return BAD_REQUEST;
-		}
+	LOG_DEBUG("Found all headers! Now reading them...");
 
-		got_all_headers = true;
+	// The head stays in its own buffer for the parser's slices; only the
+	// bytes after it are moved
+	size_t head_length = parser.head_length();
+	head.swap(incoming_data);
+	incoming_data.assign(head, head_length, std::string::npos);
+	head.erase(head_length);
 
-		incoming_data = incoming_data.substr(headers_end_position + 4);
+	if (!read_request_head())
+	{
+		LOG_DEBUG("Something went wrong reading the headers!");
+		return BAD_REQUEST;
+	}
 
-		std::cout << "Successfully read all headers!" << std::endl;
-		std::cout << "HTTP Method: " << http_method << ", Requested Path: "
-				  << requested_path << ", Version: " << http_version << std::endl;
+	got_all_headers = true;
 
-		if (http_method == "POST")
-		{
-			std::map<std::string, std::string>::iterator it_content_len = http_headers.find("content-length");
-			std::map<std::string, std::string>::iterator it_transfer_enc = http_headers.find("transfer-encoding");
-			if (it_content_len != http_headers.end())
-			{
-				expected_body_size = std::atoi(it_content_len->second.c_str());
-				std::cout << "This request should have a body with " << expected_body_size << " bytes" << std::endl;
-			}
-			else if (it_transfer_enc != http_headers.end() &&
-					 it_transfer_enc->second.find("chunked") != std::string::npos)
-			{
-				expected_body_size = 0;
-				std::cout << "Using chunked transfer encoding - size unknown" << std::endl;
-			}
-			else
-			{
-				std::cout << "Missing Content-Length header and no chunked encoding" << std::endl;
-				return LENGTH_REQUIRED;
-			}
-		}
+	LOG_DEBUG("Successfully read all headers!");
+	LOG_DEBUG("HTTP Method: " << http_method << ", Requested Path: "
+			  << requested_path << ", Version: " << http_version);
 
+	if (http_method != "POST")
+	{
+		pipelined_data = incoming_data;
+		incoming_data.clear();
 		return HEADERS_ARE_READY;
 	}
 
-	return HEADERS_ARE_READY;
-}
-bool Request::check_for_valid_http_start()
-{
-	size_t first_line_end = incoming_data.find("\r\n");
-	if (first_line_end == std::string::npos)
-		return false;
-
-	std::string first_line = incoming_data.substr(0, first_line_end);
-	std::stringstream line_stream(first_line);
-	std::string method, path, version;
-
-	if (!(line_stream >> method >> path >> version))
+	std::map<std::string, std::string>::iterator it_content_len = http_headers.find("content-length");
+	std::map<std::string, std::string>::iterator it_transfer_enc = http_headers.find("transfer-encoding");
+	if (it_content_len != http_headers.end())
 	{
-		std::cout << "error from stream \n";
-		return false;
+		expected_body_size = std::atoi(it_content_len->second.c_str());
+		LOG_DEBUG("This request should have a body with " << expected_body_size << " bytes");
+		if (incoming_data.size() > expected_body_size)
+		{
+			pipelined_data = incoming_data.substr(expected_body_size);
+			incoming_data.erase(expected_body_size);
+		}
 	}
-	if (version != "HTTP/1.1" && version != "HTTP/1.0")
-		return false;
-	if (path[0] != '/')
-		return false;
-	if (method != "GET" && method != "POST" && method != "DELETE")
-		return false;
+	else if (it_transfer_enc != http_headers.end() &&
+			 it_transfer_enc->second.find("chunked") != std::string::npos)
+	{
+		expected_body_size = 0;
+		chunked_body = true;
+		LOG_DEBUG("Using chunked transfer encoding - size unknown");
+	}
+	else
+	{
+		LOG_DEBUG("Missing Content-Length header and no chunked encoding");
+		return LENGTH_REQUIRED;
+	}
+	body_bytes_we_have = incoming_data.size();
 
-	return true;
+	return HEADERS_ARE_READY;
 }
 
-bool Request::parse_http_headers(const std::string &header_text)
+// Bytes received past the end of this request, i.e. the start of the next
+// pipelined request on the same connection
+std::string Request::take_pipelined_data()
 {
-	std::stringstream header_stream(header_text);
-	std::string current_line;
+	std::string next;
 
-	if (!std::getline(header_stream, current_line))
-		return false;
-	std::stringstream first_line_stream(current_line);
-	if (!(first_line_stream >> http_method >> requested_path >> http_version))
-		return false;
+	next.swap(pipelined_data);
+	next += post_handler.take_leftover_data();
+	return next;
+}
 
-	bool host_found = false;
+// Copy out of the parsed head what has to outlive it in decoded or
+// lower-cased form: the method, the decoded path and query, and the headers
+bool Request::read_request_head()
+{
+	http_method = HttpParser::text(head, parser.method());
+	http_version = HttpParser::text(head, parser.version());
 
-	size_t query_pos = requested_path.find('?');
-	if (query_pos != std::string::npos)
+	const Slice &target = parser.target();
+	const char *target_start = head.data() + target.offset;
+	const char *query = static_cast<const char *>(std::memchr(target_start, '?', target.length));
+	if (query)
 	{
-		query_string = requested_path.substr(query_pos + 1);
-		requested_path = requested_path.substr(0, query_pos);
+		query_string.assign(query + 1, target_start + target.length);
+		requested_path.assign(target_start, query);
 		query_params = parse_query_string(query_string);
 	}
 	else
 	{
 		query_string = "";
 		query_params.clear();
+		requested_path.assign(target_start, target.length);
 	}
 
 	requested_path = url_decode(requested_path);
@@ -209,26 +274,15 @@ bool Request::parse_http_headers(const std::string &header_text)
 		requested_path = "/";
 	else if (requested_path[0] != '/')
 		requested_path = "/" + requested_path;
-	while (std::getline(header_stream, current_line))
-	{
 
-		size_t colon_position = current_line.find(':');
-		if (colon_position == std::string::npos)
-		{
-			std::cout << "now key value in header: '" << current_line << "'" << std::endl;
-			return false;
-		}
-
-		if (colon_position > 0 && (current_line[colon_position - 1] == ' ' || current_line[colon_position - 1] == '\t'))
-		{
-			std::cout << "Invalid header (whitespace before colon): '" << std::endl;
-			return false;
-		}
-		std::string header_name = current_line.substr(0, colon_position);
-		std::string header_value = current_line.substr(colon_position + 1);
-
-		std::string lower_name = remove_spaces_and_lower(header_name);
-		http_headers[lower_name] = header_value;
+	bool host_found = false;
+	const std::vector<HeaderSlice> &fields = parser.headers();
+	for (size_t i = 0; i < fields.size(); ++i)
+	{
+		std::string lower_name = HttpParser::text(head, fields[i].name);
+		for (size_t j = 0; j < lower_name.size(); ++j)
+			lower_name[j] = tolower(lower_name[j]);
+		http_headers[lower_name] = HttpParser::text(head, fields[i].value);
 		if (lower_name == "host")
 			host_found = true;
 	}
@@ -242,13 +296,13 @@ RequestStatus Request::figure_out_http_method()
 {
 	if (location && !location->returnDirective.empty())
 	{
-		std::cout << "Found return directive: " << location->returnDirective << std::endl;
+		LOG_DEBUG("Found return directive: " << location->returnDirective);
 		return EVERYTHING_IS_OK;
 	}
 
 	if (!location || location->root.empty())
 	{
-		std::cout << " location not found \n";
+		LOG_DEBUG("location not found");
 		return NOT_FOUND;
 	}
 
@@ -277,7 +331,7 @@ RequestStatus Request::figure_out_http_method()
 				std::string file_ext = requested_path.substr(requested_path.size() - ext.size());
 				if (file_ext == ext)
 				{
-					std::cout<<"its a cgi request..\n";
+					LOG_DEBUG("its a cgi request");
 					if (http_method == "POST")
 					{
 						return post_handler.handle_post_request(http_headers, incoming_data, expected_body_size, config, location, requested_path);
@@ -5,6 +5,7 @@
 #include "../config/parser.hpp"
 # include <map>
 # include "request_status.hpp"
+# include "http_parser.hpp"
 # include "get_handler.hpp"
 # include "post_handler.hpp"
 # include "delete_handler.hpp"
@@ -22,9 +23,13 @@ class Request
   
 
   std::string incoming_data;      
+  HttpParser parser;
+  std::string head;               // request line and headers, which parser's slices point into
   bool got_all_headers;          
   size_t expected_body_size;
   size_t body_bytes_we_have;
+  bool chunked_body;
+  std::string pipelined_data;     // bytes past the end of this request
   std::string request_body;       
   ServerContext* config;
   LocationContext* location;
@@ -35,7 +40,7 @@ class Request
   DeleteHandler delete_handler;       
 
 LocationContext* match_location(const std::string& resquested_path);
-bool check_for_valid_http_start();
+bool read_request_head();
 
   public:
 
@@ -52,20 +57,23 @@ bool check_for_valid_http_start();
 	const std::map<std::string, std::string>& get_all_headers() const { return http_headers; }
 	const std::string& get_request_body() const { return request_body; }
 	LocationContext* get_location() const { return location; }
+	bool headers_complete() const { return got_all_headers; }
 
 
     void set_config(ServerContext& cfg);
 
+	void reset();
+	size_t retained_bytes() const;
+	bool wants_keep_alive() const;
+
 	RequestStatus add_new_data(const char *new_data, size_t data_size);
+	std::string take_pipelined_data();
 	RequestStatus figure_out_http_method();
 	bool is_cgi_request() const;
 	
 	std::string get_cgi_post_body() const;
 	
 
-	bool parse_http_headers(const std::string& header_text);
-	
-	bool handle_request(int client_fd, const char *request_data);
 };
 
 #endif
\ No newline at end of file
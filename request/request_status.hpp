@@ -22,7 +22,8 @@ enum RequestStatus {
 	URI_TOO_LONG = 414,         // 414 - Request-URI too long
 	HEADER_TOO_LARGE = 431,     // 431 - Request header fields too large
 	INTERNAL_ERROR = 500,       // 500 
-	NOT_IMPLEMENTED = 501       // 501 - Method not supported
+	NOT_IMPLEMENTED = 501,      // 501 - Method not supported
+	SERVICE_UNAVAILABLE = 503   // 503 - Over max_cgi_processes
 };
 
 #endif 
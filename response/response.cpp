@@ -1,4 +1,5 @@
 #include "response.hpp"
+#include "../utils/logger.hpp"
 #include "../utils/utils.hpp"
 #include <sstream>
 #include <iostream>
@@ -12,27 +13,48 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 
-Response::Response() : status_code(200), content("Welcome to My Web Server!"), file_stream(NULL), is_streaming_file(false), server_config(NULL)
+Response::Response() : status_code(200), content("Welcome to My Web Server!"), server_config(NULL), keep_alive(false), keepalive_timeout(0)
 {
 
 	set_header("Content-Type", "text/html");
-	set_header("Connection", "close");
+}
+
+// Bring the response back to its freshly constructed state so the next
+// request on a keep-alive connection starts clean
+void Response::reset()
+{
+	current_file_path.clear();
+	status_code = 200;
+	content = "Welcome to My Web Server!";
+	headers.clear();
+	set_header("Content-Type", "text/html");
+	server_config = NULL;
+	keep_alive = false;
+	keepalive_timeout = 0;
+}
+
+void Response::set_keep_alive(bool enabled, int timeout_seconds)
+{
+	keep_alive = enabled;
+	keepalive_timeout = timeout_seconds;
+}
+
+std::string Response::connection_headers() const
+{
+	if (!keep_alive)
+		return "Connection: close\r\n";
+
+	std::stringstream line;
+	line << "Connection: keep-alive\r\n";
+	line << "Keep-Alive: timeout=" << keepalive_timeout << "\r\n";
+	return line.str();
 }
 
 
 Response::~Response()
 {
-	if (file_stream)
-	{
-		std::cout << "Cleaning up file stream in destructor" << std::endl;
-		if (file_stream->is_open())
-		{
-			file_stream->close();
-		}
-		delete file_stream;
-		file_stream = NULL;
-	}
 }
 
 void Response::set_code(int code)
@@ -122,13 +144,17 @@ void Response::set_error_response(RequestStatus status)
 		set_code(413);
 		set_content("<html><body><h1>413 Payload Too Large</h1><p>The request entity is too large.</p></body></html>");
 		break;
+	case SERVICE_UNAVAILABLE:
+		set_code(503);
+		set_content("<html><body><h1>503 Service Unavailable</h1><p>The server is overloaded, please retry shortly.</p></body></html>");
+		set_header("Retry-After", "1");
+		break;
 	default:
 		set_code(500);
 		set_content("<html><body><h1>500 Internal Server Error</h1><p>An unexpected error occurred.</p></body></html>");
 		break;
 	}
 	set_header("Content-Type", "text/html");
-	set_header("Connection", "close");
 }
 
 bool Response::handle_return_directive(const std::string &return_dir)
@@ -173,6 +199,8 @@ std::string Response::what_reason(int code)
 		return "Payload Too Large";
 	case 500:
 		return "Internal Server Error";
+	case 503:
+		return "Service Unavailable";
 	default:
 		return "Unknown Status Code";
 	}
@@ -193,111 +221,48 @@ void Response::check_file(const std::string &file_path)
 		set_code(403);
 		set_content("<html><body><h1>403 Forbidden</h1><p>Access to this file is forbidden.</p></body></html>");
 		set_header("Content-Type", "text/html");
-		std::cout << "File exists but cannot be opened (403 Forbidden)" << std::endl;
+		LOG_DEBUG("File exists but cannot be opened (403 Forbidden)");
 	}
 }
 
-void Response::start_file_streaming(int client_fd)
+// Append the response headers to `out` and queue the file itself as a
+// range, sent with sendfile() as the socket drains. Returns false (without
+// writing anything) if the file cannot be served.
+bool Response::queue_file(OutboundQueue &out)
 {
-	struct stat file_stat;
-	if (stat(current_file_path.c_str(), &file_stat) != 0)
+	int fd = open(current_file_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
 	{
-		std::cout << "Error: Cannot stat file" << std::endl;
-		set_code(500);
-		return;
-	}
-
-	std::cout << "File size: " << file_stat.st_size << " bytes" << std::endl;
-
-	std::stringstream response;
-	response << "HTTP/1.0 200 OK\r\n";
-	response << "Content-Type: " << mine_type.get_mime_type(current_file_path) << "\r\n";
-	response << "Content-Length: " << file_stat.st_size << "\r\n";
-	response << "Connection: close\r\n\r\n";
-
-	std::string headers = response.str();
-	std::cout << "Sending headers " << std::endl;
-	ssize_t bytes_sent = send(client_fd, headers.c_str(), headers.length(), 0);
-	if (bytes_sent == -1) {
-		std::cout << "Failed to send headers to client " << client_fd << std::endl;
-		set_code(500);
+		LOG_ERROR("Cannot open file: " << current_file_path);
 		current_file_path.clear();
-		is_streaming_file = false;
-		return;
-	}
-
-	file_stream = new std::ifstream(current_file_path.c_str(), std::ios::binary);
-	if (!file_stream->is_open())
-	{
-		std::cout << "ERROR: Cannot open file for streaming: " << current_file_path << std::endl;
-		delete file_stream;
-		file_stream = NULL;
-		set_code(500);
-		current_file_path.clear(); 
-		is_streaming_file = false;  
-		return;
+		return false;
 	}
 
-	std::cout << "File opened successfully for streaming. Stream good: " << file_stream->good() << std::endl;
-	is_streaming_file = true;
-}
-
-void Response::continue_file_streaming(int client_fd)
-{
-	if (!file_stream || !file_stream->is_open())
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0)
 	{
-		std::cout << "ERROR: File stream is not open - finishing streaming" << std::endl;
-		finish_file_streaming();
-		return;
+		LOG_ERROR("Error: Cannot stat file");
+		close(fd);
+		current_file_path.clear();
+		return false;
 	}
 
-	std::cout << "Reading from file stream" << std::endl;
-	file_stream->read(file_buffer, sizeof(file_buffer));
-	std::streamsize bytes_read = file_stream->gcount();
+	LOG_DEBUG("File size: " << file_stat.st_size << " bytes");
 
-	std::cout << "Read " << bytes_read << " bytes from file" << std::endl;
-
-	if (bytes_read > 0)
-	{
-		ssize_t bytes_sent = send(client_fd, file_buffer, bytes_read, 0);
-		if (bytes_sent == -1)
-		{
-			std::cout << "Failed to send file data to client " << client_fd << " (errno: " << errno << ")" << std::endl;
-			finish_file_streaming();
-			return;
-		}
-		std::cout << "Sent " << bytes_sent << " bytes to client" << std::endl;
-
-		if (file_stream->eof())
-		{
-			std::cout << "File streaming completed " << std::endl;
-			finish_file_streaming();
-		}
-	}
-	else
-	{
-		finish_file_streaming();
-	}
-}
-void Response::finish_file_streaming()
-{
-	std::cout << "Finishing file streaming and cleaning up resources" << std::endl;
-	if (file_stream)
-	{
-		if (file_stream->is_open())
-		{
-			file_stream->close();
-		}
-		delete file_stream;
-		file_stream = NULL;
-	}
-	is_streaming_file = false;
+	std::stringstream response;
+	response << "HTTP/1.1 200 OK\r\n";
+	response << "Content-Type: " << MimeTypes::get_mime_type(current_file_path) << "\r\n";
+	response << "Content-Length: " << file_stat.st_size << "\r\n";
+	response << connection_headers() << "\r\n";
+	out.append(response.str());
+	out.append_file(fd, 0, static_cast<size_t>(file_stat.st_size));
 	current_file_path.clear();
+	return true;
 }
 
-bool Response::is_still_streaming() const
+bool Response::keeps_alive() const
 {
-	return is_streaming_file;
+	return keep_alive;
 }
 
 std::string Response::list_dir(const std::string &path, const std::string &request_path)
@@ -342,14 +307,14 @@ void Response::handle_directory_listing(const std::string &file_path, const std:
 {
 	if (location_config && location_config->autoindex == "on")
 	{
-		std::cout << "Generating directory listing" << std::endl;
+		LOG_DEBUG("Generating directory listing");
 		std::string dir_listing = list_dir(file_path, path);
 		set_content(dir_listing);
 		set_header("Content-Type", "text/html");
 	}
 	else
 	{
-		std::cout << "Directory access forbidden" << std::endl;
+		LOG_DEBUG("Directory access forbidden");
 		set_code(403);
 		set_content("<html><body><h1>403 Forbidden</h1><p>Directory access is forbidden.</p></body></html>");
 		set_header("Content-Type", "text/html");
@@ -365,7 +330,7 @@ void Response::analyze_request_and_set_response(const std::string &path, Locatio
 	}
 	
 	std::string file_path = resolve_file_path(path, location_config);
-	std::cout << "=== ANALYZING REQUEST PATH: " << file_path << " ===" << std::endl;
+	LOG_DEBUG("=== ANALYZING REQUEST PATH: " << file_path << " ===");
 	struct stat s;
 	if (stat(file_path.c_str(), &s) == 0)
 	{
@@ -388,7 +353,7 @@ void Response::analyze_request_and_set_response(const std::string &path, Locatio
 
 					if (index_file.is_open())
 					{
-						std::cout << "Found index file: " << *index_it << std::endl;
+						LOG_DEBUG("Found index file: " << *index_it);
 						index_file.close();
 						current_file_path = index_path;
 						set_code(200);
@@ -411,52 +376,45 @@ void Response::analyze_request_and_set_response(const std::string &path, Locatio
 		set_code(404);
 		set_content("<html><body><h1>404 Not Found</h1><p>The requested file was not found.</p></body></html>");
 		set_header("Content-Type", "text/html");
-		std::cout << "Path does not exist - returning 404 Not Found" << std::endl;
+		LOG_DEBUG("Path does not exist - returning 404 Not Found");
 	}
 }
 
-void Response::handle_response(int client_fd)
+// Serialize the response into `out`. A file body is queued as a file
+// range rather than read into memory.
+void Response::handle_response(OutboundQueue &out)
 {
-	std::cout << "-----------------RESPONSE---------------------" << std::endl;
+	LOG_DEBUG("-----------------RESPONSE---------------------");
 	if (status_code == 200 && !current_file_path.empty())
 	{
-		if (!is_streaming_file)
-		{
-			std::cout << "Starting file streaming for: " << current_file_path << std::endl;
-			start_file_streaming(client_fd);
-		}
-		else
-		{
-			std::cout << "Continuing file streaming..." << std::endl;
-			continue_file_streaming(client_fd);
-		}
+		LOG_DEBUG("Queueing file: " << current_file_path);
+		if (queue_file(out))
+			return;
+		set_error_response(INTERNAL_ERROR);
+		keep_alive = false;
 	}
-	else
-	{
-		std::stringstream status_stream;
-		status_stream << status_code;
-		std::string code_str = status_stream.str();
-		std::string reason_phrase = what_reason(status_code);
-		std::string status_line = "HTTP/1.0 " + code_str + " " + reason_phrase + "\r\n";
-		std::string headers_line;
-
-		std::map<std::string, std::string>::iterator ite = headers.begin();
-		while (ite != headers.end())
-		{
-			headers_line += ite->first + ": " + ite->second + "\r\n";
-			ite++;
-		}
-
-		std::stringstream content_length;
-		content_length << content.length();
-		headers_line += "Content-Length: " + content_length.str() + "\r\n";
-		headers_line += "\r\n";
 
-		std::string full_response = status_line + headers_line + content;
+	std::stringstream status_stream;
+	status_stream << status_code;
+	std::string code_str = status_stream.str();
+	std::string reason_phrase = what_reason(status_code);
+	std::string status_line = "HTTP/1.1 " + code_str + " " + reason_phrase + "\r\n";
+	std::string headers_line;
 
-		std::cout << "Sending response to client " << client_fd << std::endl;
-		ssize_t bytes_sent = send(client_fd, full_response.c_str(), full_response.length(), 0);
-		if (bytes_sent == -1 || bytes_sent == 0) 
-			std::cout << "Failed to send response to client " << client_fd << std::endl;
+	std::map<std::string, std::string>::iterator ite = headers.begin();
+	while (ite != headers.end())
+	{
+		headers_line += ite->first + ": " + ite->second + "\r\n";
+		ite++;
 	}
-}
\ No newline at end of file
+
+	std::stringstream content_length;
+	content_length << content.length();
+	headers_line += "Content-Length: " + content_length.str() + "\r\n";
+	headers_line += connection_headers();
+	headers_line += "\r\n";
+
+	out.append(status_line);
+	out.append(headers_line);
+	out.append(content);
+}
@@ -10,6 +10,7 @@
 #include "../config/parser.hpp"
 #include "../request/request_status.hpp"
 #include "../utils/mime_types.hpp"
+#include "../utils/outbound_queue.hpp"
 
 class Client;
 class Response
@@ -18,18 +19,20 @@ private:
 	int status_code;
 	std::string content;
 	std::map<std::string, std::string> headers;
-	MimeTypes mine_type;
 	std::string current_file_path;
-	std::ifstream *file_stream;
-	bool is_streaming_file;
-	char file_buffer[9000];
 	const ServerContext* server_config; 
+	bool keep_alive;
+	int keepalive_timeout;
+
+	std::string connection_headers() const;
 
 public:
 	Response();
 	~Response();
 
 	void set_server_config(const ServerContext* config); 
+	void set_keep_alive(bool enabled, int timeout_seconds);
+	void reset();
 
 	void set_code(int code);
 	void set_content(const std::string &body_content);
@@ -41,15 +44,13 @@ public:
 
 	void analyze_request_and_set_response(const std::string &path,LocationContext *location_config);
 	void check_file(const std::string &file_path);
-	void start_file_streaming(int client_fd);
-	void finish_file_streaming();
-	void continue_file_streaming(int client_fd);
-	bool is_still_streaming() const;
+	bool queue_file(OutboundQueue &out);
+	bool keeps_alive() const;
 	std::string list_dir(const std::string &path, const std::string &request_path);
 
 	std::string what_reason(int code);
 
-	void handle_response(int client_fd);
+	void handle_response(OutboundQueue &out);
 };
 
 #endif
\ No newline at end of file
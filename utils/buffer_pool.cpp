@@ -0,0 +1,121 @@
+#include "buffer_pool.hpp"
+#include "logger.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+BufferPool::BufferPool(size_t slab_size, size_t max_free) : slab_size(slab_size), max_free(max_free)
+{
+	std::memset(&stats, 0, sizeof(stats));
+}
+
+BufferPool::~BufferPool()
+{
+	for (size_t i = 0; i < free_list.size(); ++i)
+		destroy(free_list[i]);
+	free_list.clear();
+}
+
+Buffer *BufferPool::allocate(size_t capacity)
+{
+	Buffer *buffer = new Buffer;
+	buffer->data = static_cast<char *>(std::malloc(capacity));
+	if (!buffer->data)
+	{
+		delete buffer;
+		return NULL;
+	}
+	buffer->capacity = capacity;
+	buffer->size = 0;
+	stats.slabs_allocated++;
+	return buffer;
+}
+
+void BufferPool::destroy(Buffer *buffer)
+{
+	std::free(buffer->data);
+	delete buffer;
+	stats.slabs_allocated--;
+}
+
+Buffer *BufferPool::acquire()
+{
+	Buffer *buffer;
+
+	stats.checkouts++;
+	if (!free_list.empty())
+	{
+		buffer = free_list.back();
+		free_list.pop_back();
+	}
+	else
+	{
+		stats.misses++;
+		buffer = allocate(slab_size);
+		if (!buffer)
+			return NULL;
+	}
+	buffer->size = 0;
+	stats.slabs_in_use++;
+	if (stats.slabs_in_use > stats.peak_in_use)
+		stats.peak_in_use = stats.slabs_in_use;
+	return buffer;
+}
+
+void BufferPool::release(Buffer *buffer)
+{
+	if (!buffer)
+		return;
+	stats.slabs_in_use--;
+	if (buffer->capacity != slab_size || free_list.size() >= max_free)
+	{
+		destroy(buffer);
+		return;
+	}
+	buffer->size = 0;
+	free_list.push_back(buffer);
+}
+
+bool BufferPool::grow(Buffer *buffer, size_t min_capacity)
+{
+	size_t new_capacity = buffer->capacity;
+
+	if (min_capacity > MAX_SLAB_SIZE)
+		min_capacity = MAX_SLAB_SIZE;
+	while (new_capacity < min_capacity)
+		new_capacity *= 2;
+	if (new_capacity > MAX_SLAB_SIZE)
+		new_capacity = MAX_SLAB_SIZE;
+	if (new_capacity <= buffer->capacity)
+		return false;
+
+	char *data = static_cast<char *>(std::realloc(buffer->data, new_capacity));
+	if (!data)
+		return false;
+	buffer->data = data;
+	buffer->capacity = new_capacity;
+	stats.grows++;
+	return true;
+}
+
+size_t BufferPool::get_slab_size() const
+{
+	return slab_size;
+}
+
+const BufferPoolStats &BufferPool::get_stats() const
+{
+	return stats;
+}
+
+void BufferPool::print_stats() const
+{
+	LOG_INFO("[BUFFER POOL] slab=" << slab_size << "B"
+			  << " allocated=" << stats.slabs_allocated
+			  << " in_use=" << stats.slabs_in_use
+			  << " free=" << free_list.size()
+			  << " peak=" << stats.peak_in_use
+			  << " checkouts=" << stats.checkouts
+			  << " misses=" << stats.misses
+			  << " grows=" << stats.grows);
+}
@@ -0,0 +1,60 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <vector>
+
+// A pooled read slab. `size` is how many bytes of `data` are filled.
+struct Buffer
+{
+	char *data;
+	size_t capacity;
+	size_t size;
+};
+
+// Occupancy counters, used to size the pool
+struct BufferPoolStats
+{
+	size_t slabs_allocated;  // slabs currently owned by the pool (free + in use)
+	size_t slabs_in_use;     // slabs checked out by connections
+	size_t peak_in_use;      // high-water mark of slabs_in_use
+	size_t checkouts;        // total acquire() calls
+	size_t misses;           // acquire() calls that had to allocate a new slab
+	size_t grows;            // slabs grown past the default slab size
+};
+
+class BufferPool
+{
+  private:
+	size_t slab_size;
+	size_t max_free;
+	std::vector<Buffer *> free_list;
+	BufferPoolStats stats;
+
+	Buffer *allocate(size_t capacity);
+	void destroy(Buffer *buffer);
+
+	BufferPool(const BufferPool &);
+	BufferPool &operator=(const BufferPool &);
+
+  public:
+	static const size_t DEFAULT_SLAB_SIZE = 16 * 1024;
+	static const size_t MAX_SLAB_SIZE = 1024 * 1024;
+	static const size_t DEFAULT_MAX_FREE = 1024;
+
+	explicit BufferPool(size_t slab_size = DEFAULT_SLAB_SIZE, size_t max_free = DEFAULT_MAX_FREE);
+	~BufferPool();
+
+	// Check out an empty slab (reused from the free list when possible)
+	Buffer *acquire();
+	// Give a slab back; grown slabs are freed so the pool stays uniform
+	void release(Buffer *buffer);
+	// Grow a checked-out slab to at least min_capacity (capped at MAX_SLAB_SIZE)
+	bool grow(Buffer *buffer, size_t min_capacity);
+
+	size_t get_slab_size() const;
+	const BufferPoolStats &get_stats() const;
+	void print_stats() const;
+};
+
+#endif
@@ -0,0 +1,296 @@
+#include "logger.hpp"
+#include <pthread.h>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+
+namespace
+{
+	const size_t RING_SIZE = 1 << 16;
+	const long FLUSH_INTERVAL_MS = 50;
+
+	// Single-producer/single-consumer byte ring: the owning thread appends
+	// at head, the flusher consumes up to tail. Positions only grow.
+	struct LogRing
+	{
+		char data[RING_SIZE];
+		size_t head;
+		size_t tail;
+		size_t dropped;      // lines lost to a full ring since the last flush
+		LogRing *next;
+
+		LogRing() : head(0), tail(0), dropped(0), next(NULL) {}
+	};
+
+	const char *const level_names[] = {"debug", "info", "warn", "error"};
+
+	pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;  // ring list, flusher state
+	pthread_cond_t flush_wakeup = PTHREAD_COND_INITIALIZER;
+	pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;    // log_fd, swapped on reload
+	LogRing *rings = NULL;
+	__thread LogRing *thread_ring = NULL;
+	__thread long thread_id = 0;
+	int log_fd = STDERR_FILENO;
+	pid_t process_id = 0;
+	volatile bool running = false;
+	bool stopping = false;
+	bool fork_handlers_installed = false;
+	pthread_t flusher;
+
+	void write_all(const char *data, size_t size)
+	{
+		while (size > 0)
+		{
+			ssize_t written = ::write(log_fd, data, size);
+			if (written < 0 && errno == EINTR)
+				continue;
+			if (written <= 0)
+				return;
+			data += written;
+			size -= written;
+		}
+	}
+
+	// "2024/05/01 12:00:00 [info] 1234#5678: message"
+	std::string format_line(LogLevel level, const std::string &message)
+	{
+		char stamp[32];
+		time_t now = time(NULL);
+		struct tm local;
+
+		localtime_r(&now, &local);
+		strftime(stamp, sizeof(stamp), "%Y/%m/%d %H:%M:%S", &local);
+		std::ostringstream line;
+		if (process_id == 0)
+			process_id = getpid();
+		if (thread_id == 0)
+			thread_id = syscall(SYS_gettid);
+		line << stamp << " [" << level_names[level] << "] " << process_id << "#"
+			 << thread_id << ": " << message << '\n';
+		return line.str();
+	}
+
+	LogRing *register_ring()
+	{
+		thread_ring = new LogRing();
+		pthread_mutex_lock(&registry_lock);
+		thread_ring->next = rings;
+		rings = thread_ring;
+		pthread_mutex_unlock(&registry_lock);
+		return thread_ring;
+	}
+
+	// Move everything the rings hold into `batch`. Caller holds registry_lock.
+	void drain(std::string &batch)
+	{
+		for (LogRing *ring = rings; ring; ring = ring->next)
+		{
+			size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+			size_t tail = ring->tail;
+			while (tail != head)
+			{
+				size_t offset = tail % RING_SIZE;
+				size_t chunk = head - tail;
+				if (chunk > RING_SIZE - offset)
+					chunk = RING_SIZE - offset;
+				batch.append(ring->data + offset, chunk);
+				tail += chunk;
+			}
+			__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+			size_t dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+			if (dropped > 0)
+			{
+				std::ostringstream note;
+				note << dropped << " log lines dropped, the logging ring was full";
+				batch += format_line(LOG_LEVEL_WARN, note.str());
+			}
+		}
+	}
+
+	void *flush_loop(void *)
+	{
+		std::string batch;
+
+		pthread_mutex_lock(&registry_lock);
+		while (true)
+		{
+			bool last = stopping;
+			drain(batch);
+			pthread_mutex_unlock(&registry_lock);
+			if (!batch.empty())
+			{
+				pthread_mutex_lock(&output_lock);
+				write_all(batch.data(), batch.size());
+				pthread_mutex_unlock(&output_lock);
+				batch.clear();
+			}
+			if (last)
+				return NULL;
+			pthread_mutex_lock(&registry_lock);
+			if (!stopping)
+			{
+				struct timespec deadline;
+				clock_gettime(CLOCK_REALTIME, &deadline);
+				deadline.tv_nsec += FLUSH_INTERVAL_MS * 1000000;
+				if (deadline.tv_nsec >= 1000000000)
+				{
+					deadline.tv_sec++;
+					deadline.tv_nsec -= 1000000000;
+				}
+				pthread_cond_timedwait(&flush_wakeup, &registry_lock, &deadline);
+			}
+		}
+	}
+
+	// fork() only copies the calling thread: hold the lock across it so
+	// the child gets a consistent list, then let the child start over
+	// without a flusher. Lines the parent still has queued are its own.
+	void before_fork()
+	{
+		pthread_mutex_lock(&registry_lock);
+	}
+
+	void after_fork_parent()
+	{
+		pthread_mutex_unlock(&registry_lock);
+	}
+
+	void flush_at_exit()
+	{
+		Logger::stop();
+	}
+
+	void after_fork_child()
+	{
+		pthread_mutex_init(&registry_lock, NULL);
+		pthread_mutex_init(&output_lock, NULL);
+		pthread_cond_init(&flush_wakeup, NULL);
+		for (LogRing *ring = rings; ring; ring = ring->next)
+			ring->tail = ring->head;
+		running = false;
+		stopping = false;
+		process_id = getpid();
+		thread_id = 0;
+	}
+}
+
+int Logger::threshold = LOG_LEVEL_INFO;
+
+bool Logger::configure(const std::string &path, LogLevel level)
+{
+	int fd;
+
+	if (path == "stderr")
+		fd = STDERR_FILENO;
+	else if (path == "stdout")
+		fd = STDOUT_FILENO;
+	else
+	{
+		fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+		if (fd == -1)
+			return false;
+	}
+	pthread_mutex_lock(&output_lock);
+	if (log_fd > STDERR_FILENO && log_fd != fd)
+		close(log_fd);
+	log_fd = fd;
+	pthread_mutex_unlock(&output_lock);
+	threshold = level;
+	process_id = getpid();
+	return true;
+}
+
+void Logger::start()
+{
+	if (running)
+		return;
+	if (!fork_handlers_installed)
+	{
+		pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+		atexit(flush_at_exit);
+		fork_handlers_installed = true;
+	}
+	if (process_id == 0)
+		process_id = getpid();
+	stopping = false;
+	running = true;
+	// The flusher takes no signals: those the event loop reads from its
+	// signalfd must not be delivered to, and kill, this thread
+	sigset_t all_signals;
+	sigset_t previous;
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &previous);
+	if (pthread_create(&flusher, NULL, flush_loop, NULL) != 0)
+		running = false;
+	pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+void Logger::stop()
+{
+	if (!running)
+		return;
+	pthread_mutex_lock(&registry_lock);
+	stopping = true;
+	pthread_cond_signal(&flush_wakeup);
+	pthread_mutex_unlock(&registry_lock);
+	pthread_join(flusher, NULL);
+	running = false;
+
+	// Lines appended while the flusher was finishing
+	std::string batch;
+	pthread_mutex_lock(&registry_lock);
+	drain(batch);
+	pthread_mutex_unlock(&registry_lock);
+	write_all(batch.data(), batch.size());
+}
+
+// Append one line to the calling thread's ring. A full ring drops the line
+// (and counts it) rather than blocking the event loop.
+void Logger::write(LogLevel level, const std::string &message)
+{
+	std::string line = format_line(level, message);
+
+	if (!running)
+	{
+		write_all(line.data(), line.size());
+		return;
+	}
+	LogRing *ring = thread_ring ? thread_ring : register_ring();
+	size_t head = ring->head;
+	size_t used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (line.size() > RING_SIZE - used)
+	{
+		__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+		pthread_cond_signal(&flush_wakeup);
+		return;
+	}
+	for (size_t copied = 0; copied < line.size(); )
+	{
+		size_t offset = (head + copied) % RING_SIZE;
+		size_t chunk = line.size() - copied;
+		if (chunk > RING_SIZE - offset)
+			chunk = RING_SIZE - offset;
+		line.copy(ring->data + offset, chunk, copied);
+		copied += chunk;
+	}
+	__atomic_store_n(&ring->head, head + line.size(), __ATOMIC_RELEASE);
+	if (used + line.size() > RING_SIZE / 2)
+		pthread_cond_signal(&flush_wakeup);
+}
+
+bool Logger::parse_level(const std::string &name, LogLevel &level)
+{
+	for (int i = LOG_LEVEL_DEBUG; i <= LOG_LEVEL_ERROR; ++i)
+	{
+		if (name == level_names[i])
+		{
+			level = static_cast<LogLevel>(i);
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,61 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <sstream>
+#include <string>
+
+enum LogLevel
+{
+	LOG_LEVEL_DEBUG,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_WARN,
+	LOG_LEVEL_ERROR
+};
+
+// Process-wide logger. Each thread appends formatted lines to its own
+// lock-free ring; a background thread drains the rings and writes them out
+// in batches, so the request path never makes a syscall to log. Before
+// start() (and in forked children until they call it) lines are written
+// synchronously.
+class Logger
+{
+  public:
+	// error_log target ("stderr", "stdout" or a file opened for appending)
+	// and the lowest level that gets through
+	static bool configure(const std::string &path, LogLevel level);
+	static void start();
+	static void stop();     // flush everything and join the flusher
+
+	static bool enabled(LogLevel level) { return level >= threshold; }
+	static void write(LogLevel level, const std::string &message);
+	static bool parse_level(const std::string &name, LogLevel &level);
+
+  private:
+	static int threshold;
+
+	Logger();
+};
+
+// Messages are stream expressions: LOG_INFO("port " << port). The
+// expression is only evaluated when the level is enabled; LOG_DEBUG
+// compiles to nothing unless the build defines DEBUG (`make debug`).
+#define LOG_AT(level, expr) \
+	do { \
+		if (Logger::enabled(level)) \
+		{ \
+			std::ostringstream log_line_; \
+			log_line_ << expr; \
+			Logger::write(level, log_line_.str()); \
+		} \
+	} while (0)
+
+#ifdef DEBUG
+# define LOG_DEBUG(expr) LOG_AT(LOG_LEVEL_DEBUG, expr)
+#else
+# define LOG_DEBUG(expr) do { } while (0)
+#endif
+#define LOG_INFO(expr) LOG_AT(LOG_LEVEL_INFO, expr)
+#define LOG_WARN(expr) LOG_AT(LOG_LEVEL_WARN, expr)
+#define LOG_ERROR(expr) LOG_AT(LOG_LEVEL_ERROR, expr)
+
+#endif
@@ -1,34 +1,40 @@
 #include "mime_types.hpp"
 #include <algorithm>
 #include <cctype>
+#include <cstring>
 
-MimeTypes::MimeTypes() 
+struct MimeEntry
 {
-        mime_map[".html"] = "text/html";
-    mime_map[".htm"] = "text/html";
-    mime_map[".css"] = "text/css";
-    mime_map[".js"] = "application/javascript";
-    mime_map[".json"] = "application/json";
-    mime_map[".xml"] = "application/xml";
-    mime_map[".txt"] = "text/plain";
-    mime_map[".jpg"] = "image/jpeg";
-    mime_map[".jpeg"] = "image/jpeg";
-    mime_map[".png"] = "image/png";
-    mime_map[".gif"] = "image/gif";
-    mime_map[".bmp"] = "image/bmp";
-    mime_map[".ico"] = "image/x-icon";
-    mime_map[".svg"] = "image/svg+xml";
-    mime_map[".pdf"] = "application/pdf";
-    mime_map[".doc"] = "application/msword";
-    mime_map[".zip"] = "application/zip";
-    mime_map[".mp3"] = "audio/mpeg";
-    mime_map[".wav"] = "audio/wav";
-    mime_map[".mp4"] = "video/mp4";
-    mime_map[".avi"] = "video/x-msvideo";
-    mime_map[".woff"] = "font/woff";
-    mime_map[".woff2"] = "font/woff2";
-    mime_map[".ttf"] = "font/ttf";
-}
+    const char *extension;
+    const char *type;
+};
+
+static const MimeEntry mime_table[] = {
+    {".html", "text/html"},
+    {".htm", "text/html"},
+    {".css", "text/css"},
+    {".js", "application/javascript"},
+    {".json", "application/json"},
+    {".xml", "application/xml"},
+    {".txt", "text/plain"},
+    {".jpg", "image/jpeg"},
+    {".jpeg", "image/jpeg"},
+    {".png", "image/png"},
+    {".gif", "image/gif"},
+    {".bmp", "image/bmp"},
+    {".ico", "image/x-icon"},
+    {".svg", "image/svg+xml"},
+    {".pdf", "application/pdf"},
+    {".doc", "application/msword"},
+    {".zip", "application/zip"},
+    {".mp3", "audio/mpeg"},
+    {".wav", "audio/wav"},
+    {".mp4", "video/mp4"},
+    {".avi", "video/x-msvideo"},
+    {".woff", "font/woff"},
+    {".woff2", "font/woff2"},
+    {".ttf", "font/ttf"}
+};
 
 std::string MimeTypes::get_file_extension(const std::string &file_path)
 {
@@ -48,13 +54,15 @@ std::string MimeTypes::get_file_extension(const std::string &file_path)
     return extension;
 }
 
-std::string MimeTypes::get_mime_type(const std::string &file_path)
+const char *MimeTypes::get_mime_type(const std::string &file_path)
 {
     std::string extension = get_file_extension(file_path);
 
-    std::map<std::string, std::string>::iterator it = mime_map.find(extension);
-    if (it != mime_map.end())
-        return it->second;
+    for (size_t i = 0; i < sizeof(mime_table) / sizeof(mime_table[0]); ++i)
+    {
+        if (extension == mime_table[i].extension)
+            return mime_table[i].type;
+    }
 
     return "application/octet-stream";
 }
@@ -2,16 +2,16 @@
 #define MIME_TYPES_HPP
 
 #include <string>
-#include <map>
 
+// Extension -> Content-Type lookup in a static table shared by every
+// response, so building one costs no map of its own
 class MimeTypes
 {
-    std::map<std::string, std::string> mime_map;
+    MimeTypes();
 
 public:
-    MimeTypes();
-    std::string get_mime_type(const std::string& file_path);
-    std::string get_file_extension(const std::string& file_path);
+    static const char *get_mime_type(const std::string& file_path);
+    static std::string get_file_extension(const std::string& file_path);
 };
 
 #endif 
@@ -0,0 +1,133 @@
+#include "outbound_queue.hpp"
+#include <cerrno>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+OutboundQueue::OutboundQueue() : buffered(0), file_bytes(0)
+{
+}
+
+OutboundQueue::~OutboundQueue()
+{
+	clear();
+}
+
+void OutboundQueue::append(const std::string &data)
+{
+	append(data.data(), data.size());
+}
+
+void OutboundQueue::append(const char *data, size_t length)
+{
+	if (length == 0)
+		return;
+	if (segments.empty() || segments.back().fd >= 0
+		|| segments.back().data.size() + length > COALESCE_LIMIT)
+		segments.push_back(Segment());
+	Segment &last = segments.back();
+	last.data.append(data, length);
+	last.remaining += length;
+	buffered += length;
+}
+
+void OutboundQueue::append_file(int fd, off_t offset, size_t length)
+{
+	if (length == 0)
+	{
+		close(fd);
+		return;
+	}
+	segments.push_back(Segment());
+	Segment &last = segments.back();
+	last.fd = fd;
+	last.offset = offset;
+	last.remaining = length;
+	file_bytes += length;
+}
+
+void OutboundQueue::pop_front()
+{
+	if (segments.front().fd >= 0)
+		close(segments.front().fd);
+	segments.pop_front();
+}
+
+void OutboundQueue::clear()
+{
+	while (!segments.empty())
+		pop_front();
+	buffered = 0;
+	file_bytes = 0;
+}
+
+ssize_t OutboundQueue::write_to(int socket_fd, bool &socket_full)
+{
+	socket_full = false;
+	if (segments.empty())
+		return 0;
+	if (segments.front().fd >= 0)
+		return write_file(socket_fd, socket_full);
+	return write_memory(socket_fd, socket_full);
+}
+
+// Gather every memory segment up to the first file range into one writev.
+// MSG_NOSIGNAL is not available to writev; SIGPIPE is ignored process-wide.
+ssize_t OutboundQueue::write_memory(int socket_fd, bool &socket_full)
+{
+	struct iovec iov[MAX_IOVECS];
+	size_t count = 0;
+	size_t offered = 0;
+
+	for (std::deque<Segment>::iterator it = segments.begin();
+		 it != segments.end() && it->fd < 0 && count < MAX_IOVECS; ++it, ++count)
+	{
+		iov[count].iov_base = const_cast<char *>(it->data.data()) + it->offset;
+		iov[count].iov_len = it->remaining;
+		offered += it->remaining;
+	}
+	ssize_t written = writev(socket_fd, iov, static_cast<int>(count));
+	if (written <= 0)
+		return written;
+	socket_full = static_cast<size_t>(written) < offered;
+
+	size_t left = static_cast<size_t>(written);
+	buffered -= left;
+	while (left > 0)
+	{
+		Segment &front = segments.front();
+		if (left < front.remaining)
+		{
+			front.offset += left;
+			front.remaining -= left;
+			break;
+		}
+		left -= front.remaining;
+		pop_front();
+	}
+	return written;
+}
+
+ssize_t OutboundQueue::write_file(int socket_fd, bool &socket_full)
+{
+	Segment &front = segments.front();
+	size_t length = front.remaining < MAX_SENDFILE ? front.remaining : MAX_SENDFILE;
+	ssize_t written = sendfile(socket_fd, front.fd, &front.offset, length);
+
+	if (written < 0)
+		return written;
+	if (written == 0)
+	{
+		// The file shrank under us: the promised Content-Length cannot be
+		// met, so the connection has to end
+		errno = EPIPE;
+		return 0;
+	}
+	socket_full = static_cast<size_t>(written) < length;
+	front.remaining -= written;
+	file_bytes -= written;
+	if (front.remaining == 0)
+		pop_front();
+	return written;
+}
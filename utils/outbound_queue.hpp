@@ -0,0 +1,70 @@
+#ifndef OUTBOUND_QUEUE_HPP
+#define OUTBOUND_QUEUE_HPP
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <sys/types.h>
+
+// Bytes waiting to go out on one connection, in order: serialized headers
+// and bodies held in memory, and ranges of open files that are sent
+// straight from the page cache. write_to() resumes at the exact byte the
+// previous call stopped at.
+class OutboundQueue
+{
+  public:
+	// Producers (pipelined requests, a CGI pipe) pause once this many
+	// bytes sit in memory and resume under the low-water mark. File
+	// ranges take no memory and do not count.
+	static const size_t HIGH_WATER = 256 * 1024;
+	static const size_t LOW_WATER = 64 * 1024;
+
+  private:
+	struct Segment
+	{
+		std::string data;    // memory segment
+		int fd;              // file segment when >= 0, owned by the queue
+		off_t offset;        // memory: bytes of data sent; file: next byte to send
+		size_t remaining;    // bytes still to send
+
+		Segment() : fd(-1), offset(0), remaining(0) {}
+	};
+
+	static const size_t MAX_IOVECS = 64;
+	static const size_t COALESCE_LIMIT = 16 * 1024;  // small appends join the last segment
+	static const size_t MAX_SENDFILE = 1024 * 1024;  // per call, so one file does not hog the loop
+
+	std::deque<Segment> segments;
+	size_t buffered;         // unsent bytes held in memory
+	size_t file_bytes;       // unsent bytes of file ranges
+
+	void pop_front();
+	ssize_t write_memory(int socket_fd, bool &socket_full);
+	ssize_t write_file(int socket_fd, bool &socket_full);
+
+	OutboundQueue(const OutboundQueue &);
+	OutboundQueue &operator=(const OutboundQueue &);
+
+  public:
+	OutboundQueue();
+	~OutboundQueue();
+
+	void append(const std::string &data);
+	void append(const char *data, size_t length);
+	// Queue `length` bytes of `fd` from `offset`; the queue closes fd
+	void append_file(int fd, off_t offset, size_t length);
+
+	// One writev() of the leading memory segments, or one sendfile() of a
+	// leading file range. Returns the bytes written, or -1 with errno set;
+	// `socket_full` is set when the socket took less than it was offered.
+	ssize_t write_to(int socket_fd, bool &socket_full);
+	void clear();
+
+	bool empty() const { return segments.empty(); }
+	size_t memory_bytes() const { return buffered; }
+	size_t size() const { return buffered + file_bytes; }
+	bool above_high_water() const { return buffered >= HIGH_WATER; }
+	bool below_low_water() const { return buffered <= LOW_WATER; }
+};
+
+#endif
@@ -0,0 +1,347 @@
+#include "scan.hpp"
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+# define SCAN_X86 1
+# include <cpuid.h>
+# include <immintrin.h>
+#endif
+
+typedef const char *(*SkipKernel)(const char *begin, const char *end);
+typedef const char *(*FindKernel)(const char *haystack, size_t length, const char *needle, size_t needle_length);
+
+// ---------------------------------------------------------------- scalar
+
+static unsigned char token_table[256];
+
+static bool fill_token_table()
+{
+	const char *separators = "\"(),/:;<=>?@[\\]{}";
+
+	for (int c = 0x21; c < 0x7f; ++c)
+		token_table[c] = std::strchr(separators, c) == NULL;
+	return true;
+}
+
+static bool token_table_ready = fill_token_table();
+
+static const char *skip_token_scalar(const char *begin, const char *end)
+{
+	while (begin < end && token_table[static_cast<unsigned char>(*begin)])
+		++begin;
+	return begin;
+}
+
+static const char *skip_visible_scalar(const char *begin, const char *end)
+{
+	while (begin < end && static_cast<unsigned char>(*begin - 0x21) <= 0x7e - 0x21)
+		++begin;
+	return begin;
+}
+
+static const char *skip_field_value_scalar(const char *begin, const char *end)
+{
+	while (begin < end)
+	{
+		unsigned char c = *begin;
+		if ((c < 0x20 && c != '\t') || c == 0x7f)
+			break;
+		++begin;
+	}
+	return begin;
+}
+
+static const char *find_scalar(const char *haystack, size_t length, const char *needle, size_t needle_length)
+{
+	const char *end = haystack + length - needle_length + 1;
+	const char *p = haystack;
+
+	while (p < end)
+	{
+		p = static_cast<const char *>(std::memchr(p, needle[0], end - p));
+		if (!p)
+			return NULL;
+		if (std::memcmp(p + 1, needle + 1, needle_length - 1) == 0)
+			return p;
+		++p;
+	}
+	return NULL;
+}
+
+#ifdef SCAN_X86
+
+// Bytes v with lo <= v <= hi, unsigned, as 0xff lanes
+# define SSE2_IN_RANGE(v, lo, hi) \
+	_mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8(v, _mm_set1_epi8(lo)), _mm_set1_epi8((hi) - (lo))), \
+		_mm_sub_epi8(v, _mm_set1_epi8(lo)))
+# define AVX2_IN_RANGE(v, lo, hi) \
+	_mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_sub_epi8(v, _mm256_set1_epi8(lo)), _mm256_set1_epi8((hi) - (lo))), \
+		_mm256_sub_epi8(v, _mm256_set1_epi8(lo)))
+
+// ------------------------------------------------------------------ SSE2
+
+// Token characters are the visible ones minus " ( ) , / : ; < = > ? @ [ \ ] { }
+static inline __m128i sse2_separators(__m128i v)
+{
+	__m128i bad = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+	bad = _mm_or_si128(bad, SSE2_IN_RANGE(v, '(', ')'));
+	bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+	bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+	bad = _mm_or_si128(bad, SSE2_IN_RANGE(v, ':', '@'));
+	bad = _mm_or_si128(bad, SSE2_IN_RANGE(v, '[', ']'));
+	bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('{')));
+	return _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('}')));
+}
+
+static const char *skip_token_sse2(const char *begin, const char *end)
+{
+	for (; end - begin >= 16; begin += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+		__m128i good = _mm_andnot_si128(sse2_separators(v), SSE2_IN_RANGE(v, 0x21, 0x7e));
+		unsigned mask = ~_mm_movemask_epi8(good) & 0xffff;
+		if (mask)
+			return begin + __builtin_ctz(mask);
+	}
+	return skip_token_scalar(begin, end);
+}
+
+static const char *skip_visible_sse2(const char *begin, const char *end)
+{
+	for (; end - begin >= 16; begin += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+		unsigned mask = ~_mm_movemask_epi8(SSE2_IN_RANGE(v, 0x21, 0x7e)) & 0xffff;
+		if (mask)
+			return begin + __builtin_ctz(mask);
+	}
+	return skip_visible_scalar(begin, end);
+}
+
+static const char *skip_field_value_sse2(const char *begin, const char *end)
+{
+	for (; end - begin >= 16; begin += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+		__m128i bad = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), SSE2_IN_RANGE(v, 0, 0x1f));
+		bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+		unsigned mask = _mm_movemask_epi8(bad);
+		if (mask)
+			return begin + __builtin_ctz(mask);
+	}
+	return skip_field_value_scalar(begin, end);
+}
+
+// Candidates are positions where both the first and the last byte of the
+// needle match; only those are compared in full
+static const char *find_sse2(const char *haystack, size_t length, const char *needle, size_t needle_length)
+{
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+	size_t i = 0;
+
+	for (; i + needle_length - 1 + 16 <= length; i += 16)
+	{
+		__m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + i));
+		__m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + i + needle_length - 1));
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+			_mm_cmpeq_epi8(last, block_last)));
+		while (mask)
+		{
+			size_t at = i + __builtin_ctz(mask);
+			if (std::memcmp(haystack + at + 1, needle + 1, needle_length - 1) == 0)
+				return haystack + at;
+			mask &= mask - 1;
+		}
+	}
+	if (length - i < needle_length)
+		return NULL;
+	return find_scalar(haystack + i, length - i, needle, needle_length);
+}
+
+// ------------------------------------------------------------------ AVX2
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_separators(__m256i v)
+{
+	__m256i bad = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+	bad = _mm256_or_si256(bad, AVX2_IN_RANGE(v, '(', ')'));
+	bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')));
+	bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+	bad = _mm256_or_si256(bad, AVX2_IN_RANGE(v, ':', '@'));
+	bad = _mm256_or_si256(bad, AVX2_IN_RANGE(v, '[', ']'));
+	bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('{')));
+	return _mm256_or_si256(bad, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}')));
+}
+
+__attribute__((target("avx2")))
+static const char *skip_token_avx2(const char *begin, const char *end)
+{
+	for (; end - begin >= 32; begin += 32)
+	{
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+		__m256i good = _mm256_andnot_si256(avx2_separators(v), AVX2_IN_RANGE(v, 0x21, 0x7e));
+		unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(good));
+		if (mask)
+			return begin + __builtin_ctz(mask);
+	}
+	return skip_token_sse2(begin, end);
+}
+
+__attribute__((target("avx2")))
+static const char *skip_visible_avx2(const char *begin, const char *end)
+{
+	for (; end - begin >= 32; begin += 32)
+	{
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+		unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(AVX2_IN_RANGE(v, 0x21, 0x7e)));
+		if (mask)
+			return begin + __builtin_ctz(mask);
+	}
+	return skip_visible_sse2(begin, end);
+}
+
+__attribute__((target("avx2")))
+static const char *skip_field_value_avx2(const char *begin, const char *end)
+{
+	for (; end - begin >= 32; begin += 32)
+	{
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+		__m256i bad = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')), AVX2_IN_RANGE(v, 0, 0x1f));
+		bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f)));
+		unsigned mask = _mm256_movemask_epi8(bad);
+		if (mask)
+			return begin + __builtin_ctz(mask);
+	}
+	return skip_field_value_sse2(begin, end);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *haystack, size_t length, const char *needle, size_t needle_length)
+{
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+	size_t i = 0;
+
+	for (; i + needle_length - 1 + 32 <= length; i += 32)
+	{
+		__m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(haystack + i));
+		__m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(haystack + i + needle_length - 1));
+		unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+			_mm256_cmpeq_epi8(last, block_last)));
+		while (mask)
+		{
+			size_t at = i + __builtin_ctz(mask);
+			if (std::memcmp(haystack + at + 1, needle + 1, needle_length - 1) == 0)
+				return haystack + at;
+			mask &= mask - 1;
+		}
+	}
+	if (length - i < needle_length)
+		return NULL;
+	return find_sse2(haystack + i, length - i, needle, needle_length);
+}
+
+// AVX2 needs the CPU feature and an OS that saves the YMM registers
+static bool cpu_has_avx2()
+{
+	unsigned eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+		return false;
+	unsigned xcr0_low, xcr0_high;
+	__asm__ ("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+	if ((xcr0_low & 0x6) != 0x6)
+		return false;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (ebx & bit_AVX2) != 0;
+}
+
+#endif // SCAN_X86
+
+// -------------------------------------------------------------- dispatch
+
+static Scan::Level current_level = Scan::SCALAR;
+static SkipKernel token_kernel = skip_token_scalar;
+static SkipKernel visible_kernel = skip_visible_scalar;
+static SkipKernel field_value_kernel = skip_field_value_scalar;
+static FindKernel find_kernel = find_scalar;
+
+void Scan::select(Level max)
+{
+	(void)token_table_ready;
+	current_level = SCALAR;
+	token_kernel = skip_token_scalar;
+	visible_kernel = skip_visible_scalar;
+	field_value_kernel = skip_field_value_scalar;
+	find_kernel = find_scalar;
+#ifdef SCAN_X86
+	if (max >= SSE2)
+	{
+		current_level = SSE2;
+		token_kernel = skip_token_sse2;
+		visible_kernel = skip_visible_sse2;
+		field_value_kernel = skip_field_value_sse2;
+		find_kernel = find_sse2;
+	}
+	if (max >= AVX2 && cpu_has_avx2())
+	{
+		current_level = AVX2;
+		token_kernel = skip_token_avx2;
+		visible_kernel = skip_visible_avx2;
+		field_value_kernel = skip_field_value_avx2;
+		find_kernel = find_avx2;
+	}
+#endif
+}
+
+Scan::Level Scan::level()
+{
+	return current_level;
+}
+
+const char *Scan::level_name()
+{
+	switch (current_level)
+	{
+	case AVX2:
+		return "avx2";
+	case SSE2:
+		return "sse2";
+	default:
+		return "scalar";
+	}
+}
+
+const char *Scan::skip_token(const char *begin, const char *end)
+{
+	return token_kernel(begin, end);
+}
+
+const char *Scan::skip_visible(const char *begin, const char *end)
+{
+	return visible_kernel(begin, end);
+}
+
+const char *Scan::skip_field_value(const char *begin, const char *end)
+{
+	return field_value_kernel(begin, end);
+}
+
+size_t Scan::find(const std::string &haystack, const char *needle, size_t needle_length, size_t from)
+{
+	if (from > haystack.size() || haystack.size() - from < needle_length)
+		return std::string::npos;
+	if (needle_length == 0)
+		return from;
+	const char *found = find_kernel(haystack.data() + from, haystack.size() - from, needle, needle_length);
+	return found ? static_cast<size_t>(found - haystack.data()) : std::string::npos;
+}
+
+size_t Scan::find(const std::string &haystack, const std::string &needle, size_t from)
+{
+	return find(haystack, needle.data(), needle.size(), from);
+}
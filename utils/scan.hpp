@@ -0,0 +1,43 @@
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+#include <cstddef>
+#include <string>
+
+// Byte scanning kernels for the request parser and the body and CGI output
+// splitters. Each kernel has a portable scalar version and, on x86, SSE2
+// and AVX2 versions; select() picks the widest the CPU supports, once,
+// before any event loop starts.
+class Scan
+{
+	Scan();
+
+  public:
+	enum Level
+	{
+		SCALAR,
+		SSE2,
+		AVX2
+	};
+
+	// Use the best kernels the CPU offers, up to `max`. Not thread-safe:
+	// called from main before threads start.
+	static void select(Level max = AVX2);
+	static Level level();
+	static const char *level_name();
+
+	// First byte of [begin, end) that is not an RFC 9110 token character
+	// (method, header name), or end
+	static const char *skip_token(const char *begin, const char *end);
+	// First byte outside visible ASCII 0x21-0x7e (request target, version)
+	static const char *skip_visible(const char *begin, const char *end);
+	// First byte that cannot appear in a field value: a control character
+	// other than tab, i.e. CR at the end of the line
+	static const char *skip_field_value(const char *begin, const char *end);
+
+	// First occurrence of `needle` at or after `from`, like std::string::find
+	static size_t find(const std::string &haystack, const char *needle, size_t needle_length, size_t from = 0);
+	static size_t find(const std::string &haystack, const std::string &needle, size_t from = 0);
+};
+
+#endif
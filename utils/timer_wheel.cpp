@@ -0,0 +1,154 @@
+#include "timer_wheel.hpp"
+#include <ctime>
+
+TimerWheel::TimerWheel() : armed_count(0)
+{
+	for (size_t i = 0; i < LEVEL0_SLOTS; ++i)
+		level0[i].prev = level0[i].next = &level0[i];
+	for (size_t i = 0; i < LEVEL1_SLOTS; ++i)
+		level1[i].prev = level1[i].next = &level1[i];
+	now_ms = monotonic_ms();
+	current_tick = now_ms / TICK_MS;
+}
+
+uint64_t TimerWheel::monotonic_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Read the clock once per loop iteration; everything armed during the
+// iteration uses this value
+void TimerWheel::update_clock()
+{
+	now_ms = monotonic_ms();
+}
+
+uint64_t TimerWheel::now() const
+{
+	return now_ms;
+}
+
+void TimerWheel::link(TimerNode *head, TimerNode *node)
+{
+	node->prev = head->prev;
+	node->next = head;
+	head->prev->next = node;
+	head->prev = node;
+}
+
+void TimerWheel::unlink(TimerNode *node)
+{
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->prev = NULL;
+	node->next = NULL;
+}
+
+// File the node in the slot the wheel reaches first at or before its
+// deadline. Deadlines past the level 1 horizon go to its farthest slot and
+// are filed again when that slot is spread.
+void TimerWheel::place(TimerNode *node)
+{
+	uint64_t delta = node->expires_tick - current_tick;
+
+	if (delta < LEVEL0_SLOTS)
+		link(&level0[node->expires_tick % LEVEL0_SLOTS], node);
+	else if (delta < LEVEL0_SLOTS * LEVEL1_SLOTS)
+		link(&level1[(node->expires_tick / LEVEL0_SLOTS) % LEVEL1_SLOTS], node);
+	else
+		link(&level1[(current_tick / LEVEL0_SLOTS + LEVEL1_SLOTS - 1) % LEVEL1_SLOTS], node);
+}
+
+void TimerWheel::cascade(size_t slot)
+{
+	TimerNode *head = &level1[slot];
+
+	while (head->next != head)
+	{
+		TimerNode *node = head->next;
+		unlink(node);
+		place(node);
+	}
+}
+
+// (Re)start the node's countdown from the cached clock
+void TimerWheel::arm(TimerNode *node, uint64_t timeout_ms)
+{
+	if (node->armed())
+		unlink(node);
+	else
+		armed_count++;
+	node->expires_tick = (now_ms + timeout_ms + TICK_MS - 1) / TICK_MS;
+	if (node->expires_tick <= current_tick)
+		node->expires_tick = current_tick + 1;
+	place(node);
+}
+
+void TimerWheel::cancel(TimerNode *node)
+{
+	if (!node->armed())
+		return;
+	unlink(node);
+	armed_count--;
+}
+
+// Advance to the cached clock and collect the fds whose timers ran out.
+// Fired nodes are unlinked; owners may re-arm them while handling the fd.
+void TimerWheel::expire(std::vector<int> &fired)
+{
+	uint64_t target = now_ms / TICK_MS;
+
+	if (armed_count == 0)
+	{
+		if (target > current_tick)
+			current_tick = target;
+		return;
+	}
+	while (current_tick < target)
+	{
+		current_tick++;
+		if (current_tick % LEVEL0_SLOTS == 0)
+			cascade((current_tick / LEVEL0_SLOTS) % LEVEL1_SLOTS);
+		TimerNode *head = &level0[current_tick % LEVEL0_SLOTS];
+		while (head->next != head)
+		{
+			TimerNode *node = head->next;
+			unlink(node);
+			armed_count--;
+			fired.push_back(node->fd);
+		}
+	}
+}
+
+// Milliseconds until the wheel next has work (a level 0 slot with timers or
+// a level 1 slot to spread), -1 when nothing is armed. Used as the
+// epoll_wait timeout.
+int TimerWheel::next_timeout() const
+{
+	if (armed_count == 0)
+		return -1;
+	for (uint64_t tick = current_tick + 1; tick <= current_tick + LEVEL0_SLOTS; ++tick)
+	{
+		const TimerNode *head = &level0[tick % LEVEL0_SLOTS];
+		bool due = head->next != head;
+		if (!due && tick % LEVEL0_SLOTS == 0)
+		{
+			head = &level1[(tick / LEVEL0_SLOTS) % LEVEL1_SLOTS];
+			due = head->next != head;
+		}
+		if (due)
+		{
+			uint64_t at = tick * TICK_MS;
+			return at > now_ms ? static_cast<int>(at - now_ms) : 0;
+		}
+	}
+	return static_cast<int>(LEVEL0_SLOTS * TICK_MS);
+}
+
+size_t TimerWheel::size() const
+{
+	return armed_count;
+}
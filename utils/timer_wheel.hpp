@@ -0,0 +1,68 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+// Intrusive link embedded in whatever owns a timeout (Client, CgiProcess).
+// Copies start out unlinked: only the original is on the wheel.
+struct TimerNode
+{
+	TimerNode *prev;
+	TimerNode *next;
+	uint64_t expires_tick;
+	int fd;                  // owner fd, reported when the timer fires
+
+	TimerNode() : prev(NULL), next(NULL), expires_tick(0), fd(-1) {}
+	TimerNode(const TimerNode &other) : prev(NULL), next(NULL), expires_tick(0), fd(other.fd) {}
+	TimerNode &operator=(const TimerNode &other)
+	{
+		fd = other.fd;
+		return *this;
+	}
+	bool armed() const { return prev != NULL; }
+};
+
+// Two-level hierarchical timing wheel on a cached monotonic clock. Level 0
+// has one slot per tick, level 1 one slot per 256 ticks; level 1 slots are
+// spread into level 0 as the wheel reaches them. Arming, re-arming and
+// cancelling are O(1) list operations.
+class TimerWheel
+{
+  public:
+	static const uint64_t TICK_MS = 100;
+
+  private:
+	static const size_t LEVEL0_SLOTS = 256;
+	static const size_t LEVEL1_SLOTS = 64;
+
+	TimerNode level0[LEVEL0_SLOTS];   // list heads
+	TimerNode level1[LEVEL1_SLOTS];
+	uint64_t current_tick;            // every tick up to this one has been processed
+	uint64_t now_ms;
+	size_t armed_count;
+
+	void link(TimerNode *head, TimerNode *node);
+	void unlink(TimerNode *node);
+	void place(TimerNode *node);
+	void cascade(size_t slot);
+
+	TimerWheel(const TimerWheel &);
+	TimerWheel &operator=(const TimerWheel &);
+
+  public:
+	TimerWheel();
+
+	static uint64_t monotonic_ms();
+	void update_clock();
+	uint64_t now() const;
+
+	void arm(TimerNode *node, uint64_t timeout_ms);
+	void cancel(TimerNode *node);
+	void expire(std::vector<int> &fired);
+	int next_timeout() const;
+	size_t size() const;
+};
+
+#endif
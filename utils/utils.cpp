@@ -1,4 +1,5 @@
 #include "utils.hpp"
+#include "logger.hpp"
 #include "../config/parser.hpp"
 #include <string>
 #include <sstream>
@@ -75,7 +76,7 @@ std::string resolve_file_path(const std::string& request_path, LocationContext*
 	if (location_config->path != "/" && request_path.find(location_config->path) == 0)
 	{
 		relative_path = request_path.substr(location_config->path.length());
-		std::cout << "Extracted relative path: " << relative_path << std::endl;
+		LOG_DEBUG("Extracted relative path: " << relative_path);
 
 		if (!relative_path.empty() && relative_path[0] != '/')
 			relative_path = "/" + relative_path;
@@ -85,6 +86,6 @@ std::string resolve_file_path(const std::string& request_path, LocationContext*
 	
 	std::string file_path = root + relative_path;
 
-	std::cout << "Resolved file path: " << file_path << std::endl;
+	LOG_DEBUG("Resolved file path: " << file_path);
 	return file_path;
 }
\ No newline at end of file